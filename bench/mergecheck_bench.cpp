@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <ftw.h>
+
+#include <boost/program_options.hpp>
+#include <git2.h>
+
+#include "mergecheck/checker.hpp"
+#include "mergecheck/utils.hpp"
+#include "repo_generator.hpp"
+
+namespace po = boost::program_options;
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double msSince(Clock::time_point Start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - Start)
+      .count();
+}
+
+/**
+ * Nearest-rank percentile of the sorted \p Samples.
+ */
+double percentile(const std::vector<double> &Samples, double P) {
+  if (Samples.empty()) {
+    return 0;
+  }
+  size_t Rank = static_cast<size_t>(std::ceil(P / 100 * Samples.size()));
+  return Samples[std::max<size_t>(Rank, 1) - 1];
+}
+
+/**
+ * Replace every shape by one copy per value of \p Values (if any), with the
+ * member \p Member set to that value.
+ */
+template <typename T>
+void expand(std::vector<RepoShape> &Shapes, const std::vector<T> &Values,
+            T RepoShape::*Member) {
+  if (Values.empty()) {
+    return;
+  }
+  std::vector<RepoShape> Expanded;
+  for (const auto &Shape : Shapes) {
+    for (const T &Value : Values) {
+      Expanded.push_back(Shape);
+      Expanded.back().*Member = Value;
+    }
+  }
+  Shapes.swap(Expanded);
+}
+
+struct Measurement {
+  std::string Check;
+  RepoShape Shape;
+  unsigned MergeJobs = 1;
+  double GenerateMs = 0;
+  size_t Trials = 0;
+  /** Latency of every single check of every trial. */
+  std::vector<double> LatenciesMs;
+  /** Checks per second of every trial. */
+  std::vector<double> Throughputs;
+  size_t Conflicting = 0;
+  size_t ExpectedConflicting = 0;
+};
+
+void printJson(std::ostream &O, const Measurement &M) {
+  const RepoShape &S = M.Shape;
+  O << "{\"check\":\"" << M.Check << "\",\"files\":" << S.Files
+    << ",\"depth\":" << S.Depth << ",\"history\":" << S.History
+    << ",\"branches\":" << S.Branches
+    << ",\"branch_commits\":" << S.BranchCommits
+    << ",\"edits_per_commit\":" << S.EditsPerCommit
+    << ",\"file_size\":" << S.FileSize << ",\"rename_rate\":" << S.RenameRate
+    << ",\"conflict_rate\":" << S.ConflictRate << ",\"seed\":" << S.Seed
+    << ",\"merge_jobs\":" << M.MergeJobs
+    << ",\"generate_ms\":" << M.GenerateMs << ",\"trials\":" << M.Trials
+    << ",\"samples\":" << M.LatenciesMs.size()
+    << ",\"conflicting\":" << M.Conflicting
+    << ",\"expected_conflicting\":" << M.ExpectedConflicting
+    << ",\"min_ms\":" << percentile(M.LatenciesMs, 0)
+    << ",\"median_ms\":" << percentile(M.LatenciesMs, 50)
+    << ",\"p90_ms\":" << percentile(M.LatenciesMs, 90)
+    << ",\"p99_ms\":" << percentile(M.LatenciesMs, 99)
+    << ",\"max_ms\":" << percentile(M.LatenciesMs, 100)
+    << ",\"median_checks_per_s\":" << percentile(M.Throughputs, 50) << "}"
+    << std::endl;
+}
+
+void printCsvHeader(std::ostream &O) {
+  O << "check,files,depth,history,branches,branch_commits,edits_per_commit,"
+       "file_size,rename_rate,conflict_rate,seed,merge_jobs,generate_ms,"
+       "trials,samples,conflicting,expected_conflicting,min_ms,median_ms,"
+       "p90_ms,p99_ms,max_ms,median_checks_per_s"
+    << std::endl;
+}
+
+void printCsv(std::ostream &O, const Measurement &M) {
+  const RepoShape &S = M.Shape;
+  O << M.Check << "," << S.Files << "," << S.Depth << "," << S.History << ","
+    << S.Branches << "," << S.BranchCommits << "," << S.EditsPerCommit << ","
+    << S.FileSize << "," << S.RenameRate << "," << S.ConflictRate << ","
+    << S.Seed << "," << M.MergeJobs << "," << M.GenerateMs << ","
+    << M.Trials << "," << M.LatenciesMs.size() << "," << M.Conflicting << ","
+    << M.ExpectedConflicting << "," << percentile(M.LatenciesMs, 0) << ","
+    << percentile(M.LatenciesMs, 50) << "," << percentile(M.LatenciesMs, 90)
+    << "," << percentile(M.LatenciesMs, 99) << ","
+    << percentile(M.LatenciesMs, 100) << "," << percentile(M.Throughputs, 50)
+    << std::endl;
+}
+
+/**
+ * Run \p Check on every branch of \p Repo, \p Warmup times without and
+ * \p Trials times with recording.
+ */
+Status measure(Checker &C, const GeneratedRepo &Repo, const std::string &Check,
+               const CheckOptions &Opts, size_t Warmup, size_t Trials,
+               Measurement &M) {
+  M.Check = Check;
+  M.Trials = Trials;
+  M.ExpectedConflicting = static_cast<size_t>(
+      std::count(Repo.Conflicting.begin(), Repo.Conflicting.end(), true));
+
+  std::vector<Conflict> Conflicts;
+  for (size_t Trial = 0; Trial < Warmup + Trials; ++Trial) {
+    bool Recorded = Trial >= Warmup;
+    size_t Conflicting = 0;
+    auto TrialStart = Clock::now();
+    for (const auto &Branch : Repo.Branches) {
+      auto Start = Clock::now();
+      Status S = Check == "merge"
+                     ? C.merge(Repo.Master, Branch, Opts, Conflicts)
+                     : C.rebase(Repo.Master, Branch, "", Opts, Conflicts);
+      if (!S.ok()) {
+        return S;
+      }
+      if (Recorded) {
+        M.LatenciesMs.push_back(msSince(Start));
+      }
+      Conflicting += Conflicts.empty() ? 0 : 1;
+    }
+    if (Recorded) {
+      double TrialMs = msSince(TrialStart);
+      M.Throughputs.push_back(
+          TrialMs > 0 ? Repo.Branches.size() * 1000.0 / TrialMs : 0);
+      M.Conflicting = Conflicting;
+    }
+  }
+
+  std::sort(M.LatenciesMs.begin(), M.LatenciesMs.end());
+  std::sort(M.Throughputs.begin(), M.Throughputs.end());
+  return Status();
+}
+
+int removeEntry(const char *Path, const struct stat *, int, struct FTW *) {
+  return ::remove(Path);
+}
+
+void removeTree(const std::string &Path) {
+  nftw(Path.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::string WorkDir;
+  std::string Format = "json";
+  std::vector<std::string> Checks;
+  std::vector<size_t> Files, History, Branches, BranchCommits, FileSizes;
+  std::vector<unsigned> Depths, MergeJobs;
+  std::vector<double> RenameRates, ConflictRates;
+  size_t Trials = 5;
+  size_t Warmup = 1;
+  RepoShape Base;
+  CheckOptions CheckOpts;
+
+  /* clang-format off */
+  po::options_description Desc("Options for mergecheck-bench");
+  Desc.add_options()
+    ("work-dir", po::value<std::string>(&WorkDir),
+       "Directory for the generated repositories (default: a new temporary "
+       "directory).")
+    ("keep", "Keep the generated repositories.")
+    ("check", po::value<std::vector<std::string>>(&Checks)->composing(),
+       "Check to measure, \'merge\' or \'rebase\'. Can be repeated "
+       "(default: both).")
+    ("files", po::value<std::vector<size_t>>(&Files)->multitoken(),
+       "Number of files (default: 1000).")
+    ("depth", po::value<std::vector<unsigned>>(&Depths)->multitoken(),
+       "Directory levels above the files (default: 2).")
+    ("history", po::value<std::vector<size_t>>(&History)->multitoken(),
+       "Number of commits on master (default: 20).")
+    ("branches", po::value<std::vector<size_t>>(&Branches)->multitoken(),
+       "Number of branches, i.e. checks per trial (default: 8).")
+    ("branch-commits",
+       po::value<std::vector<size_t>>(&BranchCommits)->multitoken(),
+       "Number of commits on every branch (default: 5).")
+    ("file-size", po::value<std::vector<size_t>>(&FileSizes)->multitoken(),
+       "Approximate size of every file in bytes (default: 4096).")
+    ("rename-rate",
+       po::value<std::vector<double>>(&RenameRates)->multitoken(),
+       "Fraction of branch changes that rename a file changed on master "
+       "(default: 0).")
+    ("conflict-rate",
+       po::value<std::vector<double>>(&ConflictRates)->multitoken(),
+       "Fraction of branches that conflict with master (default: 0.25).")
+    ("edits-per-commit", po::value<size_t>(&Base.EditsPerCommit),
+       "Files changed by every commit (default: 4).")
+    ("seed", po::value<uint64_t>(&Base.Seed),
+       "Seed of the generator (default: 1).")
+    ("trials", po::value<size_t>(&Trials),
+       "Measured runs over all branches (default: 5).")
+    ("warmup", po::value<size_t>(&Warmup),
+       "Unmeasured runs before the trials (default: 1).")
+    ("rebase-jobs", po::value<unsigned>(&CheckOpts.RebaseJobs),
+       "Threads for replaying the commits of a rebase (default: 1).")
+    ("merge-jobs", po::value<std::vector<unsigned>>(&MergeJobs)->multitoken(),
+       "Threads merging the top-level directories of a merge separately "
+       "(default: 1). Wide trees show the speedup, e.g. \'--depth 1\'.")
+    ("per-commit",
+       "Do not try a squashed merge before replaying a rebase commit by "
+       "commit.")
+    ("format", po::value<std::string>(&Format),
+       "Output format, \'json\' (one object per line) or \'csv\' "
+       "(default: json).")
+    ("help,h", "Print this help text.")
+  ;
+  /* clang-format on */
+
+  po::variables_map Vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, Desc), Vm);
+    po::notify(Vm);
+  } catch (const std::exception &Ex) {
+    std::cerr << "\n" << Ex.what() << "\n\n";
+    return EXIT_FAILURE;
+  }
+
+  if (Vm.count("help")) {
+    std::cout << "USAGE: mergecheck-bench [options]\n\n"
+                 "Generates repositories for every combination of the given "
+                 "dimensions and measures the checks of all their branches "
+                 "against master. Several values can be given for every "
+                 "dimension, e.g. \'--files 1000 10000\'.\n\n"
+              << Desc;
+    return EXIT_SUCCESS;
+  }
+  if (Format != "json" && Format != "csv") {
+    std::cerr << "Error: Unknown format \'" << Format << "\'.\n";
+    return EXIT_FAILURE;
+  }
+  if (Checks.empty()) {
+    Checks = {"merge", "rebase"};
+  }
+  for (const auto &Check : Checks) {
+    if (Check != "merge" && Check != "rebase") {
+      std::cerr << "Error: Unknown check \'" << Check << "\'.\n";
+      return EXIT_FAILURE;
+    }
+  }
+  CheckOpts.SquashFirst = Vm.count("per-commit") == 0;
+  if (MergeJobs.empty()) {
+    MergeJobs = {1};
+  }
+
+  std::vector<RepoShape> Shapes = {Base};
+  expand(Shapes, Files, &RepoShape::Files);
+  expand(Shapes, Depths, &RepoShape::Depth);
+  expand(Shapes, History, &RepoShape::History);
+  expand(Shapes, Branches, &RepoShape::Branches);
+  expand(Shapes, BranchCommits, &RepoShape::BranchCommits);
+  expand(Shapes, FileSizes, &RepoShape::FileSize);
+  expand(Shapes, RenameRates, &RepoShape::RenameRate);
+  expand(Shapes, ConflictRates, &RepoShape::ConflictRate);
+
+  bool TempDir = WorkDir.empty();
+  if (TempDir) {
+    char Template[] = "/tmp/mergecheck-bench-XXXXXX";
+    if (!mkdtemp(Template)) {
+      std::cerr << "Error: Could not create a temporary directory.\n";
+      return EXIT_FAILURE;
+    }
+    WorkDir = Template;
+  }
+  bool Keep = Vm.count("keep") > 0;
+
+  git_libgit2_init();
+  if (Format == "csv") {
+    printCsvHeader(std::cout);
+  }
+
+  int ExitCode = EXIT_SUCCESS;
+  for (size_t I = 0; I < Shapes.size() && ExitCode == EXIT_SUCCESS; ++I) {
+    std::string Path = WorkDir + "/repo-" + std::to_string(I) + ".git";
+    std::cerr << "Generating " << Path << "..." << std::endl;
+
+    GeneratedRepo Repo;
+    auto Start = Clock::now();
+    try {
+      Repo = generateRepo(Path, Shapes[I]);
+    } catch (const GitError &Ex) {
+      std::cerr << Ex.what() << "\n";
+      ExitCode = EXIT_FAILURE;
+      break;
+    }
+    double GenerateMs = msSince(Start);
+
+    std::unique_ptr<Checker> C;
+    Status S = Checker::open(Path, C);
+    for (size_t K = 0; S.ok() && K < Checks.size(); ++K) {
+      // rebases replay commit by commit; only merges are sharded
+      size_t Runs = Checks[K] == "merge" ? MergeJobs.size() : 1;
+      for (size_t J = 0; S.ok() && J < Runs; ++J) {
+        Measurement M;
+        M.Shape = Shapes[I];
+        M.GenerateMs = GenerateMs;
+        M.MergeJobs = Checks[K] == "merge" ? MergeJobs[J] : 1;
+        CheckOptions Opts = CheckOpts;
+        Opts.MergeJobs = M.MergeJobs;
+        S = measure(*C, Repo, Checks[K], Opts, Warmup, Trials, M);
+        if (S.ok()) {
+          if (Format == "csv") {
+            printCsv(std::cout, M);
+          } else {
+            printJson(std::cout, M);
+          }
+        }
+      }
+    }
+    if (!S.ok()) {
+      std::cerr << S.Message << "\n";
+      ExitCode = EXIT_FAILURE;
+    }
+    C.reset();
+
+    if (!Keep) {
+      removeTree(Path);
+    }
+  }
+
+  if (TempDir && !Keep) {
+    removeTree(WorkDir);
+  } else if (Keep) {
+    std::cerr << "Kept the repositories in " << WorkDir << "." << std::endl;
+  }
+  git_libgit2_shutdown();
+  return ExitCode;
+}
@@ -0,0 +1,367 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <git2.h>
+
+#include "mergecheck/handles.hpp"
+#include "mergecheck/utils.hpp"
+#include "repo_generator.hpp"
+
+namespace {
+const size_t LineLength = 64;
+const size_t FilesPerDir = 16;
+const git_time_t Epoch = 1500000000;
+
+uint64_t mix(uint64_t X) {
+  X += 0x9e3779b97f4a7c15ULL;
+  X = (X ^ (X >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  X = (X ^ (X >> 27)) * 0x94d049bb133111ebULL;
+  return X ^ (X >> 31);
+}
+
+/**
+ * splitmix64; unlike the <random> distributions, its output is the same with
+ * every standard library.
+ */
+class Rng {
+public:
+  explicit Rng(uint64_t Seed) : State(Seed) {}
+
+  uint64_t next() { return mix(State++); }
+  size_t below(size_t N) { return N ? next() % N : 0; }
+  double unit() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+private:
+  uint64_t State;
+};
+
+struct FileState {
+  uint64_t Seed = 0;
+  /** Replaced lines: line number -> seed of the new content. */
+  std::map<size_t, uint64_t> Edits;
+  git_oid Id;
+  bool Written = false;
+};
+
+struct Dir {
+  std::map<std::string, Dir> Dirs;
+  std::map<std::string, FileState> Files;
+  git_oid Id;
+  bool Dirty = true;
+};
+
+void appendLine(std::string &Out, uint64_t Seed, size_t Line) {
+  static const char Hex[] = "0123456789abcdef";
+  uint64_t X = mix(Seed ^ mix(Line));
+  for (size_t I = 0; I + 1 < LineLength; ++I) {
+    if (I % 16 == 0) {
+      X = mix(X);
+    }
+    Out += Hex[(X >> (4 * (I % 16))) & 0xf];
+  }
+  Out += '\n';
+}
+
+std::vector<std::string> splitPath(const std::string &Path) {
+  std::vector<std::string> Parts;
+  size_t Start = 0;
+  for (size_t Slash; (Slash = Path.find('/', Start)) != std::string::npos;
+       Start = Slash + 1) {
+    Parts.push_back(Path.substr(Start, Slash - Start));
+  }
+  Parts.push_back(Path.substr(Start));
+  return Parts;
+}
+
+/**
+ * The tree of one commit. Blobs and trees are only written for files and
+ * directories that changed since the last commit.
+ */
+class Snapshot {
+public:
+  explicit Snapshot(size_t Lines) : Lines(Lines) {}
+
+  void add(const std::string &Path, uint64_t Seed) {
+    FileState File;
+    File.Seed = Seed;
+    file(Path, true) = File;
+  }
+
+  void edit(const std::string &Path, size_t Line, uint64_t Seed) {
+    FileState &File = file(Path, true);
+    File.Edits[Line] = Seed;
+    File.Written = false;
+  }
+
+  void rename(const std::string &From, const std::string &To) {
+    auto Parts = splitPath(From);
+    Dir *Parent = &Root;
+    Parent->Dirty = true;
+    for (size_t I = 0; I + 1 < Parts.size(); ++I) {
+      Parent = &Parent->Dirs[Parts[I]];
+      Parent->Dirty = true;
+    }
+    FileState File = Parent->Files[Parts.back()];
+    Parent->Files.erase(Parts.back());
+    file(To, true) = File;
+  }
+
+  git_oid write(git_repository *Repo) {
+    writeDir(Repo, Root);
+    return Root.Id;
+  }
+
+private:
+  FileState &file(const std::string &Path, bool MarkDirty) {
+    auto Parts = splitPath(Path);
+    Dir *Parent = &Root;
+    Parent->Dirty |= MarkDirty;
+    for (size_t I = 0; I + 1 < Parts.size(); ++I) {
+      Parent = &Parent->Dirs[Parts[I]];
+      Parent->Dirty |= MarkDirty;
+    }
+    return Parent->Files[Parts.back()];
+  }
+
+  git_oid blob(git_repository *Repo, FileState &File) {
+    if (!File.Written) {
+      std::string Content;
+      Content.reserve(Lines * LineLength);
+      for (size_t Line = 0; Line < Lines; ++Line) {
+        auto Edit = File.Edits.find(Line);
+        appendLine(Content, Edit == File.Edits.end() ? File.Seed : Edit->second,
+                   Line);
+      }
+      int error = git_blob_create_frombuffer(&File.Id, Repo, Content.data(),
+                                             Content.size());
+      checkError(error, "git_blob_create_frombuffer");
+      File.Written = true;
+    }
+    return File.Id;
+  }
+
+  /**
+   * Returns false for directories without files, which are left out.
+   */
+  bool writeDir(git_repository *Repo, Dir &D) {
+    if (!D.Dirty) {
+      return true;
+    }
+
+    int error;
+    git_treebuilder *Builder = nullptr;
+    error = git_treebuilder_new(&Builder, Repo, nullptr);
+    checkError(error, "git_treebuilder_new");
+
+    bool Empty = true;
+    try {
+      for (auto &KV : D.Files) {
+        git_oid Id = blob(Repo, KV.second);
+        error = git_treebuilder_insert(nullptr, Builder, KV.first.c_str(), &Id,
+                                       GIT_FILEMODE_BLOB);
+        checkError(error, "git_treebuilder_insert");
+        Empty = false;
+      }
+      for (auto &KV : D.Dirs) {
+        if (!writeDir(Repo, KV.second)) {
+          continue;
+        }
+        error = git_treebuilder_insert(nullptr, Builder, KV.first.c_str(),
+                                       &KV.second.Id, GIT_FILEMODE_TREE);
+        checkError(error, "git_treebuilder_insert");
+        Empty = false;
+      }
+      if (!Empty) {
+        error = git_treebuilder_write(&D.Id, Builder);
+        checkError(error, "git_treebuilder_write");
+      }
+    } catch (...) {
+      git_treebuilder_free(Builder);
+      throw;
+    }
+    git_treebuilder_free(Builder);
+
+    D.Dirty = Empty;
+    return !Empty;
+  }
+
+  size_t Lines;
+  Dir Root;
+};
+
+/**
+ * Directory levels are named "d<digit>", with the directory index of the file
+ * written in base \p FanOut.
+ */
+std::string filePath(size_t Index, unsigned Depth, size_t FanOut) {
+  std::string Path;
+  size_t Bucket = Index / FilesPerDir;
+  std::vector<size_t> Digits(Depth);
+  for (unsigned Level = Depth; Level > 0; --Level) {
+    Digits[Level - 1] = Bucket % FanOut;
+    Bucket /= FanOut;
+  }
+  for (size_t Digit : Digits) {
+    Path += "d" + std::to_string(Digit) + "/";
+  }
+  return Path + "f" + std::to_string(Index) + ".txt";
+}
+
+git_oid commit(git_repository *Repo, Snapshot &Tree, const git_oid *Parent,
+               const std::string &Message, git_time_t &Time) {
+  int error;
+
+  git_oid TreeId = Tree.write(Repo);
+  git_tree *RawTree = nullptr;
+  error = git_tree_lookup(&RawTree, Repo, &TreeId);
+  checkError(error, "git_tree_lookup");
+  TreePtr TreeObj(RawTree);
+
+  CommitPtr ParentCommit;
+  if (Parent) {
+    git_commit *RawParent = nullptr;
+    error = git_commit_lookup(&RawParent, Repo, Parent);
+    checkError(error, "git_commit_lookup");
+    ParentCommit.reset(RawParent);
+  }
+  const git_commit *Parents[] = {ParentCommit.get()};
+
+  git_signature *Signature = nullptr;
+  error = git_signature_new(&Signature, "mergecheck-bench",
+                            "bench@localhost", Time++, 0);
+  checkError(error, "git_signature_new");
+
+  git_oid Id;
+  error = git_commit_create(&Id, Repo, nullptr, Signature, Signature, nullptr,
+                            Message.c_str(), TreeObj.get(), Parent ? 1 : 0,
+                            Parents);
+  git_signature_free(Signature);
+  checkError(error, "git_commit_create");
+  return Id;
+}
+
+void setRef(git_repository *Repo, const std::string &Name, const git_oid &Id) {
+  git_reference *Ref = nullptr;
+  int error = git_reference_create(&Ref, Repo, Name.c_str(), &Id, 1,
+                                   "mergecheck-bench");
+  checkError(error, "git_reference_create");
+  git_reference_free(Ref);
+}
+
+struct LineEdit {
+  size_t File;
+  size_t Line;
+};
+} // namespace
+
+GeneratedRepo generateRepo(const std::string &Path, const RepoShape &Shape) {
+  int error;
+
+  size_t Files = std::max<size_t>(Shape.Files, 2);
+  size_t History = std::max<size_t>(Shape.History, 1);
+  size_t BranchCommits = std::max<size_t>(Shape.BranchCommits, 1);
+  size_t Lines = std::max<size_t>(Shape.FileSize / LineLength, 1);
+  size_t Dirs = (Files + FilesPerDir - 1) / FilesPerDir;
+  size_t FanOut = 2;
+  if (Shape.Depth > 0) {
+    FanOut = std::max<size_t>(
+        2, static_cast<size_t>(std::ceil(
+               std::pow(static_cast<double>(Dirs), 1.0 / Shape.Depth))));
+  }
+  auto pathOf = [&](size_t Index) {
+    return filePath(Index, Shape.Depth, FanOut);
+  };
+
+  git_repository *RawRepo = nullptr;
+  error = git_repository_init(&RawRepo, Path.c_str(), 1);
+  checkError(error, "git_repository_init");
+  RepositoryPtr Repo(RawRepo);
+
+  GeneratedRepo Result;
+  Result.Path = Path;
+  Result.Master = "refs/heads/master";
+  git_time_t Time = Epoch;
+
+  // master; the branches fork off commit Fork
+  Rng MasterRng(Shape.Seed);
+  Snapshot Master(Lines);
+  for (size_t I = 0; I < Files; ++I) {
+    Master.add(pathOf(I), MasterRng.next());
+  }
+  git_oid Head = commit(Repo.get(), Master, nullptr, "Initial commit", Time);
+
+  size_t Fork = (History - 1) / 2;
+  Snapshot AtFork = Master;
+  git_oid ForkId = Head;
+  std::vector<LineEdit> MasterEdits;
+  for (size_t K = 1; K < History; ++K) {
+    for (size_t E = 0; E < Shape.EditsPerCommit; ++E) {
+      size_t File = K > Fork ? 2 * MasterRng.below((Files + 1) / 2)
+                             : MasterRng.below(Files);
+      size_t Line = MasterRng.below(Lines);
+      Master.edit(pathOf(File), Line, MasterRng.next());
+      if (K > Fork) {
+        MasterEdits.push_back({File, Line});
+      }
+    }
+    Head = commit(Repo.get(), Master, &Head,
+                  "master commit " + std::to_string(K), Time);
+    if (K == Fork) {
+      AtFork = Master;
+      ForkId = Head;
+    }
+  }
+  setRef(Repo.get(), Result.Master, Head);
+
+  for (size_t B = 0; B < Shape.Branches; ++B) {
+    Rng BranchRng(Shape.Seed ^ mix(B + 1));
+    Snapshot Branch = AtFork;
+    std::map<size_t, std::string> Renamed;
+    auto currentPath = [&](size_t File) {
+      auto It = Renamed.find(File);
+      return It == Renamed.end() ? pathOf(File) : It->second;
+    };
+
+    bool Conflicting =
+        !MasterEdits.empty() && BranchRng.unit() < Shape.ConflictRate;
+    git_oid Tip = ForkId;
+    for (size_t C = 0; C < BranchCommits; ++C) {
+      for (size_t E = 0; E < Shape.EditsPerCommit; ++E) {
+        if (!MasterEdits.empty() && BranchRng.unit() < Shape.RenameRate) {
+          size_t File = MasterEdits[BranchRng.below(MasterEdits.size())].File;
+          if (!Renamed.count(File)) {
+            // move it into another directory, without changing the content
+            std::string To = pathOf(BranchRng.below(Files));
+            To = To.substr(0, To.rfind('/') + 1) + "r" +
+                 std::to_string(File) + ".txt";
+            Branch.rename(pathOf(File), To);
+            Renamed[File] = To;
+            continue;
+          }
+        }
+        size_t File = 2 * BranchRng.below(Files / 2) + 1;
+        Branch.edit(currentPath(File), BranchRng.below(Lines),
+                    BranchRng.next());
+      }
+      if (Conflicting && C + 1 == BranchCommits) {
+        const LineEdit &Edit =
+            MasterEdits[BranchRng.below(MasterEdits.size())];
+        Branch.edit(currentPath(Edit.File), Edit.Line, BranchRng.next());
+      }
+      Tip = commit(Repo.get(), Branch, &Tip,
+                   "branch-" + std::to_string(B) + " commit " +
+                       std::to_string(C + 1),
+                   Time);
+    }
+
+    std::string Name = "refs/heads/branch-" + std::to_string(B);
+    setRef(Repo.get(), Name, Tip);
+    Result.Branches.push_back(Name);
+    Result.Conflicting.push_back(Conflicting);
+  }
+
+  return Result;
+}
@@ -0,0 +1,53 @@
+#ifndef MERGECHECK_BENCH_REPO_GENERATOR_HPP
+#define MERGECHECK_BENCH_REPO_GENERATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Shape of a synthetic repository.
+ *
+ * "master" has History commits. The branches fork off its commit
+ * (History - 1) / 2 and have BranchCommits commits each. Every commit changes
+ * EditsPerCommit files; the master commits after the fork point only touch
+ * files with an even index, the branch commits only files with an odd index,
+ * so a branch merges cleanly unless it is one of the conflicting ones.
+ */
+struct RepoShape {
+  size_t Files = 1000;
+  /** Directory levels above the files. */
+  unsigned Depth = 2;
+  size_t History = 20;
+  size_t Branches = 8;
+  size_t BranchCommits = 5;
+  size_t EditsPerCommit = 4;
+  /** Approximate size of every file in bytes. */
+  size_t FileSize = 4096;
+  /** Fraction of branch edits that rename a file master changed. */
+  double RenameRate = 0.0;
+  /** Fraction of branches that change a line master changed, too. */
+  double ConflictRate = 0.25;
+  uint64_t Seed = 1;
+};
+
+/**
+ * Names and expected outcome of a generated repository.
+ */
+struct GeneratedRepo {
+  std::string Path;
+  std::string Master;
+  std::vector<std::string> Branches;
+  /** Whether the branch with the same index is expected to conflict. */
+  std::vector<bool> Conflicting;
+};
+
+/**
+ * Create a bare repository at \p Path that has the shape \p Shape. The same
+ * shape always produces the same objects (file contents, author dates and
+ * therefore commit ids). Throws a GitError if a libgit2 call fails.
+ */
+GeneratedRepo generateRepo(const std::string &Path, const RepoShape &Shape);
+
+#endif /* MERGECHECK_BENCH_REPO_GENERATOR_HPP */
@@ -0,0 +1,49 @@
+#ifndef MERGECHECK_ALTERNATES_HPP
+#define MERGECHECK_ALTERNATES_HPP
+
+#include <git2.h>
+#include <string>
+
+/**
+ * Prefix under which the references of alternate repositories can be
+ * resolved, e.g. "refs/alternates/fork/heads/master" names "refs/heads/master"
+ * of the alternate repository "fork".
+ */
+extern const char *const AlternateRefPrefix;
+
+/**
+ * Attach the object database of the repository at \p Path to \p Repo as a
+ * read-only alternate and register its references under
+ * "refs/alternates/<Name>/". Nothing is written to either repository; the
+ * alternate is only attached for the lifetime of \p Repo (and of all handles
+ * sharing its object database).
+ */
+void addAlternate(git_repository *Repo, const std::string &Path,
+                  const std::string &Name, bool Verbose);
+
+/**
+ * Attach the object databases of all registered alternate repositories to
+ * \p Repo as well, e.g. to a private handle opened after addAlternate().
+ */
+void attachAlternates(git_repository *Repo);
+
+/**
+ * Split an "--alternate-repo" argument of the form "[<name>=]<path>". Without
+ * an explicit name, the base name of the path (without ".git") is used.
+ */
+void parseAlternateSpec(const std::string &Spec, std::string &Name,
+                        std::string &Path);
+
+/**
+ * If \p Name lies below AlternateRefPrefix, resolve it in the registered
+ * alternate repository, store the target in \p Oid and return true. Returns
+ * false for all other names.
+ */
+bool resolveAlternateRef(const std::string &Name, git_oid &Oid);
+
+/**
+ * Close all alternate repositories.
+ */
+void releaseAlternates();
+
+#endif /* MERGECHECK_ALTERNATES_HPP */
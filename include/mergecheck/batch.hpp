@@ -0,0 +1,33 @@
+#ifndef MERGECHECK_BATCH_HPP
+#define MERGECHECK_BATCH_HPP
+
+#include <git2.h>
+#include <istream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mergecheck/options.hpp"
+
+using BranchPair = std::pair<std::string, std::string>;
+
+/**
+ * Read "<our> <their>" pairs, one per line. Empty lines and lines starting
+ * with '#' are ignored.
+ */
+std::vector<BranchPair> readBranchPairs(std::istream &In);
+
+/**
+ * Run a merge check for every pair on a thread pool with \p Jobs workers
+ * (0 = number of hardware threads). Every worker opens its own handle of the
+ * repository at \p RepoPath, but all handles share the object database of
+ * \p Repo, so pack indices and cached objects are only loaded once.
+ *
+ * One result per pair is printed to std::cout, in input order. Returns the
+ * total number of conflicts over all pairs.
+ */
+size_t batch(git_repository *Repo, const std::string &RepoPath,
+             const std::vector<BranchPair> &Pairs, unsigned Jobs,
+             const CheckOptions &Opts);
+
+#endif /* MERGECHECK_BATCH_HPP */
@@ -0,0 +1,28 @@
+#ifndef MERGECHECK_BLAME_HPP
+#define MERGECHECK_BLAME_HPP
+
+#include <git2.h>
+#include <string>
+
+#include "mergecheck/options.hpp"
+
+/**
+ * For every path on which merging \p TheirBranch into \p OurBranch conflicts,
+ * find the first commit on the first-parent history of \p OurBranch (since
+ * its merge base with \p TheirBranch) from which on the merge conflicts on
+ * that path, and print it.
+ *
+ * The history is searched for all paths at once: in every round, each
+ * unresolved path contributes probe points inside its remaining interval, and
+ * all distinct probes are merged in memory in parallel on \p Jobs workers
+ * (0 = number of hardware threads). Probe results are shared between paths.
+ * With Opts.PathFilters, each path is only probed at the merges and the
+ * commits whose filter may contain it.
+ * Returns the number of conflicting paths.
+ */
+size_t blameConflicts(git_repository *Repo, const std::string &RepoPath,
+                      const std::string &OurBranch,
+                      const std::string &TheirBranch, unsigned Jobs,
+                      const CheckOptions &Opts);
+
+#endif /* MERGECHECK_BLAME_HPP */
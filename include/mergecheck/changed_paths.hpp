@@ -0,0 +1,49 @@
+#ifndef MERGECHECK_CHANGED_PATHS_HPP
+#define MERGECHECK_CHANGED_PATHS_HPP
+
+#include <cstdint>
+#include <git2.h>
+#include <string>
+#include <vector>
+
+/**
+ * Collect the paths that differ between \p Old and \p New (either may be
+ * nullptr for an empty tree) and append them to \p Paths.
+ *
+ * Subtrees with identical ids on both sides are skipped without being loaded.
+ * An added or deleted subtree is reported as a single path, unless
+ * \p ExpandSubtrees is set, in which case all files below it are reported.
+ */
+void changedPaths(git_repository *Repo, const git_tree *Old,
+                  const git_tree *New, std::vector<std::string> &Paths,
+                  bool ExpandSubtrees = false);
+
+/**
+ * A path that differs between two trees, with the ids and modes of both
+ * sides (zero if the side has no entry).
+ */
+struct ChangedEntry {
+  std::string Path;
+  git_oid OldId;
+  git_oid NewId;
+  uint32_t OldMode;
+  uint32_t NewMode;
+};
+
+/**
+ * Like changedPaths(), but with the ids and modes of the entries. \p Prefix
+ * is prepended to all paths, e.g. when \p Old and \p New are subtrees.
+ */
+void changedEntries(git_repository *Repo, const git_tree *Old,
+                    const git_tree *New, std::vector<ChangedEntry> &Entries,
+                    bool ExpandSubtrees = false,
+                    const std::string &Prefix = "");
+
+/**
+ * Whether a path of \p A is equal to, or a parent directory of, a path of
+ * \p B, or vice versa.
+ */
+bool pathsOverlap(const std::vector<std::string> &A,
+                  const std::vector<std::string> &B);
+
+#endif /* MERGECHECK_CHANGED_PATHS_HPP */
@@ -0,0 +1,89 @@
+#ifndef MERGECHECK_CHECKER_HPP
+#define MERGECHECK_CHECKER_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mergecheck/conflict.hpp"
+#include "mergecheck/handles.hpp"
+#include "mergecheck/options.hpp"
+
+/**
+ * Result of a library call: Code is 0 on success and a libgit2 error code
+ * otherwise, with a description in Message.
+ *
+ * A check cancelled at Opts.TimeLimit has Code GIT_EUSER and TimedOut set,
+ * with the interrupted phase in Phase and, for rebases, the number of
+ * completed steps in Steps; the conflicts found so far are still stored.
+ */
+struct Status {
+  int Code = 0;
+  std::string Message;
+  bool TimedOut = false;
+  std::string Phase;
+  size_t Steps = 0;
+
+  bool ok() const { return Code == 0; }
+};
+
+/**
+ * Entry point for embedding mergecheck: a repository kept open for any number
+ * of in-process checks.
+ *
+ * Checks return the found conflicts instead of printing them; PrintConflicts
+ * and Verbose in the passed options are ignored. Errors are reported as a
+ * Status, nothing is thrown and the process is never terminated. A Checker
+ * must only be used by one thread at a time.
+ */
+class Checker {
+public:
+  /**
+   * Open the repository at \p RepoPath. Initializes libgit2 for the lifetime
+   * of the Checker.
+   */
+  static Status open(const std::string &RepoPath,
+                     std::unique_ptr<Checker> &Out);
+
+  ~Checker();
+  Checker(const Checker &) = delete;
+  Checker &operator=(const Checker &) = delete;
+
+  /**
+   * Merge \p TheirBranch into \p OurBranch in memory and store the conflicts
+   * in \p Conflicts.
+   */
+  Status merge(const std::string &OurBranch, const std::string &TheirBranch,
+               const CheckOptions &Opts, std::vector<Conflict> &Conflicts);
+
+  /**
+   * Rebase \p Branch onto \p UpstreamBranch (or \p OntoCommit, if not empty)
+   * in memory and store the conflicts of all replayed commits in
+   * \p Conflicts.
+   */
+  Status rebase(const std::string &UpstreamBranch, const std::string &Branch,
+                const std::string &OntoCommit, const CheckOptions &Opts,
+                std::vector<Conflict> &Conflicts);
+
+  /**
+   * Check the unified diff \p Patch, made against \p Base, against \p Target
+   * without committing it (see checkPatch()) and store the conflicts in
+   * \p Conflicts.
+   */
+  Status patch(const std::string &Target, const std::string &Base,
+               const std::string &Patch, const CheckOptions &Opts,
+               std::vector<Conflict> &Conflicts);
+
+  /**
+   * The underlying repository, e.g. for the command-level functions.
+   */
+  git_repository *repository() const { return Repo.get(); }
+
+private:
+  Checker() = default;
+
+  RepositoryPtr Repo;
+};
+
+#endif /* MERGECHECK_CHECKER_HPP */
@@ -1,17 +1,65 @@
 #ifndef MERGECHECK_CONFLICT_HPP
 #define MERGECHECK_CONFLICT_HPP
 
+#include <cstdint>
 #include <git2.h>
 #include <ostream>
 #include <string>
 
+/**
+ * A conflict as returned by git_index_conflict_next(). The entries point into
+ * the index and are only valid as long as the index is; use toConflict() to
+ * keep a conflict.
+ */
 typedef struct {
   const git_index_entry *Ancestor;
   const git_index_entry *Our;
   const git_index_entry *Their;
-} Conflict ;
+} IndexConflict;
 
-std::ostream &printConflict(Conflict C, const std::string &LocalRef,
+enum class ConflictKind : uint8_t {
+  Content,        ///< Both sides modified the file.
+  AddAdd,         ///< Both sides added the file.
+  DeletedInOurs,  ///< Deleted in "our" tree, modified in "their" tree.
+  DeletedInTheirs ///< Deleted in "their" tree, modified in "our" tree.
+};
+
+/**
+ * A conflict that owns its data and does not reference any index.
+ */
+struct Conflict {
+  ConflictKind Kind;
+  std::string Path;
+  /// Blob ids of the three sides; zero if the side has no entry.
+  git_oid AncestorId;
+  git_oid OurId;
+  git_oid TheirId;
+  /// File modes of the three sides; 0 if the side has no entry.
+  uint32_t AncestorMode;
+  uint32_t OurMode;
+  uint32_t TheirMode;
+};
+
+ConflictKind conflictKind(IndexConflict C);
+
+/**
+ * Path of the conflicting file.
+ */
+const char *conflictPath(IndexConflict C);
+
+Conflict toConflict(IndexConflict C);
+
+/**
+ * Short name of \p Kind for machine-readable output: "content", "add/add",
+ * "delete/modify" (deleted in ours) or "modify/delete" (deleted in theirs).
+ */
+const char *conflictKindName(ConflictKind Kind);
+
+std::ostream &printConflict(IndexConflict C, const std::string &LocalRef,
+                            const std::string &RemoteRef, std::ostream &O);
+
+std::ostream &printConflict(const Conflict &C,
+                            const std::string &LocalRef,
                             const std::string &RemoteRef, std::ostream &O);
 
 #endif /* MERGECHECK_CONFLICT_HPP */
@@ -0,0 +1,63 @@
+#ifndef MERGECHECK_CONFLICT_HUNKS_HPP
+#define MERGECHECK_CONFLICT_HUNKS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <git2.h>
+#include <ostream>
+#include <vector>
+
+#include "mergecheck/conflict.hpp"
+
+class Deadline;
+
+/**
+ * A conflicting hunk of a file-level three-way merge. Start and End are the
+ * (1-based) lines of the "<<<<<<<" and ">>>>>>>" markers in the merged file as
+ * "git merge" would write it with merge.conflictStyle=diff3.
+ */
+struct ConflictHunk {
+  size_t Start;
+  size_t End;
+  size_t OurLines;
+  size_t BaseLines;
+  size_t TheirLines;
+};
+
+enum class HunkStatus : uint8_t {
+  Merged,     ///< Hunks holds the conflicting hunks.
+  NotContent, ///< Not a content conflict, e.g. modify/delete.
+  TooLarge,   ///< A side is larger than the byte limit.
+  Binary,     ///< A side is binary.
+  Failed,     ///< A blob could not be read or merged.
+  TimedOut    ///< The deadline passed before the file was merged.
+};
+
+struct FileHunks {
+  HunkStatus Status = HunkStatus::Merged;
+  std::vector<ConflictHunk> Hunks;
+};
+
+/**
+ * Merge every conflicting file of \p Conflicts in memory and collect its
+ * conflicting hunks, using \p Jobs threads (0 = number of hardware threads).
+ * Files with a side of more than \p MaxBytes bytes are skipped before any blob
+ * is read. Files not started before \p Limit (may be nullptr) has passed are
+ * left TimedOut. Nothing is written to the repository.
+ */
+std::vector<FileHunks> conflictHunks(git_repository *Repo,
+                                     const std::vector<Conflict> &Conflicts,
+                                     unsigned Jobs, size_t MaxBytes,
+                                     const Deadline *Limit = nullptr);
+
+/**
+ * Short name of \p Status for machine-readable output, e.g. "too-large".
+ */
+const char *hunkStatusName(HunkStatus Status);
+
+/**
+ * Print one indented line per hunk (or the reason why there are none).
+ */
+std::ostream &printHunks(const FileHunks &Hunks, std::ostream &O);
+
+#endif /* MERGECHECK_CONFLICT_HUNKS_HPP */
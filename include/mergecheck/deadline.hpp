@@ -0,0 +1,112 @@
+#ifndef MERGECHECK_DEADLINE_HPP
+#define MERGECHECK_DEADLINE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <git2.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "mergecheck/utils.hpp"
+
+/**
+ * Thrown when a check is cancelled at its deadline. The conflicts found so
+ * far are still handed to the caller (see merge() and rebase()).
+ */
+class DeadlineExceeded : public GitError {
+public:
+  DeadlineExceeded(const std::string &Phase, size_t Steps = 0)
+      : GitError(GIT_EUSER, "Deadline exceeded during " + Phase),
+        Phase(Phase), Steps(Steps) {}
+
+  /// The phase that was interrupted, e.g. "merge" or "rebase step 3".
+  std::string Phase;
+  /// rebase: the number of steps that were completed.
+  size_t Steps;
+};
+
+/**
+ * A point in time at which checks are cancelled cooperatively: between rebase
+ * steps, between conflict entries and, through a rename similarity metric,
+ * between the file pairs compared by rename detection. Thread-safe.
+ */
+class Deadline {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  /// Expire \p Budget from now.
+  explicit Deadline(std::chrono::milliseconds Budget);
+  Deadline(const Deadline &) = delete;
+  Deadline &operator=(const Deadline &) = delete;
+  ~Deadline();
+
+  bool expired() const { return Clock::now() >= End; }
+  std::chrono::milliseconds budget() const { return Budget; }
+
+  /**
+   * Whether a metric returned by renameMetric() has stopped at the deadline.
+   * libgit2 reports such a failure as a generic error (-1), not GIT_EUSER, so
+   * this is how a failed merge is recognised as timed out.
+   */
+  bool fired() const { return Fired; }
+
+  /**
+   * Throw DeadlineExceeded for \p Phase if the deadline has passed.
+   */
+  void check(const std::string &Phase, size_t Steps = 0) const;
+
+  /**
+   * The rename similarity metric \p Inner (libgit2's default if nullptr),
+   * except that it fails (and marks the deadline as fired()) once the
+   * deadline has passed. Valid for the lifetime of this object.
+   */
+  const git_diff_similarity_metric *
+  renameMetric(const git_diff_similarity_metric *Inner) const;
+
+  /// The payload of a metric returned by renameMetric().
+  struct TimedMetric;
+
+private:
+  std::chrono::milliseconds Budget;
+  Clock::time_point End;
+  mutable std::atomic<bool> Fired{false};
+  mutable std::mutex Lock;
+  mutable std::vector<std::unique_ptr<TimedMetric>> Metrics;
+};
+
+/**
+ * Like checkError(), but an error returned after a rename metric of \p Limit
+ * (may be nullptr) stopped at the deadline is thrown as DeadlineExceeded for
+ * \p Phase.
+ */
+void checkError(int ErrorCode, const std::string &Action,
+                const Deadline *Limit, const std::string &Phase);
+
+/**
+ * Whether \p Ex was thrown after a callback stopped at \p Limit (may be
+ * nullptr).
+ */
+bool stoppedAt(const GitError &Ex, const Deadline *Limit);
+
+/**
+ * Call \p Fn, rethrowing a GitError from a callback that stopped at \p Limit
+ * (may be nullptr) as DeadlineExceeded for \p Phase.
+ */
+template <typename F>
+void runTimed(const Deadline *Limit, const std::string &Phase, F Fn) {
+  try {
+    Fn();
+  } catch (const DeadlineExceeded &) {
+    throw;
+  } catch (const GitError &Ex) {
+    if (stoppedAt(Ex, Limit)) {
+      throw DeadlineExceeded(Phase);
+    }
+    throw;
+  }
+}
+
+#endif /* MERGECHECK_DEADLINE_HPP */
@@ -0,0 +1,38 @@
+#ifndef MERGECHECK_HANDLES_HPP
+#define MERGECHECK_HANDLES_HPP
+
+#include <git2.h>
+#include <memory>
+
+/**
+ * Calls the libgit2 free function \p Free on destruction.
+ */
+template <typename T, void (*Free)(T *)> struct GitDeleter {
+  void operator()(T *Handle) const { Free(Handle); }
+};
+
+/**
+ * Owning pointer to a libgit2 handle, e.g.
+ *
+ *   RepositoryPtr Repo(Raw);
+ *   git_commit_lookup(&Ptr, Repo.get(), &Id);
+ */
+template <typename T, void (*Free)(T *)>
+using GitPtr = std::unique_ptr<T, GitDeleter<T, Free>>;
+
+using AnnotatedCommitPtr =
+    GitPtr<git_annotated_commit, git_annotated_commit_free>;
+using CommitPtr = GitPtr<git_commit, git_commit_free>;
+using ConfigPtr = GitPtr<git_config, git_config_free>;
+using DiffPtr = GitPtr<git_diff, git_diff_free>;
+using IndexPtr = GitPtr<git_index, git_index_free>;
+using OdbPtr = GitPtr<git_odb, git_odb_free>;
+using RebasePtr = GitPtr<git_rebase, git_rebase_free>;
+using ReferencePtr = GitPtr<git_reference, git_reference_free>;
+using RemotePtr = GitPtr<git_remote, git_remote_free>;
+using RepositoryPtr = GitPtr<git_repository, git_repository_free>;
+using RevwalkPtr = GitPtr<git_revwalk, git_revwalk_free>;
+using SignaturePtr = GitPtr<git_signature, git_signature_free>;
+using TreePtr = GitPtr<git_tree, git_tree_free>;
+
+#endif /* MERGECHECK_HANDLES_HPP */
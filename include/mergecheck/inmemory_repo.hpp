@@ -0,0 +1,30 @@
+#ifndef MERGECHECK_INMEMORY_REPO_HPP
+#define MERGECHECK_INMEMORY_REPO_HPP
+
+#include <git2.h>
+
+/**
+ * A private handle on a repository whose object database writes into memory.
+ *
+ * The handle is opened on the same git directory as the source repository and
+ * sees the registered alternates; an in-memory (mempack) backend with the
+ * highest priority receives all writes. Everything written through it is
+ * dropped on destruction. The handle must only be used by one thread at a
+ * time.
+ */
+class InMemoryRepository {
+public:
+  explicit InMemoryRepository(git_repository *Source);
+  ~InMemoryRepository();
+
+  InMemoryRepository(const InMemoryRepository &) = delete;
+  InMemoryRepository &operator=(const InMemoryRepository &) = delete;
+
+  git_repository *get() const { return Repo; }
+
+private:
+  git_repository *Repo = nullptr;
+  git_odb_backend *Mempack = nullptr;
+};
+
+#endif /* MERGECHECK_INMEMORY_REPO_HPP */
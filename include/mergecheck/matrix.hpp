@@ -0,0 +1,32 @@
+#ifndef MERGECHECK_MATRIX_HPP
+#define MERGECHECK_MATRIX_HPP
+
+#include <git2.h>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "mergecheck/options.hpp"
+
+/**
+ * Read one branch (ref or commit id) per line. Empty lines and lines starting
+ * with '#' are ignored.
+ */
+std::vector<std::string> readBranches(std::istream &In);
+
+/**
+ * Check every pair of \p Branches against each other and print the conflict
+ * graph as an adjacency list.
+ *
+ * First, the paths each branch changed relative to its merge base with
+ * \p Target are collected into bitsets over interned path ids. Only pairs
+ * whose sets overlap are then merged in memory, in parallel on \p Jobs workers
+ * (0 = number of hardware threads). Returns the total number of conflicts over
+ * all pairs.
+ */
+size_t matrix(git_repository *Repo, const std::string &RepoPath,
+              const std::string &Target,
+              const std::vector<std::string> &Branches, unsigned Jobs,
+              const CheckOptions &Opts);
+
+#endif /* MERGECHECK_MATRIX_HPP */
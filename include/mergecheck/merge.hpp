@@ -2,9 +2,52 @@
 #define MERGECHECK_MERGE_HPP
 
 #include <git2.h>
+#include <ostream>
 #include <string>
+#include <vector>
+
+#include "mergecheck/conflict.hpp"
+#include "mergecheck/options.hpp"
 
 size_t merge(git_repository *Repo, const std::string &OurBranch,
              const std::string &TheirBranch, bool PrintConflicts, bool Verbose);
 
+/**
+ * Same as above, but all conflict and progress output is written to \p O
+ * instead of std::cout. If \p Opts has a result cache, the merge itself is
+ * skipped when the outcome for the same merge-base and side trees is cached.
+ * If \p Conflicting is given, it receives the conflicts that were found.
+ * If Opts.TimeLimit passes, DeadlineExceeded is thrown after \p Conflicting
+ * received the conflicts found so far.
+ */
+size_t merge(git_repository *Repo, const std::string &OurBranch,
+             const std::string &TheirBranch, const CheckOptions &Opts,
+             std::ostream &O,
+             std::vector<Conflict> *Conflicting = nullptr);
+
+/**
+ * Same as above, but merges the commits \p TheirTip into \p OurTip, no
+ * matter where the branches point to now. \p OurBranch and \p TheirBranch
+ * only label the output.
+ */
+size_t merge(git_repository *Repo, const git_oid &OurTip,
+             const git_oid &TheirTip, const std::string &OurBranch,
+             const std::string &TheirBranch, const CheckOptions &Opts,
+             std::ostream &O,
+             std::vector<Conflict> *Conflicting = nullptr);
+
+/**
+ * Print and record \p Conflicts like a merge of \p TheirBranch into
+ * \p OurBranch does, labelled \p LocalRef and \p RemoteRef in the printed
+ * conflicts. With Opts.ConflictHunks, the conflicting hunks of all files are
+ * computed (in parallel) first, reading the blobs from \p Repo. Returns false
+ * if Opts.TimeLimit passed before the hunks of every file were computed.
+ */
+bool reportConflicts(git_repository *Repo,
+                     const std::vector<Conflict> &Conflicts,
+                     const CheckOptions &Opts, const std::string &OurBranch,
+                     const std::string &TheirBranch,
+                     const std::string &LocalRef, const std::string &RemoteRef,
+                     std::ostream &O);
+
 #endif /* MERGECHECK_MERGE_HPP */
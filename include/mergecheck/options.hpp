@@ -0,0 +1,82 @@
+#ifndef MERGECHECK_OPTIONS_HPP
+#define MERGECHECK_OPTIONS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Deadline;
+class PathIndex;
+class RecordWriter;
+class ResultCache;
+
+/**
+ * How renames are detected when merging.
+ */
+enum class RenameMode : uint8_t {
+  Off,   ///< No detection; a rename is a deletion and an addition.
+  Exact, ///< Only renames without content changes.
+  Full   ///< Similarity-based detection, like "git merge".
+};
+
+/**
+ * Options shared by all checks.
+ */
+struct CheckOptions {
+  bool PrintConflicts = false;
+  bool Verbose = false;
+  /// If set, merge outcomes are looked up in and stored to this cache.
+  ResultCache *Cache = nullptr;
+  /// Report merges whose sides changed disjoint sets of paths as clean
+  /// without running the content merge.
+  bool Prefilter = true;
+  /// rebase: commit every replayed step (into memory only) so that later
+  /// steps are evaluated on top of the earlier ones, like a real rebase.
+  bool Cumulative = false;
+  /// rebase: merge the branch tip in one step first and only replay the
+  /// commits one by one if that is not conclusively clean.
+  bool SquashFirst = true;
+  /// rebase: number of workers replaying commits (0 = number of hardware
+  /// threads). Ignored for cumulative rebases, which are sequential.
+  unsigned RebaseJobs = 1;
+  /// rebase: stop at the first commit that conflicts.
+  bool FirstConflict = false;
+  /// If set, every conflict and the outcome of every check are streamed to
+  /// this writer as machine-readable records.
+  RecordWriter *Records = nullptr;
+  /// merge: merge every conflicting file in memory and report its conflicting
+  /// hunks along with the conflict.
+  bool ConflictHunks = false;
+  /// merge: files with a side larger than this are reported without hunks.
+  size_t HunkMaxBytes = 1 << 20;
+  /// merge: threads for the file merges (0 = number of hardware threads).
+  unsigned HunkJobs = 0;
+  /// merge: threads merging the top-level subtrees separately (0 = number of
+  /// hardware threads); 1 merges the trees in one piece.
+  unsigned MergeJobs = 1;
+  /// Rename detection for merges and rebase steps.
+  RenameMode Renames = RenameMode::Full;
+  /// Similarity (0-100) at which a pair is a rename (0 = libgit2 default).
+  unsigned RenameThreshold = 0;
+  /// Maximum number of rename candidates to compare (0 = libgit2 default).
+  unsigned RenameLimit = 0;
+  /// merge, rebase: only check these paths (see normalizeScope()); conflicts
+  /// elsewhere are ignored and the subtrees outside are not read. Empty means
+  /// the whole tree.
+  std::vector<std::string> Paths;
+  /// merge: decide on tree entries alone, without reading any blob; paths
+  /// changed differently on both sides are reported as (potential) conflicts.
+  bool TreeOnly = false;
+  /// merge: with TreeOnly, run the content merge on the reported paths and
+  /// only keep the real conflicts.
+  bool Confirm = false;
+  /// If set, commits whose changed-path filter proves that they cannot matter
+  /// are skipped (blame-conflict probes, rebase steps).
+  const PathIndex *PathFilters = nullptr;
+  /// merge, rebase: if set, the check is cancelled at this deadline and
+  /// throws DeadlineExceeded, after handing out the conflicts found so far.
+  const Deadline *TimeLimit = nullptr;
+};
+
+#endif /* MERGECHECK_OPTIONS_HPP */
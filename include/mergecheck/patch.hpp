@@ -0,0 +1,35 @@
+#ifndef MERGECHECK_PATCH_HPP
+#define MERGECHECK_PATCH_HPP
+
+#include <git2.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "mergecheck/conflict.hpp"
+#include "mergecheck/options.hpp"
+
+/**
+ * Check whether the unified diff \p Patch (e.g. the output of "git diff
+ * HEAD"), made against \p Base, conflicts with \p Target, as if it was
+ * committed on top of \p Base and that commit merged into \p Target.
+ *
+ * The patch is applied to the tree of \p Base in memory and the result is
+ * merged with the tree of \p Target, with their merge base as ancestor (the
+ * first one if there are several). Only the paths the patch touches are
+ * merged, or Opts.Paths if given, so the cost depends on the size of the
+ * patch rather than of the tree; renames on the target side of a patched
+ * file are not followed. All objects are written to an in-memory object
+ * backend and dropped afterwards; nothing is written to the repository.
+ *
+ * Conflicts are reported like those of merge(), with "patch" as the name of
+ * the merged side. Throws a GitError if the patch cannot be parsed or does
+ * not apply to \p Base. If \p Conflicting is given, it receives the
+ * conflicts that were found.
+ */
+size_t checkPatch(git_repository *Repo, const std::string &Target,
+                  const std::string &Base, const std::string &Patch,
+                  const CheckOptions &Opts, std::ostream &O,
+                  std::vector<Conflict> *Conflicting = nullptr);
+
+#endif /* MERGECHECK_PATCH_HPP */
@@ -0,0 +1,83 @@
+#ifndef MERGECHECK_PATH_INDEX_HPP
+#define MERGECHECK_PATH_INDEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <git2.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Changed-path filters of commits, stored under <gitdir>/mergecheck/ and
+ * written by updatePathIndex().
+ *
+ * For every indexed commit, a Bloom filter holds the paths that differ between
+ * its first parent (or the empty tree) and the commit, with subtrees expanded,
+ * along with their parent directories. A negative answer is exact, so a commit
+ * whose filter rejects a path provably did not touch it; a positive answer may
+ * be wrong. Commits without a filter always answer positively.
+ *
+ * The file is mapped read-only and never modified in place (updates replace it
+ * atomically), so an open index stays valid. It uses host byte order and is
+ * not meant to be shared between machines. All methods are thread-safe.
+ */
+class PathIndex {
+public:
+  /// Hashes of one filter entry.
+  struct Key {
+    uint64_t H1;
+    uint64_t H2;
+  };
+
+  /// The entries to test for a path, computed once for many commits.
+  using Query = std::vector<Key>;
+
+  /**
+   * Open the index of the repository whose git directory is \p GitDir. A
+   * missing or malformed file gives an empty index.
+   */
+  explicit PathIndex(const std::string &GitDir);
+  PathIndex(const PathIndex &) = delete;
+  PathIndex &operator=(const PathIndex &) = delete;
+  ~PathIndex();
+
+  /**
+   * The entries that are set if a commit changed a path overlapping \p Path
+   * in the sense of pathsOverlap(): the path itself, a path below it, or one
+   * of its parent directories (e.g. replaced by a file).
+   */
+  static Query query(const std::string &Path);
+
+  /**
+   * Whether \p Commit may have changed a path overlapping the path of \p Q.
+   */
+  bool mayOverlap(const git_oid &Commit, const Query &Q) const;
+
+  bool hasFilter(const git_oid &Commit) const;
+
+  size_t size() const { return Count; }
+  bool empty() const { return Count == 0; }
+
+private:
+  const char *find(const git_oid &Commit) const;
+
+  void *Map = nullptr;
+  size_t MapSize = 0;
+  size_t Count = 0;
+
+  friend size_t updatePathIndex(git_repository *Repo,
+                                const std::string &RepoPath, unsigned Jobs,
+                                bool Verbose, std::ostream &O);
+};
+
+/**
+ * Add the filters of all commits reachable from a reference or HEAD that are
+ * not indexed yet, computed on \p Jobs workers (0 = number of hardware
+ * threads), and atomically replace the index file. Returns the number of
+ * commits added.
+ */
+size_t updatePathIndex(git_repository *Repo, const std::string &RepoPath,
+                       unsigned Jobs, bool Verbose, std::ostream &O);
+
+#endif /* MERGECHECK_PATH_INDEX_HPP */
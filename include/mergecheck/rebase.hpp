@@ -2,7 +2,12 @@
 #define MERGECHECK_REBASE_HPP
 
 #include <git2.h>
+#include <ostream>
 #include <string>
+#include <vector>
+
+#include "mergecheck/conflict.hpp"
+#include "mergecheck/options.hpp"
 
 size_t rebase(git_repository *Repo, const std::string &UpstreamBranch,
               const std::string &Branch, bool PrintConflicts, bool Verbose);
@@ -11,4 +16,42 @@ size_t rebase(git_repository *Repo, const std::string &UpstreamBranch,
               const std::string &Branch, const std::string &OntoCommit,
               bool PrintConflicts, bool Verbose);
 
+/**
+ * Same as the overloads above, but all conflict and progress output is written
+ * to \p O instead of std::cout.
+ */
+size_t rebase(git_repository *Repo, const std::string &UpstreamBranch,
+              const std::string &Branch, bool PrintConflicts, bool Verbose,
+              std::ostream &O);
+
+size_t rebase(git_repository *Repo, const std::string &UpstreamBranch,
+              const std::string &Branch, const std::string &OntoCommit,
+              bool PrintConflicts, bool Verbose, std::ostream &O);
+
+/**
+ * Rebase check driven by \p Opts. \p OntoCommit may be empty.
+ *
+ * With Opts.SquashFirst, the branch tip is first merged into the new base in a
+ * single step. If that is clean and no path was modified and reverted again on
+ * the branch, the rebase is reported as clean without replaying the commits.
+ *
+ * With Opts.Cumulative, every replayed commit is committed so that the next
+ * one is applied on top of it. Conflicting paths are resolved in favour of the
+ * replayed commit first. All trees and commits created on the way are written
+ * to an in-memory object backend of a private repository handle and dropped
+ * when the check is done; nothing is written to the repository.
+ *
+ * Otherwise, every commit is checked against the new base on its own, which
+ * is spread over Opts.RebaseJobs workers. The output is the same as for a
+ * sequential replay.
+ *
+ * If \p Conflicting is given, it receives the conflicts of all replayed
+ * commits. If Opts.TimeLimit passes, DeadlineExceeded is thrown with the
+ * number of completed steps, after \p Conflicting received their conflicts.
+ */
+size_t rebase(git_repository *Repo, const std::string &UpstreamBranch,
+              const std::string &Branch, const std::string &OntoCommit,
+              const CheckOptions &Opts, std::ostream &O,
+              std::vector<Conflict> *Conflicting = nullptr);
+
 #endif /* MERGECHECK_REBASE_HPP */
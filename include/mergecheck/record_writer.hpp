@@ -0,0 +1,94 @@
+#ifndef MERGECHECK_RECORD_WRITER_HPP
+#define MERGECHECK_RECORD_WRITER_HPP
+
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#include "mergecheck/conflict.hpp"
+#include "mergecheck/conflict_hunks.hpp"
+
+enum class OutputFormat {
+  Human,     ///< Text for humans, as printed by printConflict().
+  JsonLines, ///< One JSON object per line.
+  Csv        ///< A header row, then one row per record.
+};
+
+/**
+ * Parse a "--format" argument ("human", "jsonl" or "csv"). Returns false for
+ * unknown names.
+ */
+bool parseOutputFormat(const std::string &Name, OutputFormat &Format);
+
+/**
+ * Streams machine-readable records to an output stream.
+ *
+ * Records are formatted by the calling thread and collected in a buffer that
+ * is written to the stream whenever it exceeds the buffer size, so memory use
+ * does not depend on the number of records and the stream is not flushed per
+ * line. All methods may be called from several threads; records are never
+ * interleaved, but records of concurrent checks can be.
+ *
+ * Every record has a "type": "conflict" (one per conflict, with the path, kind
+ * and the blob ids and modes of all sides), "merge", "rebase" or "patch" (one
+ * per check), "timeout" (one per check cancelled at its deadline), "error" (one
+ * per failed check) and "summary" (written last).
+ */
+class RecordWriter {
+public:
+  RecordWriter(std::ostream &O, OutputFormat Format,
+               size_t BufferSize = 64 << 10);
+  ~RecordWriter();
+  RecordWriter(const RecordWriter &) = delete;
+  RecordWriter &operator=(const RecordWriter &) = delete;
+
+  /**
+   * A conflict found when merging \p Their into \p Our. For rebases, \p Their
+   * is the id of the replayed commit. \p Hunks, if given, adds the
+   * conflicting hunks of the file.
+   */
+  void conflict(const std::string &Our, const std::string &Their,
+                const Conflict &C, const FileHunks *Hunks = nullptr);
+
+  /**
+   * The outcome of a check; \p Type is "merge", "rebase" or "patch".
+   */
+  void result(const char *Type, const std::string &Our,
+              const std::string &Their, size_t Conflicts);
+
+  /**
+   * A check of \p Type that was cancelled at its deadline during \p Phase,
+   * after \p Steps completed rebase steps and \p Conflicts conflicts.
+   */
+  void timeout(const char *Type, const std::string &Our,
+               const std::string &Their, const std::string &Phase,
+               size_t Steps, size_t Conflicts);
+
+  void error(const std::string &Our, const std::string &Their,
+             const std::string &Message);
+
+  /**
+   * The number of checks, conflicts and errors of all records written so far.
+   */
+  void summary();
+
+  /**
+   * Write the buffered records to the stream and flush it.
+   */
+  void flush();
+
+private:
+  void append(const std::string &Record);
+
+  std::ostream &O;
+  OutputFormat Format;
+  size_t BufferSize;
+  std::mutex Lock;
+  std::string Buffer;
+  size_t Checks = 0;
+  size_t Conflicts = 0;
+  size_t Errors = 0;
+};
+
+#endif /* MERGECHECK_RECORD_WRITER_HPP */
@@ -0,0 +1,24 @@
+#ifndef MERGECHECK_REFS_HPP
+#define MERGECHECK_REFS_HPP
+
+#include <git2.h>
+#include <string>
+
+/**
+ * Resolve \p Name to an annotated commit. \p Name can either be the full name
+ * of a reference (e.g. "refs/heads/master"), a reference of an alternate
+ * repository (see addAlternate()) or a commit id. If \p ShortName is
+ * given, it receives the short branch name for nicer program output (or
+ * \p Name itself if it does not name a branch). The caller owns the returned
+ * commit.
+ */
+git_annotated_commit *lookupAnnotatedCommit(git_repository *Repo,
+                                            const std::string &Name,
+                                            std::string *ShortName = nullptr);
+
+/**
+ * Same as lookupAnnotatedCommit(), but returns the commit itself.
+ */
+git_commit *lookupCommit(git_repository *Repo, const std::string &Name);
+
+#endif /* MERGECHECK_REFS_HPP */
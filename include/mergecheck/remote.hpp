@@ -3,8 +3,17 @@
 
 #include <git2.h>
 #include <string>
+#include <vector>
 
+/**
+ * Add the remote \p RemoteName (if it does not exist yet) and fetch the refs
+ * of \p Refs that belong to it, i.e. all "refs/remotes/<RemoteName>/<branch>"
+ * entries. Only those branches are fetched, without tags. Branches whose
+ * remote tip already exists locally are not downloaded at all; only their
+ * remote-tracking ref is updated.
+ */
 void addRemote(git_repository *Repo, const std::string &RemoteUrl,
-               const std::string &RemoteName, bool Verbose);
+               const std::string &RemoteName,
+               const std::vector<std::string> &Refs, bool Verbose);
 
 #endif /* MERGECHECK_REMOTE_HPP */
@@ -0,0 +1,139 @@
+#ifndef MERGECHECK_RENAMES_HPP
+#define MERGECHECK_RENAMES_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <git2.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "mergecheck/changed_paths.hpp"
+#include "mergecheck/options.hpp"
+
+/**
+ * Parse a "--renames" argument ("off", "exact" or "full"). Returns false for
+ * unknown names.
+ */
+bool parseRenameMode(const std::string &Name, RenameMode &Mode);
+
+const char *renameModeName(RenameMode Mode);
+
+/**
+ * Configure rename detection of \p MergeOpts for \p Mode, with the threshold
+ * and limit of \p Opts. Exact detection compares blob ids only and never
+ * hashes file contents. With a TimeLimit in \p Opts, rename detection (and so
+ * the merge) fails once the deadline has passed (see Deadline::fired()).
+ */
+void setRenameOptions(git_merge_options &MergeOpts, RenameMode Mode,
+                      const CheckOptions &Opts);
+
+/**
+ * The target_limit libgit2 merges with: Opts.RenameLimit if set, otherwise
+ * merge.renameLimit or diff.renameLimit of \p Repo, otherwise 1000. libgit2
+ * skips similarity detection if the sides changed more files than this.
+ */
+unsigned renameLimit(git_repository *Repo, const CheckOptions &Opts);
+
+/**
+ * libgit2's default similarity metric for merges (hashed content signatures
+ * that ignore whitespace changes), for metrics that wrap another one.
+ */
+const git_diff_similarity_metric &defaultRenameMetric();
+
+/**
+ * What the changes of both sides of a merge mean for rename detection.
+ */
+struct RenameScan {
+  /// files deleted and added by either side
+  size_t Deleted = 0;
+  size_t Added = 0;
+  /// pairs that similarity-based detection would have to compare (0 if it is
+  /// skipped because of the limit)
+  size_t Candidates = 0;
+  /// deleted files or subtrees that were re-added unchanged elsewhere
+  size_t ExactRenames = 0;
+  /// full: files changed by either side, which libgit2 compares to the
+  /// rename limit
+  size_t ChangedFiles = 0;
+  unsigned Limit = 0;
+  /// full: more than Limit files changed, so libgit2 only matches identical
+  /// files
+  bool OverLimit = false;
+  /// whether a deleted or added path of one side was changed by the other;
+  /// otherwise renames cannot affect the merge result
+  bool Relevant = false;
+  double Ms = 0;
+};
+
+/**
+ * Scan the changes \p Ours and \p Theirs of both sides relative to their
+ * merge base. Exact renames are matched by id in a single pass; whole
+ * subtrees with identical ids count as one rename each, so moved directories
+ * are not expanded, except to count the changed files against \p Limit (see
+ * renameLimit()) with full detection.
+ */
+RenameScan scanRenames(git_repository *Repo,
+                       const std::vector<ChangedEntry> &Ours,
+                       const std::vector<ChangedEntry> &Theirs,
+                       RenameMode Mode, unsigned Limit);
+
+/**
+ * The mode the merge needs after \p Scan: Off if detection cannot change its
+ * result, Exact if full detection is over the limit, otherwise \p Mode.
+ */
+RenameMode effectiveRenameMode(RenameMode Mode, const RenameScan &Scan);
+
+/**
+ * Print a one-line summary of \p Scan, e.g. for verbose output.
+ */
+std::ostream &printRenameScan(const RenameScan &Scan, RenameMode Mode,
+                              std::ostream &O);
+
+/**
+ * Measures libgit2's similarity-based rename detection through a metric that
+ * wraps the one of a merge: the number of file signatures and comparisons and
+ * the time from the first signature to the last comparison. Thread-safe, so
+ * the shards of a merge can share it.
+ */
+class RenameTimer {
+public:
+  RenameTimer() = default;
+  RenameTimer(const RenameTimer &) = delete;
+  RenameTimer &operator=(const RenameTimer &) = delete;
+
+  /**
+   * Route the metric of \p MergeOpts (libgit2's default if none is set)
+   * through this timer, which must outlive the merge.
+   */
+  void wrap(git_merge_options &MergeOpts);
+
+  size_t signatures() const { return Signatures; }
+  size_t comparisons() const { return Comparisons; }
+  double ms() const;
+
+private:
+  static int fileSignature(void **Out, const git_diff_file *File,
+                           const char *Path, void *Payload);
+  static int bufferSignature(void **Out, const git_diff_file *File,
+                             const char *Buf, size_t Size, void *Payload);
+  static void freeSignature(void *Signature, void *Payload);
+  static int similarity(int *Score, void *A, void *B, void *Payload);
+  void started();
+
+  git_diff_similarity_metric Metric{};
+  const git_diff_similarity_metric *Inner = nullptr;
+  std::atomic<size_t> Signatures{0};
+  std::atomic<size_t> Comparisons{0};
+  /// steady clock in nanoseconds, 0 until set
+  std::atomic<int64_t> First{0};
+  std::atomic<int64_t> Last{0};
+};
+
+/**
+ * Print a one-line summary of \p Timer, e.g. for verbose output.
+ */
+std::ostream &printRenameTiming(const RenameTimer &Timer, std::ostream &O);
+
+#endif /* MERGECHECK_RENAMES_HPP */
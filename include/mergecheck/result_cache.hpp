@@ -0,0 +1,89 @@
+#ifndef MERGECHECK_RESULT_CACHE_HPP
+#define MERGECHECK_RESULT_CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <git2.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mergecheck/conflict.hpp"
+
+/**
+ * Identifies a merge outcome: the merge-base tree and the two side trees.
+ * \p Variant distinguishes results computed with different merge options.
+ */
+struct MergeKey {
+  git_oid Base;
+  git_oid Ours;
+  git_oid Theirs;
+  uint32_t Variant;
+};
+
+bool operator==(const MergeKey &A, const MergeKey &B);
+
+struct MergeKeyHash {
+  size_t operator()(const MergeKey &K) const;
+};
+
+/**
+ * On-disk cache of merge outcomes, stored under <gitdir>/mergecheck/.
+ *
+ * The cache is a single append-only file of checksummed records. Readers never
+ * lock: a record that is still being appended (or was torn by a crash) fails
+ * its length or checksum test and is ignored. Writers append under an
+ * exclusive lock on a separate lock file. When the file grows beyond the size
+ * limit, the newest entries are rewritten into a new file that atomically
+ * replaces the old one, so readers that still have the old file open are not
+ * affected. The file uses host byte order; it is not meant to be shared
+ * between machines.
+ *
+ * All methods are thread-safe.
+ */
+class ResultCache {
+public:
+  static const size_t DefaultMaxBytes = 64 << 20;
+
+  /**
+   * Open (or create) the cache of the repository whose git directory is
+   * \p GitDir.
+   */
+  explicit ResultCache(const std::string &GitDir,
+                       size_t MaxBytes = DefaultMaxBytes);
+  ResultCache(const ResultCache &) = delete;
+  ResultCache &operator=(const ResultCache &) = delete;
+
+  bool lookup(const MergeKey &Key, std::vector<Conflict> &Conflicts);
+
+  void store(const MergeKey &Key, const std::vector<Conflict> &Conflicts);
+
+  size_t hits() const { return Hits; }
+  size_t misses() const { return Misses; }
+
+private:
+  struct Entry {
+    uint64_t Sequence;
+    std::vector<Conflict> Conflicts;
+  };
+
+  void refresh();
+  void reset();
+  size_t parse(const std::string &Data);
+  void compact();
+
+  std::string DataPath;
+  std::string LockPath;
+  size_t MaxBytes;
+
+  std::mutex Lock;
+  std::unordered_map<MergeKey, Entry, MergeKeyHash> Entries;
+  uint64_t NextSequence = 0;
+  uint64_t FileId = 0;
+  size_t ParsedBytes = 0;
+  std::atomic<size_t> Hits{0};
+  std::atomic<size_t> Misses{0};
+};
+
+#endif /* MERGECHECK_RESULT_CACHE_HPP */
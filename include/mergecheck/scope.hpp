@@ -0,0 +1,65 @@
+#ifndef MERGECHECK_SCOPE_HPP
+#define MERGECHECK_SCOPE_HPP
+
+#include <git2.h>
+#include <string>
+#include <vector>
+
+#include "mergecheck/changed_paths.hpp"
+#include "mergecheck/conflict.hpp"
+
+/**
+ * Turn the "--path" argument \p Arg into the literal path \p Path. Scopes do
+ * not support globs: an argument with '*', '?' or '[' is rejected (returns
+ * false) unless it starts with ":(literal)", which is removed.
+ */
+bool literalScopePath(const std::string &Arg, std::string &Path);
+
+/**
+ * Normalize the "--path" arguments of a check: leading "./" and surrounding
+ * slashes are removed and paths below another path of the list are dropped.
+ * Returns an empty list (no restriction) if a path names the whole tree.
+ */
+std::vector<std::string> normalizeScope(const std::vector<std::string> &Paths);
+
+/**
+ * Whether \p Path is one of the paths of \p Scope or below one of them. Every
+ * path is in an empty scope.
+ */
+bool inScope(const std::string &Path, const std::vector<std::string> &Scope);
+
+/**
+ * Whether \p Path is in \p Scope or a parent directory of one of its paths;
+ * e.g. a directory replaced by a file still affects the paths below it.
+ */
+bool touchesScope(const std::string &Path,
+                  const std::vector<std::string> &Scope);
+
+/**
+ * Merge the parts of \p Ours and \p Theirs inside \p Scope like
+ * git_merge_trees() (any tree may be nullptr) and append the conflicts inside
+ * the scope to \p Conflicts, with paths relative to the root.
+ *
+ * Every path of the scope is merged on its own subtrees (or those of its
+ * deepest parent directory that is a directory on all sides), so nothing
+ * outside the scope is read; it is taken from our side. Subtrees that did not
+ * change on one side are not merged at all. Renames across the boundary of
+ * the scope are not detected.
+ */
+void mergeTreesInScope(git_repository *Repo, const git_tree *Base,
+                       const git_tree *Ours, const git_tree *Theirs,
+                       const std::vector<std::string> &Scope,
+                       const git_merge_options &MergeOpts,
+                       std::vector<Conflict> &Conflicts);
+
+/**
+ * Like changedEntries() for \p Base to \p Ours and \p Base to \p Theirs, but
+ * only inside \p Scope, without descending into other subtrees.
+ */
+void changedEntriesInScope(git_repository *Repo, const git_tree *Base,
+                           const git_tree *Ours, const git_tree *Theirs,
+                           const std::vector<std::string> &Scope,
+                           std::vector<ChangedEntry> &OurChanges,
+                           std::vector<ChangedEntry> &TheirChanges);
+
+#endif /* MERGECHECK_SCOPE_HPP */
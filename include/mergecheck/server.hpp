@@ -0,0 +1,84 @@
+#ifndef MERGECHECK_SERVER_HPP
+#define MERGECHECK_SERVER_HPP
+
+#include <ostream>
+#include <string>
+
+#include "mergecheck/options.hpp"
+
+/*
+ * Protocol
+ * --------
+ * Requests are single lines with tab-separated fields:
+ *
+ *   merge  <repo> <our> <their> <flags>
+ *   rebase <repo> <upstream> <branch> <onto> <flags>
+ *   stats
+ *
+ * <repo> is an absolute repository path, <onto> may be empty and <flags> is a
+ * comma-separated (possibly empty) list of "print-conflicts", "verbose",
+ * "result-cache", "no-prefilter", "cumulative", "per-commit",
+ * "first-conflict" and "no-path-filters". Unless "no-path-filters" is given,
+ * the daemon uses the changed-path filters of the repository (see PathIndex),
+ * which it opens once; commits indexed later are checked without filters until
+ * it restarts.
+ *
+ * Every request is answered with a header line followed by a body of exactly
+ * <length> bytes:
+ *
+ *   OK <conflicts> <length>\n<body>
+ *   ERR <length>\n<body>
+ *
+ * The body contains the output the check would have written to stdout (or the
+ * error message). A connection may carry any number of requests.
+ */
+
+/**
+ * Build a 'merge' request line (without the trailing newline).
+ */
+std::string mergeRequest(const std::string &RepoPath,
+                         const std::string &OurBranch,
+                         const std::string &TheirBranch,
+                         const CheckOptions &Opts, bool UseResultCache,
+                         bool UsePathFilters);
+
+/**
+ * Build a 'rebase' request line (without the trailing newline). \p Onto may be
+ * empty.
+ */
+std::string rebaseRequest(const std::string &RepoPath,
+                          const std::string &UpstreamBranch,
+                          const std::string &Branch, const std::string &Onto,
+                          const CheckOptions &Opts, bool UsePathFilters);
+
+/**
+ * Keep repositories open and answer check requests on the Unix domain socket
+ * \p SocketPath until SIGINT or SIGTERM is received. Requests are handled
+ * concurrently by \p Jobs workers (0 = number of hardware threads); idle
+ * connections do not occupy a worker. On shutdown, idle connections are
+ * closed and requests in progress are finished first.
+ * \p RepoPath is opened eagerly; other repositories are opened on first use.
+ * Fails if \p SocketPath exists and is not a stale socket.
+ *
+ * Returns the process exit code.
+ */
+int serve(const std::string &RepoPath, const std::string &SocketPath,
+          unsigned Jobs, bool Verbose);
+
+enum class ForwardStatus {
+  NoServer, ///< Nobody is listening on the socket.
+  Ok,       ///< The request was answered.
+  Failed    ///< The server reported an error or the connection broke.
+};
+
+/**
+ * Send \p Request to the daemon listening on \p SocketPath. On success the
+ * response body is written to \p O and the number of conflicts is stored in
+ * \p Conflicts. If the server reported an error, the message is written to
+ * std::cerr.
+ */
+ForwardStatus forwardRequest(const std::string &SocketPath,
+                             const std::string &Request, std::ostream &O,
+                             size_t &Conflicts);
+
+#endif /* MERGECHECK_SERVER_HPP */
@@ -0,0 +1,41 @@
+#ifndef MERGECHECK_SHARDED_MERGE_HPP
+#define MERGECHECK_SHARDED_MERGE_HPP
+
+#include <cstddef>
+#include <git2.h>
+#include <vector>
+
+#include "mergecheck/conflict.hpp"
+
+class Deadline;
+
+/**
+ * Merge \p Ours and \p Theirs with the ancestor \p Base like git_merge_trees()
+ * and append the conflicts to \p Conflicts in path order, with the top-level
+ * entries split into shards that are merged in parallel on \p Jobs workers
+ * (0 = number of hardware threads).
+ *
+ * A top-level entry that is identical on two sides resolves trivially and is
+ * not read. Every other entry that is a directory (or absent) on all sides is
+ * a shard of its own, merged on its subtrees. The remaining entries, which
+ * are a file on some side, are merged together in root trees that contain
+ * only them, built in memory. \p Shards receives the number of shards.
+ *
+ * The conflicts are the same as those of a single merge, since without
+ * rename detection every path is merged on its own entries. Returns false
+ * without merging if \p MergeOpts detects renames (which could pair paths of
+ * different shards) or if libgit2 could see a directory/file conflict in the
+ * single merge that the split changes, i.e. another changed entry sorts
+ * between a file "a" and the directory "a/".
+ *
+ * No shard is started once \p Limit (may be nullptr) has passed. The merge
+ * then throws DeadlineExceeded, after appending the conflicts of the shards
+ * that finished to \p Conflicts.
+ */
+bool mergeTreesSharded(git_repository *Repo, const git_tree *Base,
+                       const git_tree *Ours, const git_tree *Theirs,
+                       const git_merge_options &MergeOpts, unsigned Jobs,
+                       std::vector<Conflict> &Conflicts, size_t &Shards,
+                       const Deadline *Limit = nullptr);
+
+#endif /* MERGECHECK_SHARDED_MERGE_HPP */
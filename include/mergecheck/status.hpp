@@ -0,0 +1,27 @@
+#ifndef MERGECHECK_STATUS_HPP
+#define MERGECHECK_STATUS_HPP
+
+#include <git2.h>
+#include <string>
+#include <vector>
+
+#include "mergecheck/options.hpp"
+
+/**
+ * Print the merge status of every branch in \p Branches against \p Target.
+ *
+ * The tips, merge base, changed-path sets and result of every evaluated
+ * (target, branch) pair are kept in <gitdir>/mergecheck/status. On the next
+ * run, pairs whose tips did not move are reused as they are. If a tip moved
+ * but the merge base stayed the same, the changed-path sets are updated by
+ * diffing only the old and the new tip; otherwise they are recomputed from the
+ * merge base. Pairs are keyed by the options that affect the result
+ * (renames, scope, tree-only), and the state file is updated under a lock,
+ * keeping the pairs concurrent runs stored. Returns the total number of
+ * conflicts.
+ */
+size_t status(git_repository *Repo, const std::string &Target,
+              const std::vector<std::string> &Branches,
+              const CheckOptions &Opts);
+
+#endif /* MERGECHECK_STATUS_HPP */
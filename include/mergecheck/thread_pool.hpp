@@ -0,0 +1,74 @@
+#ifndef MERGECHECK_THREAD_POOL_HPP
+#define MERGECHECK_THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A small work-stealing thread pool.
+ *
+ * Every worker owns a task queue. Tasks are distributed round-robin on
+ * submission; an idle worker first drains its own queue (LIFO) and then steals
+ * from the front of the other workers' queues. Each task receives the index of
+ * the worker executing it, so callers can keep per-worker state (e.g. one
+ * git_repository handle per worker).
+ */
+class ThreadPool {
+public:
+  using Task = std::function<void(unsigned Worker)>;
+
+  /**
+   * Start \p Threads workers. A value of 0 uses the number of hardware
+   * threads.
+   */
+  explicit ThreadPool(unsigned Threads = 0);
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ~ThreadPool();
+
+  /**
+   * Number of worker threads.
+   */
+  unsigned size() const { return static_cast<unsigned>(Queues.size()); }
+
+  /**
+   * Enqueue a task.
+   */
+  void submit(Task T);
+
+  /**
+   * Block until all submitted tasks have finished. If any of them threw,
+   * rethrow the first exception (the remaining tasks still run to completion).
+   */
+  void wait();
+
+private:
+  struct WorkQueue {
+    std::mutex Lock;
+    std::deque<Task> Tasks;
+  };
+
+  void run(unsigned Worker);
+  bool popOrSteal(unsigned Worker, Task &Out);
+
+  std::vector<std::unique_ptr<WorkQueue>> Queues;
+  std::vector<std::thread> Workers;
+
+  std::mutex StateLock;
+  std::condition_variable WorkAvailable;
+  std::condition_variable AllDone;
+  long Queued = 0;
+  size_t Pending = 0;
+  std::exception_ptr FirstError;
+  std::atomic<unsigned> NextQueue{0};
+  bool Stopping = false;
+};
+
+#endif /* MERGECHECK_THREAD_POOL_HPP */
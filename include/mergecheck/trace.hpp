@@ -0,0 +1,83 @@
+#ifndef MERGECHECK_TRACE_HPP
+#define MERGECHECK_TRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/**
+ * Set by enableTracing(). Only read through tracing().
+ */
+extern std::atomic<bool> TracingEnabled;
+
+/**
+ * Whether phases are recorded. While disabled, a TraceScope costs a single
+ * relaxed load and nothing is allocated or locked.
+ */
+inline bool tracing() {
+  return TracingEnabled.load(std::memory_order_relaxed);
+}
+
+/**
+ * Start recording phases and counter samples (process-wide).
+ */
+void enableTracing();
+
+/**
+ * Records the time between construction and destruction as one phase named
+ * \p Name (a string literal). A non-negative \p Index distinguishes repeated
+ * phases, e.g. rebase steps, which are then also listed individually.
+ */
+class TraceScope {
+public:
+  explicit TraceScope(const char *Name, int64_t Index = -1)
+      : Name(Name), Index(Index), Start(tracing() ? now() : 0) {}
+  ~TraceScope() {
+    if (Start) {
+      record(Name, Index, Start, now());
+    }
+  }
+
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+
+  /**
+   * Do not record this phase.
+   */
+  void cancel() { Start = 0; }
+
+  /**
+   * Microseconds on a monotonic clock; never 0.
+   */
+  static uint64_t now();
+
+private:
+  static void record(const char *Name, int64_t Index, uint64_t Start,
+                     uint64_t End);
+
+  const char *Name;
+  int64_t Index;
+  uint64_t Start;
+};
+
+/**
+ * Sample the memory counters (resident and peak resident memory, libgit2
+ * object cache size) if tracing is enabled.
+ */
+void traceCounters();
+
+/**
+ * Print the total, count and average duration of every recorded phase and
+ * the duration of every indexed phase, followed by the last counter sample.
+ */
+void printTimings(std::ostream &O);
+
+/**
+ * Write all recorded phases and counter samples to \p Path in the Chrome trace
+ * event format (chrome://tracing, Perfetto). Returns false if the file could
+ * not be written.
+ */
+bool writeTrace(const std::string &Path);
+
+#endif /* MERGECHECK_TRACE_HPP */
@@ -0,0 +1,32 @@
+#ifndef MERGECHECK_TRAIN_HPP
+#define MERGECHECK_TRAIN_HPP
+
+#include <git2.h>
+#include <string>
+#include <vector>
+
+#include "mergecheck/options.hpp"
+
+/**
+ * Simulate a merge train: merge \p Refs one after another into \p Target and
+ * report the first position that conflicts.
+ *
+ * Every step merges a ref into the tree produced by the previous step, using
+ * the merge base of the ref and \p Target as ancestor. The intermediate trees
+ * are only written to an in-memory object backend.
+ *
+ * The merge bases and changed paths of all refs are computed in parallel on
+ * \p Jobs workers (0 = number of hardware threads). The queue is then split
+ * into one segment per worker, and every segment is evaluated speculatively,
+ * starting from \p Target instead of from the result of the preceding
+ * segments. A speculative result is kept if no ref of the segment changed a
+ * path that a ref of an earlier segment changed, as the earlier merges cannot
+ * affect it then. Otherwise, the queue is re-evaluated sequentially from that
+ * segment on. Returns the number of conflicts at the first conflicting
+ * position.
+ */
+size_t train(git_repository *Repo, const std::string &RepoPath,
+             const std::string &Target, const std::vector<std::string> &Refs,
+             unsigned Jobs, const CheckOptions &Opts);
+
+#endif /* MERGECHECK_TRAIN_HPP */
@@ -0,0 +1,28 @@
+#ifndef MERGECHECK_TREE_CONFLICTS_HPP
+#define MERGECHECK_TREE_CONFLICTS_HPP
+
+#include <git2.h>
+#include <string>
+#include <vector>
+
+#include "mergecheck/conflict.hpp"
+
+/**
+ * Find the paths that could conflict when merging \p Ours and \p Theirs with
+ * the ancestor \p Base (any tree may be nullptr), using tree entries alone.
+ *
+ * A path is clean if one side left it unchanged or both sides changed it to
+ * the same id and mode. Otherwise it is a potential conflict, classified like
+ * a merge conflict (content, add/add, delete/modify or modify/delete); a path
+ * that is a file on one side and a directory on another is reported once, as
+ * the file. Subtrees are only descended into if all three sides differ, and
+ * no blob is ever read, so a content conflict may still merge cleanly.
+ * Renames are not detected. Only paths touching \p Scope are visited (see
+ * touchesScope()).
+ */
+std::vector<Conflict> treeConflicts(git_repository *Repo, const git_tree *Base,
+                                    const git_tree *Ours,
+                                    const git_tree *Theirs,
+                                    const std::vector<std::string> &Scope);
+
+#endif /* MERGECHECK_TREE_CONFLICTS_HPP */
@@ -1,12 +1,61 @@
 #ifndef MERGECHECK_UTILS_HPP
 #define MERGECHECK_UTILS_HPP
 
+#include <cstddef>
+#include <git2.h>
+#include <stdexcept>
 #include <string>
 
 /**
- * If there is an error, print out an error message and exit the program.
- * Otherwise, do nothing.
+ * Thrown by checkError() for failed libgit2 calls.
+ */
+class GitError : public std::runtime_error {
+public:
+  GitError(int ErrorCode, const std::string &Message)
+      : std::runtime_error(Message), ErrorCode(ErrorCode) {}
+
+  int code() const { return ErrorCode; }
+
+private:
+  int ErrorCode;
+};
+
+/**
+ * If there is an error, throw a GitError describing it. Otherwise, do
+ * nothing.
  */
 void checkError(int ErrorCode, const std::string &Action);
 
+/**
+ * Hexadecimal representation of \p Oid.
+ */
+std::string oidString(const git_oid &Oid);
+
+/**
+ * Resident set size of this process in bytes, or 0 if it is unknown.
+ */
+size_t residentMemory();
+
+/**
+ * Write all of \p Data to the file descriptor \p Fd, retrying short writes.
+ * Returns false on an error.
+ */
+bool writeAll(int Fd, const std::string &Data);
+
+/**
+ * Holds an exclusive flock() on a file for its lifetime.
+ */
+class FileLock {
+public:
+  explicit FileLock(const std::string &Path);
+  FileLock(const FileLock &) = delete;
+  FileLock &operator=(const FileLock &) = delete;
+  ~FileLock();
+
+  bool locked() const { return Fd >= 0; }
+
+private:
+  int Fd;
+};
+
 #endif /* MERGECHECK_UTILS_HPP */
@@ -0,0 +1,30 @@
+#ifndef MERGECHECK_WORKER_REPOS_HPP
+#define MERGECHECK_WORKER_REPOS_HPP
+
+#include <git2.h>
+#include <string>
+#include <vector>
+
+/**
+ * One repository handle per thread pool worker. All handles share the object
+ * database of the main handle, so pack indices and cached objects are only
+ * loaded once.
+ */
+class WorkerRepositories {
+public:
+  WorkerRepositories(git_repository *Repo, const std::string &RepoPath,
+                     unsigned Workers);
+  WorkerRepositories(const WorkerRepositories &) = delete;
+  WorkerRepositories &operator=(const WorkerRepositories &) = delete;
+  ~WorkerRepositories();
+
+  git_repository *operator[](unsigned Worker) const { return Repos[Worker]; }
+
+private:
+  void release();
+
+  git_odb *SharedOdb = nullptr;
+  std::vector<git_repository *> Repos;
+};
+
+#endif /* MERGECHECK_WORKER_REPOS_HPP */
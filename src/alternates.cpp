@@ -0,0 +1,135 @@
+#include <iostream>
+#include <map>
+#include <mutex>
+
+#include "mergecheck/alternates.hpp"
+#include "mergecheck/utils.hpp"
+
+const char *const AlternateRefPrefix = "refs/alternates/";
+
+namespace {
+std::mutex AlternatesLock;
+
+/**
+ * Registered alternate repositories by name. They are only used for reference
+ * lookups, which are serialized by AlternatesLock.
+ */
+std::map<std::string, git_repository *> &alternates() {
+  static std::map<std::string, git_repository *> Alternates;
+  return Alternates;
+}
+} // namespace
+
+void addAlternate(git_repository *Repo, const std::string &Path,
+                  const std::string &Name, bool Verbose) {
+  int error;
+
+  git_repository *AltRepo = nullptr;
+  error = git_repository_open(&AltRepo, Path.c_str());
+  checkError(error, "opening alternate repository");
+
+  std::string ObjectsDir =
+      std::string(git_repository_path(AltRepo)) + "objects";
+  git_odb *Odb = nullptr;
+  error = git_repository_odb(&Odb, Repo);
+  if (!error) {
+    // in-memory only: unlike writing objects/info/alternates, this does not
+    // touch the repository
+    error = git_odb_add_disk_alternate(Odb, ObjectsDir.c_str());
+    git_odb_free(Odb);
+  }
+  if (error) {
+    git_repository_free(AltRepo);
+  }
+  checkError(error, "git_odb_add_disk_alternate");
+
+  if (Verbose) {
+    std::cout << "Attached objects of \'" << Path << "\' as alternate, refs "
+              << "available under \'" << AlternateRefPrefix << Name << "/\'."
+              << std::endl;
+  }
+
+  std::lock_guard<std::mutex> Guard(AlternatesLock);
+  git_repository *&Slot = alternates()[Name];
+  git_repository_free(Slot);
+  Slot = AltRepo;
+}
+
+void attachAlternates(git_repository *Repo) {
+  int error;
+
+  git_odb *Odb = nullptr;
+  error = git_repository_odb(&Odb, Repo);
+  checkError(error, "git_repository_odb");
+
+  std::lock_guard<std::mutex> Guard(AlternatesLock);
+  for (const auto &KV : alternates()) {
+    std::string ObjectsDir =
+        std::string(git_repository_path(KV.second)) + "objects";
+    error = git_odb_add_disk_alternate(Odb, ObjectsDir.c_str());
+    if (error) {
+      break;
+    }
+  }
+  git_odb_free(Odb);
+  checkError(error, "git_odb_add_disk_alternate");
+}
+
+void parseAlternateSpec(const std::string &Spec, std::string &Name,
+                        std::string &Path) {
+  auto Eq = Spec.find('=');
+  if (Eq != std::string::npos) {
+    Name = Spec.substr(0, Eq);
+    Path = Spec.substr(Eq + 1);
+    return;
+  }
+
+  Path = Spec;
+  std::string Base = Path;
+  while (!Base.empty() && Base.back() == '/') {
+    Base.pop_back();
+  }
+  auto Slash = Base.rfind('/');
+  if (Slash != std::string::npos) {
+    Base = Base.substr(Slash + 1);
+  }
+  const std::string Suffix = ".git";
+  if (Base.size() > Suffix.size() &&
+      Base.compare(Base.size() - Suffix.size(), Suffix.size(), Suffix) == 0) {
+    Base.erase(Base.size() - Suffix.size());
+  }
+  Name = Base;
+}
+
+bool resolveAlternateRef(const std::string &Name, git_oid &Oid) {
+  const std::string Prefix = AlternateRefPrefix;
+  if (Name.compare(0, Prefix.size(), Prefix) != 0) {
+    return false;
+  }
+  auto Slash = Name.find('/', Prefix.size());
+  if (Slash == std::string::npos) {
+    throw GitError(GIT_ENOTFOUND, "Error: \'" + Name +
+                                      "\' does not name a reference of an "
+                                      "alternate repository");
+  }
+  std::string AltName = Name.substr(Prefix.size(), Slash - Prefix.size());
+  std::string RefName = "refs/" + Name.substr(Slash + 1);
+
+  std::lock_guard<std::mutex> Guard(AlternatesLock);
+  auto It = alternates().find(AltName);
+  if (It == alternates().end()) {
+    throw GitError(GIT_ENOTFOUND,
+                   "Error: Unknown alternate repository \'" + AltName + "\'");
+  }
+  int error = git_reference_name_to_id(&Oid, It->second, RefName.c_str());
+  checkError(error, "resolving \'" + Name + "\'");
+  return true;
+}
+
+void releaseAlternates() {
+  std::lock_guard<std::mutex> Guard(AlternatesLock);
+  for (auto &KV : alternates()) {
+    git_repository_free(KV.second);
+  }
+  alternates().clear();
+}
@@ -0,0 +1,82 @@
+#include <iostream>
+#include <sstream>
+
+#include "mergecheck/batch.hpp"
+#include "mergecheck/merge.hpp"
+#include "mergecheck/record_writer.hpp"
+#include "mergecheck/string_utils.hpp"
+#include "mergecheck/thread_pool.hpp"
+#include "mergecheck/utils.hpp"
+#include "mergecheck/worker_repos.hpp"
+
+std::vector<BranchPair> readBranchPairs(std::istream &In) {
+  std::vector<BranchPair> Pairs;
+  std::string Line;
+  while (std::getline(In, Line)) {
+    Trim(Line);
+    if (Line.empty() || Line[0] == '#') {
+      continue;
+    }
+    std::istringstream LineStream(Line);
+    BranchPair P;
+    if (!(LineStream >> P.first >> P.second)) {
+      std::cerr << "Warning: Ignoring malformed line \"" << Line << "\"\n";
+      continue;
+    }
+    Pairs.push_back(P);
+  }
+  return Pairs;
+}
+
+size_t batch(git_repository *Repo, const std::string &RepoPath,
+             const std::vector<BranchPair> &Pairs, unsigned Jobs,
+             const CheckOptions &Opts) {
+  ThreadPool Pool(Jobs);
+  if (Opts.Verbose) {
+    std::cout << "Checking " << Pairs.size() << " pairs with " << Pool.size()
+              << " workers..." << std::endl;
+  }
+
+  WorkerRepositories WorkerRepos(Repo, RepoPath, Pool.size());
+
+  std::vector<size_t> Conflicts(Pairs.size(), 0);
+  std::vector<std::string> Output(Pairs.size());
+  std::vector<char> Failed(Pairs.size(), 0);
+  for (size_t I = 0; I < Pairs.size(); ++I) {
+    Pool.submit([&, I](unsigned Worker) {
+      std::ostringstream O;
+      try {
+        Conflicts[I] = merge(WorkerRepos[Worker], Pairs[I].first,
+                             Pairs[I].second, Opts, O);
+      } catch (const GitError &Ex) {
+        if (Opts.Records) {
+          Opts.Records->error(Pairs[I].first, Pairs[I].second, Ex.what());
+        } else {
+          O << Ex.what() << "\n";
+        }
+        Failed[I] = 1;
+      }
+      Output[I] = O.str();
+    });
+  }
+  Pool.wait();
+
+  size_t Total = 0;
+  for (size_t I = 0; I < Pairs.size(); ++I) {
+    Total += Conflicts[I];
+    // records are streamed by the workers
+    if (Opts.Records) {
+      continue;
+    }
+    std::cout << Output[I];
+    std::cout << Pairs[I].first << " " << Pairs[I].second << ": ";
+    if (Failed[I]) {
+      std::cout << "error\n";
+    } else {
+      std::cout << Conflicts[I] << " conflicts\n";
+    }
+  }
+  std::cout.flush();
+
+  return Total;
+}
@@ -0,0 +1,272 @@
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+#include "mergecheck/blame.hpp"
+#include "mergecheck/handles.hpp"
+#include "mergecheck/merge.hpp"
+#include "mergecheck/path_index.hpp"
+#include "mergecheck/refs.hpp"
+#include "mergecheck/thread_pool.hpp"
+#include "mergecheck/utils.hpp"
+#include "mergecheck/worker_repos.hpp"
+
+namespace {
+/**
+ * Paths on which merging the other side into one commit of the history
+ * conflicts.
+ */
+struct Probe {
+  bool Done = false;
+  std::set<std::string> Paths;
+};
+
+/**
+ * Remaining search interval of one path: the merge does not conflict on it at
+ * History[Lo], but does at History[Hi].
+ */
+struct PathSearch {
+  std::string Path;
+  size_t Lo;
+  size_t Hi;
+  /// With path filters: the sorted indices of the commits that may change
+  /// the outcome on the path.
+  std::vector<size_t> Changes;
+};
+
+/**
+ * Shrink the interval of \p S to the commits that may change its path: the
+ * outcome on the path is the same from one of them up to the next. Nothing
+ * changes if the filters do not explain the conflict.
+ */
+void snapToChanges(PathSearch &S) {
+  auto First = std::upper_bound(S.Changes.begin(), S.Changes.end(), S.Lo);
+  auto End = std::upper_bound(First, S.Changes.end(), S.Hi);
+  if (First == End) {
+    return;
+  }
+  S.Lo = *First - 1;
+  S.Hi = *(End - 1);
+}
+
+/**
+ * Indices of the commits of \p History (other than the first) that may
+ * change the outcome on \p Path: merges, whose merge base with the other
+ * side may move, and commits whose filter may overlap the path.
+ */
+std::vector<size_t> pathChanges(const std::vector<git_oid> &History,
+                                const std::vector<bool> &Merges,
+                                const PathIndex &Filters,
+                                const std::string &Path) {
+  PathIndex::Query Q = PathIndex::query(Path);
+  std::vector<size_t> Changes;
+  for (size_t I = 1; I < History.size(); ++I) {
+    if (Merges[I] || Filters.mayOverlap(History[I], Q)) {
+      Changes.push_back(I);
+    }
+  }
+  return Changes;
+}
+
+/**
+ * \p Base followed by the first-parent history of \p Tip since \p Base, oldest
+ * first.
+ */
+std::vector<git_oid> firstParentHistory(git_repository *Repo,
+                                        const git_oid &Base,
+                                        const git_oid &Tip) {
+  int error;
+
+  git_revwalk *Walk;
+  error = git_revwalk_new(&Walk, Repo);
+  checkError(error, "git_revwalk_new");
+  git_revwalk_sorting(Walk, GIT_SORT_TOPOLOGICAL | GIT_SORT_REVERSE);
+  git_revwalk_simplify_first_parent(Walk);
+  error = git_revwalk_push(Walk, &Tip);
+  if (!error) {
+    error = git_revwalk_hide(Walk, &Base);
+  }
+  if (error) {
+    git_revwalk_free(Walk);
+  }
+  checkError(error, "setting up revwalk");
+
+  std::vector<git_oid> History(1, Base);
+  git_oid Id;
+  while (git_revwalk_next(&Id, Walk) == 0) {
+    History.push_back(Id);
+  }
+  git_revwalk_free(Walk);
+  return History;
+}
+} // namespace
+
+size_t blameConflicts(git_repository *Repo, const std::string &RepoPath,
+                      const std::string &OurBranch,
+                      const std::string &TheirBranch, unsigned Jobs,
+                      const CheckOptions &Opts) {
+  int error;
+
+  CommitPtr Ours(lookupCommit(Repo, OurBranch));
+  CommitPtr Theirs(lookupCommit(Repo, TheirBranch));
+  git_oid OurId, TheirId, Base;
+  git_oid_cpy(&OurId, git_commit_id(Ours.get()));
+  git_oid_cpy(&TheirId, git_commit_id(Theirs.get()));
+  Ours.reset();
+  Theirs.reset();
+
+  error = git_merge_base(&Base, Repo, &OurId, &TheirId);
+  checkError(error, "git_merge_base");
+  std::vector<git_oid> History = firstParentHistory(Repo, Base, OurId);
+  if (Opts.Verbose) {
+    std::cout << "Searching " << History.size() - 1
+              << " first-parent commits of \'" << OurBranch
+              << "\' since the merge base..." << std::endl;
+  }
+
+  ThreadPool Pool(Jobs);
+  WorkerRepositories WorkerRepos(Repo, RepoPath, Pool.size());
+
+  CheckOptions ProbeOpts = Opts;
+  ProbeOpts.PrintConflicts = false;
+  ProbeOpts.Verbose = false;
+  const std::string Their = oidString(TheirId);
+
+  // the merge base is an ancestor of theirs, so merging into it never
+  // conflicts
+  std::vector<Probe> Probes(History.size());
+  Probes[0].Done = true;
+  size_t ProbeCount = 0, Rounds = 0;
+  auto runProbes = [&](const std::vector<size_t> &Indices) {
+    for (auto I : Indices) {
+      Pool.submit([&, I](unsigned Worker) {
+        std::ostringstream Ignored;
+        std::vector<Conflict> Records;
+        merge(WorkerRepos[Worker], oidString(History[I]), Their, ProbeOpts,
+              Ignored, &Records);
+        for (const auto &Record : Records) {
+          Probes[I].Paths.insert(Record.Path);
+        }
+        Probes[I].Done = true;
+      });
+    }
+    Pool.wait();
+    ProbeCount += Indices.size();
+  };
+
+  size_t Tip = History.size() - 1;
+  std::vector<PathSearch> Searches;
+  if (Tip > 0) {
+    runProbes({Tip});
+    for (const auto &Path : Probes[Tip].Paths) {
+      Searches.push_back(PathSearch{Path, 0, Tip, {}});
+    }
+  }
+
+  // with path filters, only the commits that may change a path are probed
+  const PathIndex *Filters = Opts.PathFilters;
+  if (Filters && !Searches.empty()) {
+    std::vector<bool> Merges(History.size(), false);
+    for (size_t I = 1; I <= Tip; ++I) {
+      git_commit *Raw;
+      error = git_commit_lookup(&Raw, Repo, &History[I]);
+      checkError(error, "git_commit_lookup");
+      CommitPtr Commit(Raw);
+      Merges[I] = git_commit_parentcount(Commit.get()) > 1;
+    }
+    std::vector<bool> Candidates(History.size(), false);
+    for (auto &S : Searches) {
+      S.Changes = pathChanges(History, Merges, *Filters, S.Path);
+      for (auto I : S.Changes) {
+        Candidates[I] = true;
+      }
+      snapToChanges(S);
+    }
+    if (Opts.Verbose) {
+      std::cout << "Path filters: "
+                << std::count(Candidates.begin(), Candidates.end(), true)
+                << " of " << Tip
+                << " commits may change the conflicting paths." << std::endl;
+    }
+  }
+
+  while (true) {
+    std::vector<PathSearch *> Open;
+    for (auto &S : Searches) {
+      if (S.Hi - S.Lo > 1) {
+        Open.push_back(&S);
+      }
+    }
+    if (Open.empty()) {
+      break;
+    }
+
+    // split every open interval into as many parts as there are workers to
+    // spare for it
+    size_t PerPath = std::max<size_t>(1, Pool.size() / Open.size());
+    std::set<size_t> Wanted;
+    for (const auto *S : Open) {
+      // the same split over the commits that may change the path, if the
+      // interval was snapped to them
+      auto First =
+          std::upper_bound(S->Changes.begin(), S->Changes.end(), S->Lo);
+      auto Last = std::lower_bound(First, S->Changes.end(), S->Hi);
+      if (Last != S->Changes.end() && *Last == S->Hi) {
+        size_t A = First - S->Changes.begin();
+        size_t Gap = Last - First + 1;
+        size_t Points = std::min(PerPath, Gap - 1);
+        for (size_t J = 1; J <= Points; ++J) {
+          Wanted.insert(S->Changes[A + Gap * J / (Points + 1) - 1]);
+        }
+        continue;
+      }
+      size_t Gap = S->Hi - S->Lo;
+      size_t Points = std::min(PerPath, Gap - 1);
+      for (size_t J = 1; J <= Points; ++J) {
+        Wanted.insert(S->Lo + Gap * J / (Points + 1));
+      }
+    }
+    std::vector<size_t> Pending;
+    for (auto I : Wanted) {
+      if (!Probes[I].Done) {
+        Pending.push_back(I);
+      }
+    }
+    runProbes(Pending);
+    ++Rounds;
+
+    // narrow the intervals using every probe inside them, including those
+    // requested for other paths
+    for (auto *S : Open) {
+      for (size_t I = S->Lo + 1; I < S->Hi; ++I) {
+        if (!Probes[I].Done) {
+          continue;
+        }
+        if (Probes[I].Paths.count(S->Path)) {
+          S->Hi = I;
+          break;
+        }
+        S->Lo = I;
+      }
+      snapToChanges(*S);
+    }
+  }
+
+  if (Opts.Verbose) {
+    std::cout << "Merged " << ProbeCount << " of " << Tip << " commits in "
+              << Rounds << " rounds." << std::endl;
+  }
+
+  for (const auto &S : Searches) {
+    git_commit *Raw;
+    error = git_commit_lookup(&Raw, Repo, &History[S.Hi]);
+    checkError(error, "git_commit_lookup");
+    CommitPtr Culprit(Raw);
+    std::cout << S.Path << ": " << oidString(History[S.Hi]) << " \""
+              << git_commit_summary(Culprit.get()) << "\"\n";
+  }
+  std::cout.flush();
+
+  return Searches.size();
+}
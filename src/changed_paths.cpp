@@ -0,0 +1,157 @@
+#include <functional>
+#include <unordered_set>
+
+#include "mergecheck/changed_paths.hpp"
+#include "mergecheck/utils.hpp"
+
+namespace {
+/**
+ * Called with the path and the old and new entry (nullptr if absent) of
+ * every difference.
+ */
+using EntryFn = std::function<void(
+    const std::string &Path, const git_tree_entry *Old,
+    const git_tree_entry *New)>;
+
+bool isTree(const git_tree_entry *E) {
+  return git_tree_entry_type(E) == GIT_OBJ_TREE;
+}
+
+void diffTrees(git_repository *Repo, const git_tree *Old, const git_tree *New,
+               const std::string &Prefix, bool ExpandSubtrees,
+               const EntryFn &Fn);
+
+/**
+ * Report an entry that only exists on one side.
+ */
+void addEntry(git_repository *Repo, const git_tree_entry *E,
+              const std::string &Path, bool Deleted, bool ExpandSubtrees,
+              const EntryFn &Fn) {
+  if (!ExpandSubtrees || !isTree(E)) {
+    Fn(Path, Deleted ? E : nullptr, Deleted ? nullptr : E);
+    return;
+  }
+
+  git_tree *Subtree;
+  int error = git_tree_lookup(&Subtree, Repo, git_tree_entry_id(E));
+  checkError(error, "git_tree_lookup");
+  if (Deleted) {
+    diffTrees(Repo, Subtree, nullptr, Path + "/", ExpandSubtrees, Fn);
+  } else {
+    diffTrees(Repo, nullptr, Subtree, Path + "/", ExpandSubtrees, Fn);
+  }
+  git_tree_free(Subtree);
+}
+
+void diffTrees(git_repository *Repo, const git_tree *Old, const git_tree *New,
+               const std::string &Prefix, bool ExpandSubtrees,
+               const EntryFn &Fn) {
+  int error;
+
+  size_t NewCount = New ? git_tree_entrycount(New) : 0;
+  for (size_t I = 0; I < NewCount; ++I) {
+    const git_tree_entry *NewEntry = git_tree_entry_byindex(New, I);
+    const char *Name = git_tree_entry_name(NewEntry);
+    std::string Path = Prefix + Name;
+    const git_tree_entry *OldEntry =
+        Old ? git_tree_entry_byname(Old, Name) : nullptr;
+
+    if (OldEntry == nullptr) {
+      addEntry(Repo, NewEntry, Path, false, ExpandSubtrees, Fn);
+      continue;
+    }
+    if (git_oid_equal(git_tree_entry_id(OldEntry),
+                      git_tree_entry_id(NewEntry)) &&
+        git_tree_entry_filemode(OldEntry) ==
+            git_tree_entry_filemode(NewEntry)) {
+      // identical file or subtree
+      continue;
+    }
+
+    if (isTree(OldEntry) && isTree(NewEntry)) {
+      git_tree *OldSubtree, *NewSubtree;
+      error = git_tree_lookup(&OldSubtree, Repo, git_tree_entry_id(OldEntry));
+      checkError(error, "git_tree_lookup");
+      error = git_tree_lookup(&NewSubtree, Repo, git_tree_entry_id(NewEntry));
+      checkError(error, "git_tree_lookup");
+      diffTrees(Repo, OldSubtree, NewSubtree, Path + "/", ExpandSubtrees, Fn);
+      git_tree_free(OldSubtree);
+      git_tree_free(NewSubtree);
+    } else if (isTree(OldEntry) || isTree(NewEntry)) {
+      // type change between file and directory
+      if (ExpandSubtrees) {
+        addEntry(Repo, OldEntry, Path, true, ExpandSubtrees, Fn);
+        addEntry(Repo, NewEntry, Path, false, ExpandSubtrees, Fn);
+      } else {
+        Fn(Path, OldEntry, NewEntry);
+      }
+    } else {
+      Fn(Path, OldEntry, NewEntry);
+    }
+  }
+
+  size_t OldCount = Old ? git_tree_entrycount(Old) : 0;
+  for (size_t I = 0; I < OldCount; ++I) {
+    const git_tree_entry *OldEntry = git_tree_entry_byindex(Old, I);
+    const char *Name = git_tree_entry_name(OldEntry);
+    if (New == nullptr || git_tree_entry_byname(New, Name) == nullptr) {
+      addEntry(Repo, OldEntry, Prefix + Name, true, ExpandSubtrees, Fn);
+    }
+  }
+}
+
+bool hasPathOrParent(const std::string &Path,
+                     const std::unordered_set<std::string> &Set) {
+  for (auto Pos = Path.find('/'); Pos != std::string::npos;
+       Pos = Path.find('/', Pos + 1)) {
+    if (Set.count(Path.substr(0, Pos))) {
+      return true;
+    }
+  }
+  return Set.count(Path) > 0;
+}
+} // namespace
+
+void changedPaths(git_repository *Repo, const git_tree *Old,
+                  const git_tree *New, std::vector<std::string> &Paths,
+                  bool ExpandSubtrees) {
+  diffTrees(Repo, Old, New, "", ExpandSubtrees,
+            [&](const std::string &Path, const git_tree_entry *,
+                const git_tree_entry *) { Paths.push_back(Path); });
+}
+
+void changedEntries(git_repository *Repo, const git_tree *Old,
+                    const git_tree *New, std::vector<ChangedEntry> &Entries,
+                    bool ExpandSubtrees, const std::string &Prefix) {
+  diffTrees(Repo, Old, New, Prefix, ExpandSubtrees,
+            [&](const std::string &Path, const git_tree_entry *OldEntry,
+                const git_tree_entry *NewEntry) {
+              ChangedEntry E{Path, {}, {}, 0, 0};
+              if (OldEntry) {
+                git_oid_cpy(&E.OldId, git_tree_entry_id(OldEntry));
+                E.OldMode = git_tree_entry_filemode(OldEntry);
+              }
+              if (NewEntry) {
+                git_oid_cpy(&E.NewId, git_tree_entry_id(NewEntry));
+                E.NewMode = git_tree_entry_filemode(NewEntry);
+              }
+              Entries.push_back(std::move(E));
+            });
+}
+
+bool pathsOverlap(const std::vector<std::string> &A,
+                  const std::vector<std::string> &B) {
+  std::unordered_set<std::string> SetA(A.begin(), A.end());
+  std::unordered_set<std::string> SetB(B.begin(), B.end());
+  for (const auto &Path : A) {
+    if (hasPathOrParent(Path, SetB)) {
+      return true;
+    }
+  }
+  for (const auto &Path : B) {
+    if (hasPathOrParent(Path, SetA)) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,101 @@
+#include <ostream>
+
+#include "mergecheck/checker.hpp"
+#include "mergecheck/deadline.hpp"
+#include "mergecheck/merge.hpp"
+#include "mergecheck/patch.hpp"
+#include "mergecheck/rebase.hpp"
+#include "mergecheck/utils.hpp"
+
+namespace {
+/**
+ * Run \p Check and turn a thrown exception into a Status.
+ */
+template <typename F> Status guarded(F Check) {
+  Status Result;
+  try {
+    Check();
+  } catch (const DeadlineExceeded &Ex) {
+    Result.Code = Ex.code();
+    Result.Message = Ex.what();
+    Result.TimedOut = true;
+    Result.Phase = Ex.Phase;
+    Result.Steps = Ex.Steps;
+  } catch (const GitError &Ex) {
+    Result.Code = Ex.code();
+    Result.Message = Ex.what();
+  } catch (const std::exception &Ex) {
+    // e.g. std::bad_alloc or a std::system_error from a thread
+    Result.Code = GIT_ERROR;
+    Result.Message = Ex.what();
+  }
+  return Result;
+}
+
+/**
+ * Library calls do not print; the command-level functions they use get a
+ * stream without a buffer, which discards everything.
+ */
+CheckOptions quiet(const CheckOptions &Opts) {
+  CheckOptions Quiet = Opts;
+  Quiet.PrintConflicts = false;
+  Quiet.Verbose = false;
+  return Quiet;
+}
+} // namespace
+
+Status Checker::open(const std::string &RepoPath,
+                     std::unique_ptr<Checker> &Out) {
+  git_libgit2_init();
+  std::unique_ptr<Checker> Result(new Checker());
+  Status S = guarded([&] {
+    git_repository *Raw = nullptr;
+    int error = git_repository_open(&Raw, RepoPath.c_str());
+    checkError(error, "opening repository");
+    Result->Repo.reset(Raw);
+  });
+  if (S.ok()) {
+    Out = std::move(Result);
+  }
+  // on failure, the destructor of Result balances git_libgit2_init()
+  return S;
+}
+
+Checker::~Checker() {
+  Repo.reset();
+  git_libgit2_shutdown();
+}
+
+Status Checker::merge(const std::string &OurBranch,
+                      const std::string &TheirBranch, const CheckOptions &Opts,
+                      std::vector<Conflict> &Conflicts) {
+  Conflicts.clear();
+  return guarded([&] {
+    std::ostream Discard(nullptr);
+    ::merge(Repo.get(), OurBranch, TheirBranch, quiet(Opts), Discard,
+            &Conflicts);
+  });
+}
+
+Status Checker::rebase(const std::string &UpstreamBranch,
+                       const std::string &Branch,
+                       const std::string &OntoCommit, const CheckOptions &Opts,
+                       std::vector<Conflict> &Conflicts) {
+  Conflicts.clear();
+  return guarded([&] {
+    std::ostream Discard(nullptr);
+    ::rebase(Repo.get(), UpstreamBranch, Branch, OntoCommit, quiet(Opts),
+             Discard, &Conflicts);
+  });
+}
+
+Status Checker::patch(const std::string &Target, const std::string &Base,
+                      const std::string &Patch, const CheckOptions &Opts,
+                      std::vector<Conflict> &Conflicts) {
+  Conflicts.clear();
+  return guarded([&] {
+    std::ostream Discard(nullptr);
+    checkPatch(Repo.get(), Target, Base, Patch, quiet(Opts), Discard,
+               &Conflicts);
+  });
+}
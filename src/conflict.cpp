@@ -1,21 +1,83 @@
 #include "mergecheck/conflict.hpp"
 
-std::ostream &printConflict(Conflict C, const std::string &LocalRef,
-                            const std::string &RemoteRef, std::ostream &O) {
+ConflictKind conflictKind(IndexConflict C) {
   if (C.Our == nullptr) {
-    O << "CONFLICT (modify/delete): " << C.Their->path
+    return ConflictKind::DeletedInOurs;
+  }
+  if (C.Their == nullptr) {
+    return ConflictKind::DeletedInTheirs;
+  }
+  // "normal conflict"
+  if (C.Ancestor == nullptr) {
+    return ConflictKind::AddAdd;
+  }
+  return ConflictKind::Content;
+}
+
+const char *conflictPath(IndexConflict C) {
+  if (C.Our != nullptr) {
+    return C.Our->path;
+  }
+  if (C.Their != nullptr) {
+    return C.Their->path;
+  }
+  return C.Ancestor->path;
+}
+
+Conflict toConflict(IndexConflict C) {
+  Conflict Result{conflictKind(C), conflictPath(C), {}, {}, {}, 0, 0, 0};
+  if (C.Ancestor) {
+    git_oid_cpy(&Result.AncestorId, &C.Ancestor->id);
+    Result.AncestorMode = C.Ancestor->mode;
+  }
+  if (C.Our) {
+    git_oid_cpy(&Result.OurId, &C.Our->id);
+    Result.OurMode = C.Our->mode;
+  }
+  if (C.Their) {
+    git_oid_cpy(&Result.TheirId, &C.Their->id);
+    Result.TheirMode = C.Their->mode;
+  }
+  return Result;
+}
+
+const char *conflictKindName(ConflictKind Kind) {
+  switch (Kind) {
+  case ConflictKind::DeletedInOurs:
+    return "delete/modify";
+  case ConflictKind::DeletedInTheirs:
+    return "modify/delete";
+  case ConflictKind::AddAdd:
+    return "add/add";
+  case ConflictKind::Content:
+    break;
+  }
+  return "content";
+}
+
+std::ostream &printConflict(IndexConflict C, const std::string &LocalRef,
+                            const std::string &RemoteRef, std::ostream &O) {
+  return printConflict(toConflict(C), LocalRef, RemoteRef, O);
+}
+
+std::ostream &printConflict(const Conflict &C,
+                            const std::string &LocalRef,
+                            const std::string &RemoteRef, std::ostream &O) {
+  switch (C.Kind) {
+  case ConflictKind::DeletedInOurs:
+    O << "CONFLICT (modify/delete): " << C.Path
       << " deleted in HEAD and modified in " << RemoteRef << ".\n";
-  } else if (C.Their == nullptr) {
-    O << "CONFLICT (modify/delete): " << C.Our->path << " deleted in "
-      << LocalRef << " and modified in HEAD.\n";
-  } else {
-    std::string reason = "content";
-    // "normal conflict"
-    if (C.Ancestor == nullptr) {
-      reason = "add/add";
-    }
-    O << "CONFLICT (" << reason << "): Merge conflict in " << C.Our->path
-      << "\n";
+    break;
+  case ConflictKind::DeletedInTheirs:
+    O << "CONFLICT (modify/delete): " << C.Path << " deleted in " << LocalRef
+      << " and modified in HEAD.\n";
+    break;
+  case ConflictKind::AddAdd:
+    O << "CONFLICT (add/add): Merge conflict in " << C.Path << "\n";
+    break;
+  case ConflictKind::Content:
+    O << "CONFLICT (content): Merge conflict in " << C.Path << "\n";
+    break;
   }
   return O;
 }
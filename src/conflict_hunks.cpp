@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include "mergecheck/conflict_hunks.hpp"
+#include "mergecheck/deadline.hpp"
+#include "mergecheck/handles.hpp"
+#include "mergecheck/thread_pool.hpp"
+#include "mergecheck/utils.hpp"
+
+namespace {
+/// Like git, a blob is binary if its first 8000 bytes contain a NUL.
+const size_t BinaryProbeSize = 8000;
+const size_t MarkerSize = 7;
+
+using OdbObjectPtr = GitPtr<git_odb_object, git_odb_object_free>;
+
+bool isMarker(const char *Line, size_t Size, char Ch) {
+  if (Size < MarkerSize) {
+    return false;
+  }
+  for (size_t I = 0; I < MarkerSize; ++I) {
+    if (Line[I] != Ch) {
+      return false;
+    }
+  }
+  return Size == MarkerSize || Line[MarkerSize] == ' ' ||
+         Line[MarkerSize] == '\n' || Line[MarkerSize] == '\r';
+}
+
+/**
+ * Find the conflict markers in a merge result in diff3 style.
+ */
+std::vector<ConflictHunk> parseHunks(const char *Data, size_t Size) {
+  enum { Outside, Ours, Base, Theirs } State = Outside;
+  std::vector<ConflictHunk> Hunks;
+  ConflictHunk Hunk{};
+
+  size_t LineNo = 0;
+  for (size_t Pos = 0; Pos < Size;) {
+    const char *Line = Data + Pos;
+    const char *Eol =
+        static_cast<const char *>(std::memchr(Line, '\n', Size - Pos));
+    size_t Length = Eol ? Eol - Line + 1 : Size - Pos;
+    Pos += Length;
+    ++LineNo;
+
+    switch (State) {
+    case Outside:
+      if (isMarker(Line, Length, '<')) {
+        Hunk = ConflictHunk{LineNo, 0, 0, 0, 0};
+        State = Ours;
+      }
+      break;
+    case Ours:
+      if (isMarker(Line, Length, '|')) {
+        State = Base;
+      } else if (isMarker(Line, Length, '=')) {
+        State = Theirs;
+      } else {
+        ++Hunk.OurLines;
+      }
+      break;
+    case Base:
+      if (isMarker(Line, Length, '=')) {
+        State = Theirs;
+      } else {
+        ++Hunk.BaseLines;
+      }
+      break;
+    case Theirs:
+      if (isMarker(Line, Length, '>')) {
+        Hunk.End = LineNo;
+        Hunks.push_back(Hunk);
+        State = Outside;
+      } else {
+        ++Hunk.TheirLines;
+      }
+      break;
+    }
+  }
+  return Hunks;
+}
+
+void mergeFile(git_odb *Odb, const Conflict &C, size_t MaxBytes,
+               const Deadline *Limit, FileHunks &Result) {
+  int error;
+
+  if (Limit && Limit->expired()) {
+    Result.Status = HunkStatus::TimedOut;
+    return;
+  }
+
+  if (C.Kind != ConflictKind::Content && C.Kind != ConflictKind::AddAdd) {
+    Result.Status = HunkStatus::NotContent;
+    return;
+  }
+
+  // an add/add conflict has no ancestor; it is merged against an empty file
+  const git_oid *Ids[] = {&C.AncestorId, &C.OurId, &C.TheirId};
+  const uint32_t Modes[] = {C.AncestorMode, C.OurMode, C.TheirMode};
+
+  // headers first, so that large blobs are never inflated
+  for (size_t I = 0; I < 3; ++I) {
+    size_t Size = 0;
+    git_otype Type;
+    if (!Modes[I]) {
+      continue;
+    }
+    if (git_odb_read_header(&Size, &Type, Odb, Ids[I]) != 0) {
+      Result.Status = HunkStatus::Failed;
+      return;
+    }
+    if (Size > MaxBytes) {
+      Result.Status = HunkStatus::TooLarge;
+      return;
+    }
+  }
+
+  OdbObjectPtr Blobs[3];
+  git_merge_file_input Inputs[3];
+  for (size_t I = 0; I < 3; ++I) {
+    git_merge_file_init_input(&Inputs[I], GIT_MERGE_FILE_INPUT_VERSION);
+    if (!Modes[I]) {
+      Inputs[I].ptr = "";
+      continue;
+    }
+    git_odb_object *Raw = nullptr;
+    if (git_odb_read(&Raw, Odb, Ids[I]) != 0) {
+      Result.Status = HunkStatus::Failed;
+      return;
+    }
+    Blobs[I].reset(Raw);
+    const char *Data = static_cast<const char *>(git_odb_object_data(Raw));
+    size_t Size = git_odb_object_size(Raw);
+    if (std::memchr(Data, 0, std::min(Size, BinaryProbeSize))) {
+      Result.Status = HunkStatus::Binary;
+      return;
+    }
+    Inputs[I].ptr = Data;
+    Inputs[I].size = Size;
+    Inputs[I].path = C.Path.c_str();
+    Inputs[I].mode = Modes[I];
+  }
+
+  git_merge_file_options Opts;
+  git_merge_file_init_options(&Opts, GIT_MERGE_FILE_OPTIONS_VERSION);
+  Opts.flags = GIT_MERGE_FILE_STYLE_DIFF3;
+
+  git_merge_file_result Merged{};
+  error = git_merge_file(&Merged, &Inputs[0], &Inputs[1], &Inputs[2], &Opts);
+  if (error) {
+    Result.Status = HunkStatus::Failed;
+    return;
+  }
+  Result.Status = HunkStatus::Merged;
+  Result.Hunks = parseHunks(Merged.ptr, Merged.len);
+  git_merge_file_result_free(&Merged);
+}
+} // namespace
+
+std::vector<FileHunks> conflictHunks(git_repository *Repo,
+                                     const std::vector<Conflict> &Conflicts,
+                                     unsigned Jobs, size_t MaxBytes,
+                                     const Deadline *Limit) {
+  std::vector<FileHunks> Result(Conflicts.size());
+
+  // the object database can be read concurrently; no per-worker handles are
+  // needed
+  git_odb *RawOdb = nullptr;
+  int error = git_repository_odb(&RawOdb, Repo);
+  checkError(error, "git_repository_odb");
+  OdbPtr Odb(RawOdb);
+
+  unsigned Threads = Jobs ? Jobs : std::thread::hardware_concurrency();
+  Threads = static_cast<unsigned>(
+      std::min<size_t>(std::max(Threads, 1u), Conflicts.size()));
+  if (Threads <= 1) {
+    for (size_t I = 0; I < Conflicts.size(); ++I) {
+      mergeFile(Odb.get(), Conflicts[I], MaxBytes, Limit, Result[I]);
+    }
+    return Result;
+  }
+
+  ThreadPool Pool(Threads);
+  for (size_t I = 0; I < Conflicts.size(); ++I) {
+    Pool.submit([&, I](unsigned) {
+      mergeFile(Odb.get(), Conflicts[I], MaxBytes, Limit, Result[I]);
+    });
+  }
+  Pool.wait();
+  return Result;
+}
+
+const char *hunkStatusName(HunkStatus Status) {
+  switch (Status) {
+  case HunkStatus::NotContent:
+    return "not-content";
+  case HunkStatus::TooLarge:
+    return "too-large";
+  case HunkStatus::Binary:
+    return "binary";
+  case HunkStatus::Failed:
+    return "failed";
+  case HunkStatus::TimedOut:
+    return "timed-out";
+  case HunkStatus::Merged:
+    break;
+  }
+  return "merged";
+}
+
+std::ostream &printHunks(const FileHunks &Hunks, std::ostream &O) {
+  switch (Hunks.Status) {
+  case HunkStatus::Merged:
+    for (const auto &H : Hunks.Hunks) {
+      O << "  lines " << H.Start << "-" << H.End << ": " << H.OurLines
+        << " ours, " << H.BaseLines << " base, " << H.TheirLines
+        << " theirs\n";
+    }
+    if (Hunks.Hunks.empty()) {
+      O << "  no conflicting hunks on the file level\n";
+    }
+    break;
+  case HunkStatus::NotContent:
+    break;
+  case HunkStatus::TooLarge:
+    O << "  hunks skipped: file too large\n";
+    break;
+  case HunkStatus::Binary:
+    O << "  hunks skipped: binary file\n";
+    break;
+  case HunkStatus::Failed:
+    O << "  hunks skipped: file could not be merged\n";
+    break;
+  case HunkStatus::TimedOut:
+    O << "  hunks skipped: deadline exceeded\n";
+    break;
+  }
+  return O;
+}
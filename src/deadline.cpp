@@ -0,0 +1,103 @@
+#include "mergecheck/deadline.hpp"
+#include "mergecheck/renames.hpp"
+
+struct Deadline::TimedMetric {
+  git_diff_similarity_metric Metric;
+  const git_diff_similarity_metric *Inner;
+  const Deadline *Limit;
+
+  /// Whether the callback should fail; marks the deadline as fired if so.
+  bool stop() const {
+    if (!Limit->expired()) {
+      return false;
+    }
+    Limit->Fired = true;
+    return true;
+  }
+};
+
+namespace {
+const Deadline::TimedMetric &payload(void *P) {
+  return *static_cast<const Deadline::TimedMetric *>(P);
+}
+
+int timedFileSignature(void **Out, const git_diff_file *File,
+                       const char *Path, void *P) {
+  const Deadline::TimedMetric &Timed = payload(P);
+  if (Timed.stop()) {
+    return GIT_EUSER;
+  }
+  return Timed.Inner->file_signature(Out, File, Path, Timed.Inner->payload);
+}
+
+int timedBufferSignature(void **Out, const git_diff_file *File,
+                         const char *Buf, size_t Size, void *P) {
+  const Deadline::TimedMetric &Timed = payload(P);
+  if (Timed.stop()) {
+    return GIT_EUSER;
+  }
+  return Timed.Inner->buffer_signature(Out, File, Buf, Size,
+                                       Timed.Inner->payload);
+}
+
+void timedFreeSignature(void *Signature, void *P) {
+  const Deadline::TimedMetric &Timed = payload(P);
+  Timed.Inner->free_signature(Signature, Timed.Inner->payload);
+}
+
+int timedSimilarity(int *Score, void *A, void *B, void *P) {
+  const Deadline::TimedMetric &Timed = payload(P);
+  if (Timed.stop()) {
+    return GIT_EUSER;
+  }
+  return Timed.Inner->similarity(Score, A, B, Timed.Inner->payload);
+}
+} // namespace
+
+Deadline::Deadline(std::chrono::milliseconds Budget)
+    : Budget(Budget), End(Clock::now() + Budget) {}
+
+Deadline::~Deadline() = default;
+
+void Deadline::check(const std::string &Phase, size_t Steps) const {
+  if (expired()) {
+    throw DeadlineExceeded(Phase, Steps);
+  }
+}
+
+const git_diff_similarity_metric *
+Deadline::renameMetric(const git_diff_similarity_metric *Inner) const {
+  if (!Inner) {
+    Inner = &defaultRenameMetric();
+  }
+  std::lock_guard<std::mutex> Guard(Lock);
+  for (const auto &Timed : Metrics) {
+    if (Timed->Inner == Inner) {
+      return &Timed->Metric;
+    }
+  }
+  Metrics.emplace_back(new TimedMetric{
+      {timedFileSignature, timedBufferSignature, timedFreeSignature,
+       timedSimilarity, nullptr},
+      Inner,
+      this});
+  TimedMetric &Timed = *Metrics.back();
+  Timed.Metric.payload = &Timed;
+  return &Timed.Metric;
+}
+
+void checkError(int ErrorCode, const std::string &Action,
+                const Deadline *Limit, const std::string &Phase) {
+  // libgit2 turns a failing similarity() into -1, so any error counts
+  if (ErrorCode < 0 && Limit && Limit->fired()) {
+    throw DeadlineExceeded(Phase);
+  }
+  checkError(ErrorCode, Action);
+}
+
+bool stoppedAt(const GitError &Ex, const Deadline *Limit) {
+  if (!Limit) {
+    return false;
+  }
+  return Limit->fired() || (Ex.code() == GIT_EUSER && Limit->expired());
+}
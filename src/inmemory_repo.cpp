@@ -0,0 +1,43 @@
+#include <git2/sys/mempack.h>
+#include <git2/sys/odb_backend.h>
+
+#include "mergecheck/alternates.hpp"
+#include "mergecheck/inmemory_repo.hpp"
+#include "mergecheck/utils.hpp"
+
+InMemoryRepository::InMemoryRepository(git_repository *Source) {
+  int error;
+
+  error = git_repository_open(&Repo, git_repository_path(Source));
+  checkError(error, "opening repository");
+  try {
+    attachAlternates(Repo);
+
+    git_odb *Odb;
+    error = git_repository_odb(&Odb, Repo);
+    checkError(error, "git_repository_odb");
+    error = git_mempack_new(&Mempack);
+    if (!error) {
+      // highest priority, so that all writes go to memory
+      error = git_odb_add_backend(Odb, Mempack, 1000);
+      if (error) {
+        // only owned by the object database once it was added
+        Mempack->free(Mempack);
+        Mempack = nullptr;
+      }
+    }
+    git_odb_free(Odb);
+    checkError(error, "adding in-memory object backend");
+  } catch (...) {
+    git_repository_free(Repo);
+    throw;
+  }
+}
+
+InMemoryRepository::~InMemoryRepository() {
+  if (Mempack) {
+    git_mempack_reset(Mempack);
+  }
+  // frees the backend along with the object database
+  git_repository_free(Repo);
+}
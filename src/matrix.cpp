@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+#include "mergecheck/changed_paths.hpp"
+#include "mergecheck/handles.hpp"
+#include "mergecheck/matrix.hpp"
+#include "mergecheck/merge.hpp"
+#include "mergecheck/refs.hpp"
+#include "mergecheck/string_utils.hpp"
+#include "mergecheck/thread_pool.hpp"
+#include "mergecheck/utils.hpp"
+#include "mergecheck/worker_repos.hpp"
+
+namespace {
+/**
+ * A set of interned path ids, stored as a dense bitset. Only the words in
+ * [Begin, End) can be non-zero, so intersecting two sparse sets only touches
+ * the range where both have bits.
+ */
+class PathSet {
+public:
+  void resize(size_t Ids) { Words.assign((Ids + 63) / 64, 0); }
+
+  void insert(uint32_t Id) {
+    size_t Word = Id / 64;
+    Words[Word] |= uint64_t(1) << (Id % 64);
+    Begin = std::min(Begin, Word);
+    End = std::max(End, Word + 1);
+  }
+
+  bool intersects(const PathSet &Other) const {
+    size_t From = std::max(Begin, Other.Begin);
+    size_t To = std::min(End, Other.End);
+    // branch-free so the compiler can vectorize the loop
+    uint64_t Any = 0;
+    for (size_t I = From; I < To; ++I) {
+      Any |= Words[I] & Other.Words[I];
+    }
+    return Any != 0;
+  }
+
+  size_t intersectionSize(const PathSet &Other) const {
+    size_t From = std::max(Begin, Other.Begin);
+    size_t To = std::min(End, Other.End);
+    size_t Count = 0;
+    for (size_t I = From; I < To; ++I) {
+      Count += __builtin_popcountll(Words[I] & Other.Words[I]);
+    }
+    return Count;
+  }
+
+private:
+  std::vector<uint64_t> Words;
+  size_t Begin = SIZE_MAX;
+  size_t End = 0;
+};
+
+struct BranchChanges {
+  std::vector<std::string> Paths;
+  std::string Error;
+  /// changed files
+  PathSet Leaves;
+  /// parent directories of changed files
+  PathSet Dirs;
+};
+
+/**
+ * Paths \p Tip changed relative to its merge base with \p Target.
+ */
+std::vector<std::string> changedSinceMergeBase(git_repository *Repo,
+                                               const git_oid &Target,
+                                               const std::string &Tip) {
+  int error;
+
+  CommitPtr TipCommit(lookupCommit(Repo, Tip));
+  git_oid BaseId{};
+  TreePtr BaseTree;
+  error =
+      git_merge_base(&BaseId, Repo, &Target, git_commit_id(TipCommit.get()));
+  if (error != GIT_ENOTFOUND) {
+    checkError(error, "git_merge_base");
+    git_commit *RawBase;
+    error = git_commit_lookup(&RawBase, Repo, &BaseId);
+    checkError(error, "git_commit_lookup");
+    CommitPtr Base(RawBase);
+    git_tree *Raw;
+    error = git_commit_tree(&Raw, Base.get());
+    checkError(error, "git_commit_tree");
+    BaseTree.reset(Raw);
+  }
+  TreePtr TipTree;
+  {
+    git_tree *Raw;
+    error = git_commit_tree(&Raw, TipCommit.get());
+    checkError(error, "git_commit_tree");
+    TipTree.reset(Raw);
+  }
+
+  std::vector<std::string> Paths;
+  changedPaths(Repo, BaseTree.get(), TipTree.get(), Paths, true);
+  return Paths;
+}
+
+bool mayConflict(const BranchChanges &A, const BranchChanges &B) {
+  return A.Leaves.intersects(B.Leaves) || A.Leaves.intersects(B.Dirs) ||
+         A.Dirs.intersects(B.Leaves);
+}
+} // namespace
+
+std::vector<std::string> readBranches(std::istream &In) {
+  std::vector<std::string> Branches;
+  std::string Line;
+  while (std::getline(In, Line)) {
+    Trim(Line);
+    if (Line.empty() || Line[0] == '#') {
+      continue;
+    }
+    Branches.push_back(Line);
+  }
+  return Branches;
+}
+
+size_t matrix(git_repository *Repo, const std::string &RepoPath,
+              const std::string &Target,
+              const std::vector<std::string> &Branches, unsigned Jobs,
+              const CheckOptions &Opts) {
+  git_commit *TargetCommit = lookupCommit(Repo, Target);
+  git_oid TargetId;
+  git_oid_cpy(&TargetId, git_commit_id(TargetCommit));
+  git_commit_free(TargetCommit);
+
+  ThreadPool Pool(Jobs);
+  WorkerRepositories WorkerRepos(Repo, RepoPath, Pool.size());
+
+  // 1. changed paths of every branch relative to the target
+  if (Opts.Verbose) {
+    std::cout << "Collecting changed paths of " << Branches.size()
+              << " branches..." << std::endl;
+  }
+  std::vector<BranchChanges> Changes(Branches.size());
+  for (size_t I = 0; I < Branches.size(); ++I) {
+    Pool.submit([&, I](unsigned Worker) {
+      try {
+        Changes[I].Paths =
+            changedSinceMergeBase(WorkerRepos[Worker], TargetId, Branches[I]);
+      } catch (const GitError &Ex) {
+        Changes[I].Error = Ex.what();
+      }
+    });
+  }
+  Pool.wait();
+
+  // 2. intern paths and their parent directories into dense ids
+  std::unordered_map<std::string, uint32_t> Ids;
+  auto intern = [&Ids](const std::string &Path) {
+    return Ids.emplace(Path, static_cast<uint32_t>(Ids.size())).first->second;
+  };
+  std::vector<std::vector<uint32_t>> LeafIds(Branches.size());
+  std::vector<std::vector<uint32_t>> DirIds(Branches.size());
+  for (size_t I = 0; I < Branches.size(); ++I) {
+    for (const auto &Path : Changes[I].Paths) {
+      LeafIds[I].push_back(intern(Path));
+      for (auto Pos = Path.find('/'); Pos != std::string::npos;
+           Pos = Path.find('/', Pos + 1)) {
+        DirIds[I].push_back(intern(Path.substr(0, Pos)));
+      }
+    }
+    Changes[I].Paths.clear();
+  }
+  for (size_t I = 0; I < Branches.size(); ++I) {
+    Changes[I].Leaves.resize(Ids.size());
+    Changes[I].Dirs.resize(Ids.size());
+    for (auto Id : LeafIds[I]) {
+      Changes[I].Leaves.insert(Id);
+    }
+    for (auto Id : DirIds[I]) {
+      Changes[I].Dirs.insert(Id);
+    }
+  }
+
+  // 3. candidate pairs: branches that changed a common path
+  std::vector<std::pair<size_t, size_t>> Candidates;
+  for (size_t I = 0; I < Branches.size(); ++I) {
+    if (!Changes[I].Error.empty()) {
+      continue;
+    }
+    for (size_t J = I + 1; J < Branches.size(); ++J) {
+      if (Changes[J].Error.empty() && mayConflict(Changes[I], Changes[J])) {
+        Candidates.emplace_back(I, J);
+      }
+    }
+  }
+  if (Opts.Verbose) {
+    size_t Pairs = Branches.size() * (Branches.size() - 1) / 2;
+    std::cout << Ids.size() << " distinct paths, " << Candidates.size()
+              << " of " << Pairs << " pairs share changed paths." << std::endl;
+  }
+
+  // 4. merge the candidate pairs
+  CheckOptions PairOpts = Opts;
+  PairOpts.Verbose = false;
+  std::vector<size_t> Conflicts(Candidates.size(), 0);
+  std::vector<std::string> Output(Candidates.size());
+  for (size_t K = 0; K < Candidates.size(); ++K) {
+    Pool.submit([&, K](unsigned Worker) {
+      std::ostringstream O;
+      try {
+        Conflicts[K] =
+            merge(WorkerRepos[Worker], Branches[Candidates[K].first],
+                  Branches[Candidates[K].second], PairOpts, O);
+      } catch (const GitError &Ex) {
+        O << Ex.what() << "\n";
+      }
+      Output[K] = O.str();
+    });
+  }
+  Pool.wait();
+
+  // 5. print the conflict graph
+  size_t Total = 0;
+  std::vector<std::vector<size_t>> Adjacent(Branches.size());
+  for (size_t K = 0; K < Candidates.size(); ++K) {
+    size_t I = Candidates[K].first, J = Candidates[K].second;
+    std::cout << Output[K];
+    if (Opts.Verbose) {
+      std::cout << Branches[I] << " " << Branches[J] << ": "
+                << Changes[I].Leaves.intersectionSize(Changes[J].Leaves)
+                << " common paths, " << Conflicts[K] << " conflicts\n";
+    }
+    if (Conflicts[K] > 0) {
+      Adjacent[I].push_back(J);
+      Adjacent[J].push_back(I);
+      Total += Conflicts[K];
+    }
+  }
+
+  for (size_t I = 0; I < Branches.size(); ++I) {
+    std::cout << Branches[I] << ":";
+    if (!Changes[I].Error.empty()) {
+      std::cout << " error (" << Changes[I].Error << ")\n";
+      continue;
+    }
+    std::sort(Adjacent[I].begin(), Adjacent[I].end());
+    for (auto J : Adjacent[I]) {
+      std::cout << " " << Branches[J];
+    }
+    std::cout << "\n";
+  }
+  std::cout.flush();
+
+  return Total;
+}
@@ -1,105 +1,490 @@
+#include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <vector>
 
+#include "mergecheck/changed_paths.hpp"
 #include "mergecheck/conflict.hpp"
+#include "mergecheck/conflict_hunks.hpp"
+#include "mergecheck/deadline.hpp"
+#include "mergecheck/handles.hpp"
 #include "mergecheck/merge.hpp"
+#include "mergecheck/record_writer.hpp"
+#include "mergecheck/refs.hpp"
+#include "mergecheck/renames.hpp"
+#include "mergecheck/result_cache.hpp"
+#include "mergecheck/scope.hpp"
+#include "mergecheck/sharded_merge.hpp"
+#include "mergecheck/trace.hpp"
+#include "mergecheck/tree_conflicts.hpp"
 #include "mergecheck/utils.hpp"
 
+namespace {
+/**
+ * Look up the merge base of \p Ours and \p Theirs and store it in \p Base
+ * (nullptr for unrelated histories). Returns false if there are several merge
+ * bases; the recursive merge then depends on more than one base tree.
+ */
+bool uniqueMergeBase(git_repository *Repo, const git_commit *Ours,
+                     const git_commit *Theirs, git_commit *&Base) {
+  int error;
+  TraceScope Trace("merge base");
+
+  Base = nullptr;
+  git_oidarray Bases{};
+  error = git_merge_bases(&Bases, Repo, git_commit_id(Ours),
+                          git_commit_id(Theirs));
+  if (error == GIT_ENOTFOUND) {
+    return true;
+  }
+  checkError(error, "git_merge_bases");
+  if (Bases.count != 1) {
+    git_oidarray_free(&Bases);
+    return false;
+  }
+  error = git_commit_lookup(&Base, Repo, &Bases.ids[0]);
+  git_oidarray_free(&Bases);
+  checkError(error, "git_commit_lookup");
+  return true;
+}
+
+MergeKey mergeKey(const git_commit *Base, const git_commit *Ours,
+                  const git_commit *Theirs, const CheckOptions &Opts) {
+  MergeKey Key{};
+  if (Base) {
+    git_oid_cpy(&Key.Base, git_commit_tree_id(Base));
+  }
+  git_oid_cpy(&Key.Ours, git_commit_tree_id(Ours));
+  git_oid_cpy(&Key.Theirs, git_commit_tree_id(Theirs));
+  Key.Variant = static_cast<uint32_t>(Opts.Renames) |
+                std::min(Opts.RenameThreshold, 127u) << 2 |
+                std::min(Opts.RenameLimit, 0x7fffffu) << 9;
+  return Key;
+}
+
+/**
+ * The tree of \p Commit, or nullptr if there is no commit.
+ */
+git_tree *commitTree(const git_commit *Commit) {
+  git_tree *Tree = nullptr;
+  if (Commit) {
+    int error = git_commit_tree(&Tree, Commit);
+    checkError(error, "git_commit_tree");
+  }
+  return Tree;
+}
+
+/**
+ * Merge the trees of \p Ours and \p Theirs with mergeTreesSharded() on
+ * Opts.MergeJobs workers and append the conflicts to \p Records. Returns false
+ * if the shards would not reproduce a single merge. At the deadline, the
+ * conflicts of the finished shards are kept and \p Interrupted is set.
+ */
+bool shardedMerge(git_repository *Repo, const git_commit *Base,
+                  const git_commit *Ours, const git_commit *Theirs,
+                  const git_merge_options &MergeOpts,
+                  const CheckOptions &Opts, std::vector<Conflict> &Records,
+                  std::string &Interrupted, std::ostream &O) {
+  TraceScope Trace("sharded merge");
+  TreePtr BaseTree(commitTree(Base));
+  TreePtr OurTree(commitTree(Ours));
+  TreePtr TheirTree(commitTree(Theirs));
+  size_t Shards = 0;
+  bool Merged = true;
+  try {
+    Merged =
+        mergeTreesSharded(Repo, BaseTree.get(), OurTree.get(), TheirTree.get(),
+                          MergeOpts, Opts.MergeJobs, Records, Shards,
+                          Opts.TimeLimit);
+  } catch (const DeadlineExceeded &Ex) {
+    Interrupted = Ex.Phase;
+  }
+  if (Opts.Verbose) {
+    if (!Interrupted.empty()) {
+      O << "Sharded merge: deadline exceeded, " << Records.size()
+        << " conflicts in the finished shards.\n";
+    } else if (Merged) {
+      O << "Sharded merge: " << Shards << " shards, " << Records.size()
+        << " conflicts.\n";
+    } else {
+      O << "Sharded merge: renames or a directory/file conflict across "
+           "shards, merging in one piece.\n";
+    }
+  }
+  return Merged;
+}
+
+/**
+ * Collect the changes of both sides relative to \p Base, only inside \p Scope
+ * unless it is empty.
+ */
+void collectChanges(git_repository *Repo, const git_commit *Base,
+                    const git_commit *Ours, const git_commit *Theirs,
+                    const std::vector<std::string> &Scope,
+                    std::vector<ChangedEntry> &OurChanges,
+                    std::vector<ChangedEntry> &TheirChanges) {
+  int error;
+
+  git_tree *BaseTree = nullptr, *OurTree, *TheirTree;
+  if (Base) {
+    error = git_commit_tree(&BaseTree, Base);
+    checkError(error, "git_commit_tree");
+  }
+  error = git_commit_tree(&OurTree, Ours);
+  checkError(error, "git_commit_tree");
+  error = git_commit_tree(&TheirTree, Theirs);
+  checkError(error, "git_commit_tree");
+
+  if (Scope.empty()) {
+    changedEntries(Repo, BaseTree, OurTree, OurChanges);
+    changedEntries(Repo, BaseTree, TheirTree, TheirChanges);
+  } else {
+    changedEntriesInScope(Repo, BaseTree, OurTree, TheirTree, Scope,
+                          OurChanges, TheirChanges);
+  }
+
+  git_tree_free(BaseTree);
+  git_tree_free(OurTree);
+  git_tree_free(TheirTree);
+}
+
+/**
+ * Whether both sides changed disjoint sets of paths relative to \p Base, in
+ * which case the merge is clean without looking at any file contents. The
+ * changes are kept in \p OurChanges and \p TheirChanges for the rename scan.
+ */
+bool changesDisjoint(git_repository *Repo, const git_commit *Base,
+                     const git_commit *Ours, const git_commit *Theirs,
+                     const std::vector<std::string> &Scope,
+                     std::vector<ChangedEntry> &OurChanges,
+                     std::vector<ChangedEntry> &TheirChanges) {
+  TraceScope Trace("prefilter");
+
+  collectChanges(Repo, Base, Ours, Theirs, Scope, OurChanges, TheirChanges);
+  std::vector<std::string> OurPaths, TheirPaths;
+  for (const auto &E : OurChanges) {
+    OurPaths.push_back(E.Path);
+  }
+  for (const auto &E : TheirChanges) {
+    TheirPaths.push_back(E.Path);
+  }
+  return !pathsOverlap(OurPaths, TheirPaths);
+}
+} // namespace
+
+bool reportConflicts(git_repository *Repo,
+                     const std::vector<Conflict> &Conflicts,
+                     const CheckOptions &Opts, const std::string &OurBranch,
+                     const std::string &TheirBranch,
+                     const std::string &LocalRef, const std::string &RemoteRef,
+                     std::ostream &O) {
+  std::vector<FileHunks> Hunks;
+  if (Opts.ConflictHunks) {
+    TraceScope Trace("conflict hunks");
+    Hunks = conflictHunks(Repo, Conflicts, Opts.HunkJobs, Opts.HunkMaxBytes,
+                          Opts.TimeLimit);
+  }
+  bool Complete = true;
+  for (size_t I = 0; I < Conflicts.size(); ++I) {
+    const FileHunks *FileHunks = Hunks.empty() ? nullptr : &Hunks[I];
+    if (FileHunks && FileHunks->Status == HunkStatus::TimedOut) {
+      Complete = false;
+    }
+    if (Opts.PrintConflicts) {
+      printConflict(Conflicts[I], LocalRef, RemoteRef, O);
+      if (FileHunks) {
+        printHunks(*FileHunks, O);
+      }
+    }
+    if (Opts.Records) {
+      Opts.Records->conflict(OurBranch, TheirBranch, Conflicts[I], FileHunks);
+    }
+  }
+  return Complete;
+}
+
 size_t merge(git_repository *Repo, const std::string &OurBranch,
              const std::string &TheirBranch, bool PrintConflicts,
              bool Verbose) {
-  int error;
+  CheckOptions Opts;
+  Opts.PrintConflicts = PrintConflicts;
+  Opts.Verbose = Verbose;
+  return merge(Repo, OurBranch, TheirBranch, Opts, std::cout);
+}
 
-  git_reference *OurRef, *TheirRef;
-  git_annotated_commit *OurHead, *TheirHead;
-  git_commit *Ours, *Theirs;
-  const char *OurBranchShort = nullptr;
-  const char *TheirBranchShort = nullptr;
+namespace {
+/**
+ * Merge \p TheirTip into \p OurTip. The conflicts are recorded under
+ * \p OurBranch and \p TheirBranch and printed with \p LocalRef and
+ * \p RemoteRef.
+ */
+size_t mergeTips(git_repository *Repo, const git_oid &OurTip,
+                 const git_oid &TheirTip, const std::string &OurBranch,
+                 const std::string &TheirBranch, const std::string &LocalRef,
+                 const std::string &RemoteRef, const CheckOptions &Opts,
+                 std::ostream &O, std::vector<Conflict> *Conflicting) {
+  int error;
+  const bool PrintConflicts = Opts.PrintConflicts;
+  const bool Verbose = Opts.Verbose;
 
-  // get "OurBranch" commit
-  error = git_reference_lookup(&OurRef, Repo, OurBranch.c_str());
-  if (!error) {
-    error = git_annotated_commit_from_ref(&OurHead, Repo, OurRef);
-    checkError(error, "git_annotated_commit");
-    // get short name for nicer program output
-    error = git_branch_name(&OurBranchShort, OurRef);
-    checkError(error, "git_branch_name");
-  } else {
-    // try to parse as commit id
-    git_oid Oid{};
-    error = git_oid_fromstrp(&Oid, OurBranch.c_str());
-    checkError(error, "git_oid_fromstrp");
-    error = git_annotated_commit_lookup(&OurHead, Repo, &Oid);
-    checkError(error, "git_annotated_commit");
-  }
-  error = git_commit_lookup(&Ours, Repo, git_annotated_commit_id(OurHead));
+  git_commit *Raw;
+  error = git_commit_lookup(&Raw, Repo, &OurTip);
   checkError(error, "git_commit_lookup");
+  CommitPtr Ours(Raw);
 
-  // get "TheirBranch" commit
-  error = git_reference_lookup(&TheirRef, Repo, TheirBranch.c_str());
-  if (!error) {
-    error = git_annotated_commit_from_ref(&TheirHead, Repo, TheirRef);
-    checkError(error, "git_annotated_commit");
-    // get short name for nicer program output
-    error = git_branch_name(&TheirBranchShort, TheirRef);
-    checkError(error, "git_branch_name");
-  } else {
-    // try to parse as commit id
-    git_oid Oid{};
-    error = git_oid_fromstrp(&Oid, TheirBranch.c_str());
-    checkError(error, "git_oid_fromstrp");
-    error = git_annotated_commit_lookup(&TheirHead, Repo, &Oid);
-    checkError(error, "git_annotated_commit");
-  }
-  error = git_commit_lookup(&Theirs, Repo, git_annotated_commit_id(TheirHead));
+  error = git_commit_lookup(&Raw, Repo, &TheirTip);
   checkError(error, "git_commit_lookup");
+  CommitPtr Theirs(Raw);
 
-  if (Verbose) {
-    std::cout << "Attempting to merge..." << std::endl;
+  Raw = nullptr;
+  bool UniqueBase = (Opts.Cache || Opts.Prefilter ||
+                     Opts.Renames != RenameMode::Off || !Opts.Paths.empty() ||
+                     Opts.TreeOnly || Opts.MergeJobs != 1) &&
+                    uniqueMergeBase(Repo, Ours.get(), Theirs.get(), Raw);
+  CommitPtr Base(Raw);
+  // scoped and tree-only results depend on options that are not part of the
+  // cache key
+  bool Cacheable =
+      Opts.Cache && UniqueBase && Opts.Paths.empty() && !Opts.TreeOnly;
+  // tree entries are only compared against a single merge base tree
+  bool TreeOnly = UniqueBase && Opts.TreeOnly;
+  // the scope can only be merged on its own with a single merge base tree
+  bool Scoped = UniqueBase && !Opts.Paths.empty();
+  // shards are merged on the subtrees of a single merge base tree
+  bool Sharded = UniqueBase && Opts.MergeJobs != 1;
+  MergeKey Key{};
+  if (Cacheable) {
+    Key = mergeKey(Base.get(), Ours.get(), Theirs.get(), Opts);
   }
+  std::vector<Conflict> Records;
+  std::vector<ChangedEntry> OurChanges, TheirChanges;
+  const Deadline *Limit = Opts.TimeLimit;
+  // the phase that ran into the deadline, with the conflicts so far
+  std::string Interrupted;
+  // once interrupted, the conflicts found are reported without hunks
+  auto Report = [&] {
+    CheckOptions ReportOpts = Opts;
+    ReportOpts.ConflictHunks = Opts.ConflictHunks && Interrupted.empty();
+    if (!reportConflicts(Repo, Records, ReportOpts, OurBranch, TheirBranch,
+                         LocalRef, RemoteRef, O)) {
+      Interrupted = "conflict hunks";
+    }
+  };
 
-  git_index *MergeIndex;
-  git_merge_options MergeOpts{};
-  error = git_merge_init_options(&MergeOpts, GIT_MERGE_OPTIONS_VERSION);
-  checkError(error, "git_merge_init_options");
+  size_t Conflicts = 0;
+  if (Cacheable && Opts.Cache->lookup(Key, Records)) {
+    if (Verbose) {
+      O << "Using cached merge result.\n";
+    }
+    Conflicts = Records.size();
+    Report();
+  } else if (Opts.Prefilter && UniqueBase &&
+             changesDisjoint(Repo, Base.get(), Ours.get(), Theirs.get(),
+                             Opts.Paths, OurChanges, TheirChanges)) {
+    if (Verbose) {
+      O << "Prefilter: changed paths are disjoint, skipping merge.\n";
+    }
+    if (Cacheable) {
+      Opts.Cache->store(Key, Records);
+    }
+  } else {
+    if (Verbose && Opts.Prefilter) {
+      O << (UniqueBase ? "Prefilter: changed paths overlap, running full "
+                         "merge.\n"
+                       : "Prefilter: several merge bases, running full "
+                         "merge.\n");
+    }
+    if (Limit) {
+      Limit->check("merge");
+    }
+    if (Verbose) {
+      O << "Attempting to merge..." << std::endl;
+    }
 
-  error = git_merge_commits(&MergeIndex, Repo, Ours, Theirs, &MergeOpts);
-  checkError(error, "git_merge_commits");
+    git_merge_options MergeOpts{};
+    error = git_merge_init_options(&MergeOpts, GIT_MERGE_OPTIONS_VERSION);
+    checkError(error, "git_merge_init_options");
 
-  // get conflicts
-  git_index_conflict_iterator *ConflictIt;
-  git_index_conflict_iterator_new(&ConflictIt, MergeIndex);
-  checkError(error, "iterator empty");
+    // renames only matter if one side moved a path the other side changed
+    RenameMode Renames = Opts.Renames;
+    if (Renames != RenameMode::Off && UniqueBase && !TreeOnly) {
+      TraceScope RenameTrace("rename scan");
+      if (!Opts.Prefilter) {
+        collectChanges(Repo, Base.get(), Ours.get(), Theirs.get(), Opts.Paths,
+                       OurChanges, TheirChanges);
+      }
+      RenameScan Scan = scanRenames(Repo, OurChanges, TheirChanges, Renames,
+                                    renameLimit(Repo, Opts));
+      if (Verbose) {
+        printRenameScan(Scan, Renames, O);
+      }
+      Renames = effectiveRenameMode(Renames, Scan);
+    }
+    setRenameOptions(MergeOpts, Renames, Opts);
+    // libgit2 only calls the metric for similarity-based detection
+    RenameTimer DetectionTimer;
+    bool TimeRenames = Verbose && Renames == RenameMode::Full;
+    if (TimeRenames) {
+      DetectionTimer.wrap(MergeOpts);
+    }
 
-  size_t Conflicts = 0;
-  Conflict C{};
-  while ((error = git_index_conflict_next(&C.Ancestor, &C.Our, &C.Their,
-                                          ConflictIt)) == 0) {
-    Conflicts++;
-    if (PrintConflicts) {
-      printConflict(C, OurBranchShort ? OurBranchShort : OurBranch,
-                    TheirBranchShort ? TheirBranchShort : TheirBranch,
-                    std::cout);
+    if (TreeOnly) {
+      TreePtr BaseTree(commitTree(Base.get()));
+      TreePtr OurTree(commitTree(Ours.get()));
+      TreePtr TheirTree(commitTree(Theirs.get()));
+      {
+        TraceScope Trace("tree-only merge");
+        Records = treeConflicts(Repo, BaseTree.get(), OurTree.get(),
+                                TheirTree.get(), Opts.Paths);
+      }
+      if (Verbose) {
+        O << "Tree-only: " << Records.size()
+          << " paths changed differently on both sides.\n";
+      }
+      if (Opts.Confirm && !Records.empty()) {
+        TraceScope Trace("confirm");
+        std::vector<std::string> Flagged;
+        for (const auto &R : Records) {
+          Flagged.push_back(R.Path);
+        }
+        std::vector<Conflict> Confirmed;
+        runTimed(Limit, "confirm", [&] {
+          mergeTreesInScope(Repo, BaseTree.get(), OurTree.get(),
+                            TheirTree.get(), normalizeScope(Flagged),
+                            MergeOpts, Confirmed);
+        });
+        if (Verbose) {
+          O << "Confirm: " << Confirmed.size() << " of " << Records.size()
+            << " paths conflict.\n";
+        }
+        Records = std::move(Confirmed);
+      }
+      Conflicts = Records.size();
+      Report();
+    } else if (Scoped) {
+      TraceScope Trace("scoped merge");
+      TreePtr BaseTree(commitTree(Base.get()));
+      TreePtr OurTree(commitTree(Ours.get()));
+      TreePtr TheirTree(commitTree(Theirs.get()));
+      runTimed(Limit, "merge", [&] {
+        mergeTreesInScope(Repo, BaseTree.get(), OurTree.get(),
+                          TheirTree.get(), Opts.Paths, MergeOpts, Records);
+      });
+      Conflicts = Records.size();
+      if (Verbose) {
+        O << "Finished merging.\n";
+      }
+      Report();
+    } else if (Sharded && shardedMerge(Repo, Base.get(), Ours.get(),
+                                       Theirs.get(), MergeOpts, Opts,
+                                       Records, Interrupted, O)) {
+      Conflicts = Records.size();
+      Report();
+    } else {
+      git_index *RawIndex;
+      {
+        // merge base, tree merge, rename detection and content merge
+        TraceScope Trace("git_merge_commits");
+        error = git_merge_commits(&RawIndex, Repo, Ours.get(), Theirs.get(),
+                                  &MergeOpts);
+      }
+      checkError(error, "git_merge_commits", Limit, "merge");
+      IndexPtr MergeIndex(RawIndex);
+      TraceScope IterationTrace("conflict iteration");
+
+      // get conflicts
+      git_index_conflict_iterator *ConflictIt;
+      error = git_index_conflict_iterator_new(&ConflictIt, MergeIndex.get());
+      checkError(error, "git_index_conflict_iterator_new");
+
+      IndexConflict C{};
+      while ((error = git_index_conflict_next(&C.Ancestor, &C.Our, &C.Their,
+                                              ConflictIt)) == 0) {
+        // with several merge bases, the scope is only applied here
+        if (!Opts.Paths.empty() && !inScope(toConflict(C).Path, Opts.Paths)) {
+          continue;
+        }
+        if (Limit && Limit->expired()) {
+          Interrupted = "conflict iteration";
+          break;
+        }
+        Conflicts++;
+        if (Cacheable || Conflicting || Opts.ConflictHunks) {
+          Records.push_back(toConflict(C));
+        }
+        // with hunks, conflicts are reported once all files are merged
+        if (Opts.ConflictHunks) {
+          continue;
+        }
+        if (PrintConflicts) {
+          printConflict(C, LocalRef, RemoteRef, O);
+        }
+        if (Opts.Records) {
+          Opts.Records->conflict(OurBranch, TheirBranch, toConflict(C));
+        }
+      }
+      git_index_conflict_iterator_free(ConflictIt);
+
+      if (Verbose) {
+        O << "Finished merging.\n";
+      }
+
+      if (error != GIT_ITEROVER) {
+        checkError(error, "git_index_conflict_next");
+      }
+      // with hunks, the conflicts were only collected so far
+      if (Opts.ConflictHunks) {
+        Report();
+      }
+    }
+    if (TimeRenames) {
+      printRenameTiming(DetectionTimer, O);
+    }
+    if (Cacheable && Interrupted.empty()) {
+      Opts.Cache->store(Key, Records);
     }
   }
-  git_index_conflict_iterator_free(ConflictIt);
 
-  if (Verbose) {
-    std::cout << "Finished merging.\n";
+  if (Conflicting) {
+    *Conflicting = std::move(Records);
   }
-
-  if (error != GIT_ITEROVER) {
-    std::cerr << "An error occured during merging!\n";
+  if (!Interrupted.empty()) {
+    throw DeadlineExceeded(Interrupted);
+  }
+  if (Opts.Records) {
+    Opts.Records->result("merge", OurBranch, TheirBranch, Conflicts);
   }
 
-  // clean up merge stuff...
-  git_index_free(MergeIndex);
-  git_commit_free(Ours);
-  git_commit_free(Theirs);
-  git_annotated_commit_free(OurHead);
-  git_annotated_commit_free(TheirHead);
-  git_reference_free(OurRef);
-  git_reference_free(TheirRef);
-
+  traceCounters();
   return Conflicts;
 }
+} // namespace
+
+size_t merge(git_repository *Repo, const std::string &OurBranch,
+             const std::string &TheirBranch, const CheckOptions &Opts,
+             std::ostream &O, std::vector<Conflict> *Conflicting) {
+  TraceScope Trace("merge");
+  std::string LocalRef, RemoteRef;
+  git_oid OurTip, TheirTip;
+
+  // get "OurBranch" commit
+  AnnotatedCommitPtr OurHead(lookupAnnotatedCommit(Repo, OurBranch, &LocalRef));
+  git_oid_cpy(&OurTip, git_annotated_commit_id(OurHead.get()));
+
+  // get "TheirBranch" commit
+  AnnotatedCommitPtr TheirHead(
+      lookupAnnotatedCommit(Repo, TheirBranch, &RemoteRef));
+  git_oid_cpy(&TheirTip, git_annotated_commit_id(TheirHead.get()));
+
+  return mergeTips(Repo, OurTip, TheirTip, OurBranch, TheirBranch, LocalRef,
+                   RemoteRef, Opts, O, Conflicting);
+}
+
+size_t merge(git_repository *Repo, const git_oid &OurTip,
+             const git_oid &TheirTip, const std::string &OurBranch,
+             const std::string &TheirBranch, const CheckOptions &Opts,
+             std::ostream &O, std::vector<Conflict> *Conflicting) {
+  TraceScope Trace("merge");
+  return mergeTips(Repo, OurTip, TheirTip, OurBranch, TheirBranch, OurBranch,
+                   TheirBranch, Opts, O, Conflicting);
+}
@@ -1,3 +1,8 @@
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -5,29 +10,111 @@
 #include <boost/program_options.hpp>
 #include <git2.h>
 
+#include "mergecheck/alternates.hpp"
+#include "mergecheck/batch.hpp"
+#include "mergecheck/blame.hpp"
+#include "mergecheck/deadline.hpp"
+#include "mergecheck/matrix.hpp"
 #include "mergecheck/merge.hpp"
+#include "mergecheck/patch.hpp"
+#include "mergecheck/path_index.hpp"
 #include "mergecheck/rebase.hpp"
+#include "mergecheck/record_writer.hpp"
 #include "mergecheck/remote.hpp"
+#include "mergecheck/renames.hpp"
+#include "mergecheck/result_cache.hpp"
+#include "mergecheck/scope.hpp"
+#include "mergecheck/server.hpp"
+#include "mergecheck/status.hpp"
 #include "mergecheck/string_utils.hpp"
+#include "mergecheck/trace.hpp"
+#include "mergecheck/train.hpp"
 #include "mergecheck/utils.hpp"
 
 namespace po = boost::program_options;
 
+namespace {
+/// Exit code of a check cancelled at its deadline, the same as timeout(1).
+const int ExitDeadlineExceeded = 124;
+
+int reportConflicts(size_t Conflicts) {
+  if (Conflicts > 0) {
+    std::cout << "Found " << Conflicts << " conflicts in total." << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  std::cout << "Good news, everyone! Branches can be merged automatically "
+               "without conflicts."
+            << std::endl;
+  return EXIT_SUCCESS;
+}
+
+std::string absolutePath(const std::string &Path) {
+  char Resolved[PATH_MAX];
+  if (realpath(Path.c_str(), Resolved) == nullptr) {
+    return Path;
+  }
+  return Resolved;
+}
+
+void reportTrace(bool Timings, const std::string &TracePath,
+                 std::ostream &O) {
+  if (Timings) {
+    printTimings(O);
+  }
+  if (!TracePath.empty() && !writeTrace(TracePath)) {
+    std::cerr << "Warning: Could not write trace to '" << TracePath
+              << "'.\n";
+  }
+}
+} // namespace
+
 int main(int argc, char *argv[]) {
   // global cmd-line arguments
   std::string RepoPath;
   std::string RemoteUrl;
   std::string RemoteName;
+  std::string SocketPath;
+  std::vector<std::string> AlternateRepos;
   bool Verbose = false;
   bool PrintConflicts = false;
   bool AddRemote = false;
+  bool UseResultCache = false;
+  size_t ResultCacheSize = 64;
+  std::string TracePath;
+  std::string FormatName = "human";
+  size_t HunkMaxBytes = 1 << 20;
+  std::string RenamesName = "full";
+  unsigned RenameThreshold = 0;
+  unsigned RenameLimit = 0;
+  unsigned DeadlineMs = 0;
 
   // cmd-line arguments for 'merge' subcommand
   std::string MergeOurBranch, MergeTheirBranch;
+  unsigned MergeJobs = 1;
+  // 'merge' and 'rebase'
+  std::vector<std::string> ScopePaths;
 
   // cmd-line arguments for 'rebase' subcommand
   std::string RebaseUpstreamBranch, RebaseBranch;
   std::string RebaseOntoCommit;
+  unsigned RebaseJobs = 1;
+
+  // cmd-line arguments for 'batch' subcommand
+  std::string BatchInput;
+  unsigned BatchJobs = 0;
+
+  // cmd-line arguments for 'matrix', 'status' and 'train' subcommands (also
+  // use BatchInput and BatchJobs; 'blame-conflict' uses MergeOurBranch,
+  // MergeTheirBranch and BatchJobs, 'path-index' uses BatchJobs, 'patch'
+  // uses TargetBranch and BatchInput)
+  std::string TargetBranch;
+
+  // cmd-line arguments for 'patch' subcommand
+  std::string PatchBase = "HEAD";
+
+  // cmd-line arguments for 'serve' subcommand
+  unsigned ServeJobs = 0;
 
   /* clang-format off */
   po::options_description Global("Global options");
@@ -36,10 +123,82 @@ int main(int argc, char *argv[]) {
        "Path to the repository")
     ("remote-url", po::value<std::string>(&RemoteUrl),
        "Add a new remote to the repository.\n(This is not an im-memory "
-       "operation and changes the repository!)")
+       "operation and changes the repository!) Only the branches referenced "
+       "as refs/remotes/<name>/... are fetched, and only if their tips are "
+       "missing locally.")
     ("remote-name", po::value<std::string>(&RemoteName),
        "Name for the new  remote (e.g. \'upstream\')")
+    ("alternate-repo",
+       po::value<std::vector<std::string>>(&AlternateRepos)->composing(),
+       "[<name>=]<path> of a repository on the same filesystem whose objects "
+       "are made readable for this check, without fetching or writing "
+       "anything. Its refs can be used as \"refs/alternates/<name>/...\", "
+       "e.g. \"refs/alternates/fork/heads/master\". Without a name, the base "
+       "name of the path is used. Can be repeated.")
+    ("socket", po::value<std::string>(&SocketPath),
+       "Unix domain socket of a \'serve\' daemon. Required for \'serve\' "
+       "and \'stats\'. For \'merge\' and \'rebase\', the check is "
+       "forwarded to the daemon if one is listening.")
     ("print-conflicts", "List all conflicts.")
+    ("result-cache",
+       "Cache merge results in <gitdir>/mergecheck/ and reuse them for "
+       "identical merge-base and side trees.")
+    ("result-cache-size", po::value<size_t>(&ResultCacheSize),
+       "Size limit of the result cache in MiB (default: 64).")
+    ("no-prefilter",
+       "Always run the content merge, even if both sides changed disjoint "
+       "sets of paths.")
+    ("no-path-filters",
+       "Ignore the changed-path filters written by 'path-index'.")
+    ("timings",
+       "Print how much time was spent in each phase of the check (reference "
+       "lookup, merge base, prefilter, merge, rebase steps, ...) and the "
+       "memory counters. Checks are done locally, not by a daemon.")
+    ("trace", po::value<std::string>(&TracePath),
+       "Write the phases and memory counters to this file in the Chrome "
+       "trace event format (chrome://tracing, Perfetto). Checks are done "
+       "locally, not by a daemon.")
+    ("conflict-hunks",
+       "'merge', 'batch' and 'patch': merge every conflicting file in memory "
+       "and list its conflicting hunks (line ranges in the file with "
+       "diff3-style conflict markers, and the number of lines of every "
+       "side). Implies '--print-conflicts'.")
+    ("conflict-hunks-max-bytes", po::value<size_t>(&HunkMaxBytes),
+       "Skip the hunks of files with a side larger than this (default: "
+       "1048576). Binary files are always skipped.")
+    ("tree-only",
+       "'merge' and 'batch': decide on tree entries alone and never read a "
+       "file. Paths that both sides changed to different ids or modes are "
+       "reported as potential conflicts; a path changed by one side only, or "
+       "in the same way by both, is clean. Renames are not detected.")
+    ("confirm",
+       "With '--tree-only': run the content merge on the reported paths only "
+       "and keep the real conflicts.")
+    ("renames", po::value<std::string>(&RenamesName),
+       "Rename detection of merges and rebase steps: 'off' (a rename is a "
+       "deletion and an addition), 'exact' (only renames without content "
+       "changes, matched by blob id) or 'full' (similarity-based, like 'git "
+       "merge'; default). Detection is skipped when no renamed path was "
+       "changed on the other side.")
+    ("rename-threshold", po::value<unsigned>(&RenameThreshold),
+       "Similarity in percent at which a pair is a rename with "
+       "'--renames=full' (default: 50).")
+    ("rename-limit", po::value<unsigned>(&RenameLimit),
+       "Skip similarity-based rename detection if the sides changed more "
+       "files than this (default: merge.renameLimit or diff.renameLimit, "
+       "otherwise 1000).")
+    ("format", po::value<std::string>(&FormatName),
+       "Output format of 'merge', 'rebase', 'batch' and 'patch': 'human' "
+       "(default), 'jsonl' (one JSON object per line) or 'csv'. The "
+       "machine-readable formats stream one record per conflict and per "
+       "check, followed by a summary record, and suppress all other output "
+       "on stdout.")
+    ("deadline", po::value<unsigned>(&DeadlineMs),
+       "'merge', 'rebase' and 'patch': cancel the check after this many "
+       "milliseconds, counted from the start. It stops between rebase "
+       "steps, between conflicts and during rename detection, prints the "
+       "conflicts found so far, the completed steps and the interrupted "
+       "phase, and exits with code 124.")
     ("verbose,v", "Be verbose.")("help,h", "Print this help text.")
   ;
 
@@ -61,6 +220,17 @@ int main(int argc, char *argv[]) {
        "Commit/Ref that reflects the destination tree")
     ("their", po::value<std::string>(&MergeTheirBranch)->required(),
        "Commit/Ref to merge in to \"our\" commit")
+    ("path", po::value<std::vector<std::string>>(&ScopePaths)->composing(),
+       "Only check this file or directory. Conflicts elsewhere are ignored "
+       "and subtrees outside are not merged (they are taken from \"our\" "
+       "side). Can be repeated. Paths are literal; globs are rejected (use "
+       "\":(literal)\" for names with '*', '?' or '['). Renames into or out "
+       "of the paths are not detected, and the result cache is not used.")
+    ("jobs,j", po::value<unsigned>(&MergeJobs)->default_value(1),
+       "Number of threads merging the top-level directories that both sides "
+       "changed, each on its own (0 = number of hardware threads). The "
+       "conflicts are the same as those of a single merge; if renames are "
+       "detected, the trees are merged in one piece.")
   ;
 
   po::options_description RebaseDesc("Options for \'rebase\' command");
@@ -73,6 +243,99 @@ int main(int argc, char *argv[]) {
        "(Optional) If specified, the new commits will start at this point. "
        "Can be any valid commit."
        "If unspecified, the starting point will be <upstream>.")
+    ("cumulative",
+       "Commit every replayed step (in memory only), so that each commit is "
+       "checked on top of the ones before it, like a real rebase does. "
+       "Conflicts are resolved in favour of the replayed commit.")
+    ("per-commit",
+       "Always replay the commits one by one. By default, the branch is "
+       "first merged in a single step and only replayed if that merge "
+       "conflicts.")
+    ("jobs,j", po::value<unsigned>(&RebaseJobs)->default_value(1),
+       "Number of worker threads replaying commits (0 = number of hardware "
+       "threads). Cannot be combined with --cumulative.")
+    ("first-conflict", "Stop at the first commit that conflicts.")
+    ("path", po::value<std::vector<std::string>>(&ScopePaths)->composing(),
+       "Only check this file or directory (see 'merge'). Can be repeated. "
+       "Steps are replayed independently (as with '--jobs'), except for "
+       "cumulative rebases, which only ignore conflicts elsewhere.")
+  ;
+
+  po::options_description BatchDesc("Options for \'batch\' command");
+  BatchDesc.add_options()
+    ("input", po::value<std::string>(&BatchInput)->default_value("-"),
+       "File with one \"<our> <their>\" pair per line. Use \'-\' to read "
+       "from stdin.")
+    ("jobs,j", po::value<unsigned>(&BatchJobs)->default_value(0),
+       "Number of worker threads (0 = number of hardware threads).")
+  ;
+
+  po::options_description MatrixDesc("Options for \'matrix\' command");
+  MatrixDesc.add_options()
+    ("target", po::value<std::string>(&TargetBranch)->required(),
+       "Commit/Ref the branches will be merged into. Changed paths of every "
+       "branch are computed relative to its merge base with this commit.")
+    ("input", po::value<std::string>(&BatchInput)->default_value("-"),
+       "File with one branch (Commit/Ref) per line. Use \'-\' to read from "
+       "stdin.")
+    ("jobs,j", po::value<unsigned>(&BatchJobs)->default_value(0),
+       "Number of worker threads (0 = number of hardware threads).")
+  ;
+
+  po::options_description StatusDesc("Options for \'status\' command");
+  StatusDesc.add_options()
+    ("target", po::value<std::string>(&TargetBranch)->required(),
+       "Commit/Ref the branches will be merged into.")
+    ("input", po::value<std::string>(&BatchInput)->default_value("-"),
+       "File with one branch (Commit/Ref) per line. Use \'-\' to read from "
+       "stdin.")
+  ;
+
+  po::options_description TrainDesc("Options for \'train\' command");
+  TrainDesc.add_options()
+    ("target", po::value<std::string>(&TargetBranch)->required(),
+       "Commit/Ref the train starts from.")
+    ("input", po::value<std::string>(&BatchInput)->default_value("-"),
+       "File with one Commit/Ref per line, in the order they are merged. "
+       "Use \'-\' to read from stdin.")
+    ("jobs,j", po::value<unsigned>(&BatchJobs)->default_value(0),
+       "Number of worker threads (0 = number of hardware threads). The "
+       "queue is split into one speculatively evaluated segment per "
+       "worker.")
+  ;
+
+  po::options_description BlameDesc("Options for \'blame-conflict\' command");
+  BlameDesc.add_options()
+    ("our", po::value<std::string>(&MergeOurBranch)->required(),
+       "Commit/Ref whose first-parent history is searched")
+    ("their", po::value<std::string>(&MergeTheirBranch)->required(),
+       "Commit/Ref to merge in to \"our\" commit")
+    ("jobs,j", po::value<unsigned>(&BatchJobs)->default_value(0),
+       "Number of worker threads (0 = number of hardware threads).")
+  ;
+
+  po::options_description PathIndexDesc("Options for \'path-index\' command");
+  PathIndexDesc.add_options()
+    ("jobs,j", po::value<unsigned>(&BatchJobs)->default_value(0),
+       "Number of worker threads (0 = number of hardware threads).")
+  ;
+
+  po::options_description PatchDesc("Options for \'patch\' command");
+  PatchDesc.add_options()
+    ("target", po::value<std::string>(&TargetBranch)->required(),
+       "Commit/Ref the patch would be merged into.")
+    ("base", po::value<std::string>(&PatchBase)->default_value("HEAD"),
+       "Commit/Ref the patch was made against.")
+    ("input", po::value<std::string>(&BatchInput)->default_value("-"),
+       "File with a unified diff, e.g. from \'git diff HEAD\'. Use \'-\' to "
+       "read from stdin.")
+  ;
+
+  po::options_description ServeDesc("Options for \'serve\' command");
+  ServeDesc.add_options()
+    ("jobs,j", po::value<unsigned>(&ServeJobs)->default_value(0),
+       "Number of requests handled concurrently (0 = number of hardware "
+       "threads).")
   ;
   /* clang-format on */
 
@@ -90,17 +353,103 @@ int main(int argc, char *argv[]) {
     std::cout << "Available commands:\n"
               << "  merge\t\t\tJoin two development histories together\n"
               << "  rebase\t\tReapply commits on top of another base tip\n"
+              << "  batch\t\t\tCheck many branch pairs in one process\n"
+              << "  matrix\t\tFind all pairs of branches that conflict with "
+                 "each other\n"
+              << "  status\t\tCheck branches against a target, reusing the "
+                 "results of\n\t\t\tthe previous run\n"
+              << "  train\t\t\tMerge a queue of branches one after "
+                 "another into a target\n"
+              << "  blame-conflict\tFind the commits of \"our\" history "
+                 "from which on each\n\t\t\tconflicting path conflicts\n"
+              << "  path-index\t\tStore changed-path filters of all commits "
+                 "that speed up\n\t\t\t\'blame-conflict\' and \'rebase\'\n"
+              << "  patch\t\t\tCheck a diff against a target without "
+                 "committing it\n"
+              << "  serve\t\t\tKeep repositories open and answer checks "
+                 "over a socket\n"
+              << "  stats\t\t\tPrint the statistics of a running daemon\n"
               << "\n";
     std::cout << Global << "\n";
     std::cout << MergeDesc << "\n";
-    std::cout << RebaseDesc;
+    std::cout << RebaseDesc << "\n";
+    std::cout << BatchDesc << "\n";
+    std::cout << MatrixDesc << "\n";
+    std::cout << StatusDesc << "\n";
+    std::cout << TrainDesc << "\n";
+    std::cout << BlameDesc << "\n";
+    std::cout << PathIndexDesc << "\n";
+    std::cout << PatchDesc << "\n";
+    std::cout << ServeDesc;
     return EXIT_SUCCESS;
   }
 
   Verbose = Vm.count("verbose") > 0;
   PrintConflicts = Vm.count("print-conflicts") > 0;
+  UseResultCache = Vm.count("result-cache") > 0;
+  bool Timings = Vm.count("timings") > 0;
+  if (Timings || !TracePath.empty()) {
+    enableTracing();
+  }
   std::string Command = Vm["command"].as<std::string>();
 
+  OutputFormat Format;
+  if (!parseOutputFormat(FormatName, Format)) {
+    std::cerr << "Error: Unknown format '" << FormatName << "'.\n";
+    return EXIT_FAILURE;
+  }
+  if (Format != OutputFormat::Human && Command != "merge" &&
+      Command != "rebase" && Command != "batch" && Command != "patch") {
+    std::cerr << "Error: '--format' is only supported by 'merge', "
+                 "'rebase', 'batch' and 'patch'.\n";
+    return EXIT_FAILURE;
+  }
+  RenameMode Renames;
+  if (!parseRenameMode(RenamesName, Renames)) {
+    std::cerr << "Error: Unknown rename mode '" << RenamesName << "'.\n";
+    return EXIT_FAILURE;
+  }
+  if (RenameThreshold > 100) {
+    std::cerr << "Error: '--rename-threshold' must be at most 100.\n";
+    return EXIT_FAILURE;
+  }
+  if (DeadlineMs && Command != "merge" && Command != "rebase" &&
+      Command != "patch") {
+    std::cerr << "Error: '--deadline' is only supported by 'merge', "
+                 "'rebase' and 'patch'.\n";
+    return EXIT_FAILURE;
+  }
+  std::unique_ptr<Deadline> Limit;
+  if (DeadlineMs) {
+    Limit.reset(new Deadline(std::chrono::milliseconds(DeadlineMs)));
+  }
+  bool TreeOnly = Vm.count("tree-only") > 0;
+  bool Confirm = Vm.count("confirm") > 0;
+  if (TreeOnly && Command != "merge" && Command != "batch") {
+    std::cerr << "Error: '--tree-only' is only supported by 'merge' and "
+                 "'batch'.\n";
+    return EXIT_FAILURE;
+  }
+  if (Confirm && !TreeOnly) {
+    std::cerr << "Error: '--confirm' requires '--tree-only'.\n";
+    return EXIT_FAILURE;
+  }
+  bool ConflictHunks = Vm.count("conflict-hunks") > 0;
+  if (ConflictHunks && Command != "merge" && Command != "batch" &&
+      Command != "patch") {
+    std::cerr << "Error: '--conflict-hunks' is only supported by 'merge', "
+                 "'batch' and 'patch'.\n";
+    return EXIT_FAILURE;
+  }
+  if (ConflictHunks) {
+    PrintConflicts = true;
+  }
+  if (Format != OutputFormat::Human) {
+    // stdout only carries records
+    Verbose = false;
+    PrintConflicts = false;
+  }
+
   bool HasRemoteUrlParam = Vm.count("remote-url") > 0;
   bool HasRemoteNameParam = Vm.count("remote-name") > 0;
   if (HasRemoteUrlParam && HasRemoteNameParam) {
@@ -148,6 +497,72 @@ int main(int argc, char *argv[]) {
     }
     Trim(MergeOurBranch);
     Trim(MergeTheirBranch);
+  } else if (Command == "batch") {
+    try {
+      po::store(po::command_line_parser(Opts).options(BatchDesc).run(), Vm);
+      po::notify(Vm);
+    } catch (const std::exception &Ex) {
+      std::cerr << "\n" << Ex.what() << "\n\n";
+      return EXIT_FAILURE;
+    }
+    Trim(BatchInput);
+  } else if (Command == "matrix" || Command == "status" ||
+             Command == "train") {
+    const po::options_description &Desc =
+        Command == "matrix" ? MatrixDesc
+                            : Command == "status" ? StatusDesc : TrainDesc;
+    try {
+      po::store(po::command_line_parser(Opts).options(Desc).run(), Vm);
+      po::notify(Vm);
+    } catch (const std::exception &Ex) {
+      std::cerr << "\n" << Ex.what() << "\n\n";
+      return EXIT_FAILURE;
+    }
+    Trim(TargetBranch);
+    Trim(BatchInput);
+  } else if (Command == "blame-conflict") {
+    try {
+      po::store(po::command_line_parser(Opts).options(BlameDesc).run(), Vm);
+      po::notify(Vm);
+    } catch (const std::exception &Ex) {
+      std::cerr << "\n" << Ex.what() << "\n\n";
+      return EXIT_FAILURE;
+    }
+    Trim(MergeOurBranch);
+    Trim(MergeTheirBranch);
+  } else if (Command == "path-index") {
+    try {
+      po::store(po::command_line_parser(Opts).options(PathIndexDesc).run(),
+                Vm);
+      po::notify(Vm);
+    } catch (const std::exception &Ex) {
+      std::cerr << "\n" << Ex.what() << "\n\n";
+      return EXIT_FAILURE;
+    }
+  } else if (Command == "patch") {
+    try {
+      po::store(po::command_line_parser(Opts).options(PatchDesc).run(), Vm);
+      po::notify(Vm);
+    } catch (const std::exception &Ex) {
+      std::cerr << "\n" << Ex.what() << "\n\n";
+      return EXIT_FAILURE;
+    }
+    Trim(TargetBranch);
+    Trim(PatchBase);
+    Trim(BatchInput);
+  } else if (Command == "serve" || Command == "stats") {
+    try {
+      po::store(po::command_line_parser(Opts).options(ServeDesc).run(), Vm);
+      po::notify(Vm);
+    } catch (const std::exception &Ex) {
+      std::cerr << "\n" << Ex.what() << "\n\n";
+      return EXIT_FAILURE;
+    }
+    if (SocketPath.empty()) {
+      std::cerr << "Error: Option \"socket\" is required for \"" << Command
+                << "\".\n";
+      return EXIT_FAILURE;
+    }
   } else {
     std::cerr << "Error! No legal command was specified! Use \"--help\" for "
                  "details.\n";
@@ -156,45 +571,267 @@ int main(int argc, char *argv[]) {
 
   // done with command line parsing
 
+  CheckOptions CheckOpts;
+  CheckOpts.PrintConflicts = PrintConflicts;
+  CheckOpts.Verbose = Verbose;
+  CheckOpts.Prefilter = Vm.count("no-prefilter") == 0;
+  CheckOpts.Cumulative = Vm.count("cumulative") > 0;
+  CheckOpts.SquashFirst = Vm.count("per-commit") == 0;
+  CheckOpts.RebaseJobs = RebaseJobs;
+  CheckOpts.MergeJobs = MergeJobs;
+  CheckOpts.FirstConflict = Vm.count("first-conflict") > 0;
+  CheckOpts.ConflictHunks = ConflictHunks;
+  CheckOpts.HunkMaxBytes = HunkMaxBytes;
+  // batch already checks the pairs in parallel
+  CheckOpts.HunkJobs = Command == "batch" ? 1 : 0;
+  CheckOpts.Renames = Renames;
+  CheckOpts.RenameThreshold = RenameThreshold;
+  CheckOpts.RenameLimit = RenameLimit;
+  std::vector<std::string> LiteralPaths;
+  for (const auto &Arg : ScopePaths) {
+    std::string Path;
+    if (!literalScopePath(Arg, Path)) {
+      std::cerr << "Error: \'--path\' takes literal paths, not globs: \'"
+                << Arg << "\'. Prefix it with \':(literal)\' if the "
+                << "characters are part of the name.\n";
+      return EXIT_FAILURE;
+    }
+    LiteralPaths.push_back(Path);
+  }
+  CheckOpts.Paths = normalizeScope(LiteralPaths);
+  CheckOpts.TreeOnly = TreeOnly;
+  CheckOpts.Confirm = Confirm;
+  CheckOpts.TimeLimit = Limit.get();
+  if (CheckOpts.Cumulative && RebaseJobs != 1) {
+    std::cerr << "Error: \'--jobs\' cannot be combined with "
+                 "\'--cumulative\'.\n";
+    return EXIT_FAILURE;
+  }
+
+  // forward the check to a running daemon, if there is one; adding a remote
+  // modifies the repository and alternates are only attached to our own
+  // handle, so those checks are always done locally, as are traced ones and
+  // those with machine-readable output, hunks, custom rename detection,
+  // paths, tree-only, sharded, parallel rebase and time-limited checks
+  bool DefaultRenames =
+      Renames == RenameMode::Full && !RenameThreshold && !RenameLimit;
+  Trim(SocketPath);
+  if (!SocketPath.empty() && !AddRemote && AlternateRepos.empty() &&
+      !tracing() && Format == OutputFormat::Human && !ConflictHunks &&
+      DefaultRenames && CheckOpts.Paths.empty() && !TreeOnly &&
+      MergeJobs == 1 && RebaseJobs == 1 && !Limit && Command != "serve") {
+    std::string Request;
+    bool UsePathFilters = Vm.count("no-path-filters") == 0;
+    if (Command == "merge") {
+      Request =
+          mergeRequest(absolutePath(RepoPath), MergeOurBranch, MergeTheirBranch,
+                       CheckOpts, UseResultCache, UsePathFilters);
+    } else if (Command == "rebase") {
+      Request = rebaseRequest(absolutePath(RepoPath), RebaseUpstreamBranch,
+                              RebaseBranch, RebaseOntoCommit, CheckOpts,
+                              UsePathFilters);
+    } else if (Command == "stats") {
+      Request = "stats";
+    }
+
+    if (!Request.empty()) {
+      size_t Conflicts = 0;
+      switch (forwardRequest(SocketPath, Request, std::cout, Conflicts)) {
+      case ForwardStatus::Ok:
+        return Command == "stats" ? EXIT_SUCCESS : reportConflicts(Conflicts);
+      case ForwardStatus::Failed:
+        return EXIT_FAILURE;
+      case ForwardStatus::NoServer:
+        if (Command == "stats") {
+          std::cerr << "Error: No daemon is listening on \'" << SocketPath
+                    << "\'.\n";
+          return EXIT_FAILURE;
+        }
+        if (Verbose) {
+          std::cout << "No daemon running, checking locally..." << std::endl;
+        }
+        break;
+      }
+    }
+  }
+
   int error;
   git_repository *Repo = nullptr;
   git_libgit2_init();
 
-  if (Verbose) {
-    std::cout << "Opening repository..." << std::endl;
+  if (Command == "serve") {
+    int ExitCode = EXIT_FAILURE;
+    try {
+      ExitCode = serve(absolutePath(RepoPath), SocketPath, ServeJobs, Verbose);
+    } catch (const GitError &Ex) {
+      std::cerr << Ex.what() << "\n";
+    }
+    git_libgit2_shutdown();
+    return ExitCode;
   }
-  error = git_repository_open(&Repo, RepoPath.c_str());
-  checkError(error, "opening repository");
 
-  if (AddRemote) {
-    addRemote(Repo, RemoteUrl, RemoteName, Verbose);
+  // read the branch lists first; they determine what a remote fetch needs
+  std::vector<BranchPair> Pairs;
+  std::vector<std::string> Branches;
+  std::string PatchText;
+  if (Command == "batch" || Command == "matrix" || Command == "status" ||
+      Command == "train" || Command == "patch") {
+    std::ifstream InputFile;
+    if (BatchInput != "-") {
+      InputFile.open(BatchInput);
+      if (!InputFile) {
+        std::cerr << "Error: Could not open \'" << BatchInput << "\'.\n";
+        git_libgit2_shutdown();
+        return EXIT_FAILURE;
+      }
+    }
+    std::istream &In = BatchInput == "-" ? std::cin : InputFile;
+    if (Command == "batch") {
+      Pairs = readBranchPairs(In);
+    } else if (Command == "patch") {
+      std::ostringstream Text;
+      Text << In.rdbuf();
+      PatchText = Text.str();
+    } else {
+      Branches = readBranches(In);
+    }
   }
 
-  size_t Conflicts = 0;
-  if (Command == "merge") {
-    Conflicts =
-        merge(Repo, MergeOurBranch, MergeTheirBranch, PrintConflicts, Verbose);
+  std::vector<std::string> RequestedRefs;
+  if (Command == "merge" || Command == "blame-conflict") {
+    RequestedRefs = {MergeOurBranch, MergeTheirBranch};
   } else if (Command == "rebase") {
-    if (Vm.count("onto") == 1) {
-      Conflicts = rebase(Repo, RebaseUpstreamBranch, RebaseBranch,
-                         RebaseOntoCommit, PrintConflicts, Verbose);
-    } else {
+    RequestedRefs = {RebaseUpstreamBranch, RebaseBranch, RebaseOntoCommit};
+  } else if (Command == "patch") {
+    RequestedRefs = {TargetBranch, PatchBase};
+  } else if (Command == "batch") {
+    for (const auto &Pair : Pairs) {
+      RequestedRefs.push_back(Pair.first);
+      RequestedRefs.push_back(Pair.second);
+    }
+  } else if (Command != "path-index") {
+    RequestedRefs = Branches;
+    RequestedRefs.push_back(TargetBranch);
+  }
+
+  size_t Conflicts = 0;
+  // with a deadline, the conflicts found before it passed
+  std::vector<Conflict> Found;
+  std::vector<Conflict> *Partial = Limit ? &Found : nullptr;
+  std::unique_ptr<ResultCache> Cache;
+  std::unique_ptr<PathIndex> Filters;
+  std::unique_ptr<RecordWriter> Records;
+  if (Format != OutputFormat::Human) {
+    Records.reset(new RecordWriter(std::cout, Format));
+    CheckOpts.Records = Records.get();
+  }
+  std::ostream &TimingsOut = Records ? std::cerr : std::cout;
+  try {
+    if (Verbose) {
+      std::cout << "Opening repository..." << std::endl;
+    }
+    error = git_repository_open(&Repo, RepoPath.c_str());
+    checkError(error, "opening repository");
+
+    if (AddRemote) {
+      addRemote(Repo, RemoteUrl, RemoteName, RequestedRefs, Verbose);
+    }
+
+    for (auto Spec : AlternateRepos) {
+      std::string AltName, AltPath;
+      parseAlternateSpec(Trim(Spec), AltName, AltPath);
+      addAlternate(Repo, AltPath, AltName, Verbose);
+    }
+
+    if (UseResultCache) {
+      Cache.reset(
+          new ResultCache(git_repository_path(Repo), ResultCacheSize << 20));
+      CheckOpts.Cache = Cache.get();
+    }
+
+    if (Command != "path-index" && Vm.count("no-path-filters") == 0) {
+      Filters.reset(new PathIndex(git_repository_path(Repo)));
+      if (!Filters->empty()) {
+        CheckOpts.PathFilters = Filters.get();
+      }
+    }
+
+    if (Command == "path-index") {
+      size_t Added =
+          updatePathIndex(Repo, RepoPath, BatchJobs, Verbose, std::cout);
+      std::cout << "Indexed " << Added << " new commits." << std::endl;
+    } else if (Command == "batch") {
+      Conflicts = batch(Repo, RepoPath, Pairs, BatchJobs, CheckOpts);
+    } else if (Command == "matrix") {
+      Conflicts =
+          matrix(Repo, RepoPath, TargetBranch, Branches, BatchJobs, CheckOpts);
+    } else if (Command == "status") {
+      Conflicts = status(Repo, TargetBranch, Branches, CheckOpts);
+    } else if (Command == "train") {
+      Conflicts =
+          train(Repo, RepoPath, TargetBranch, Branches, BatchJobs, CheckOpts);
+    } else if (Command == "blame-conflict") {
+      Conflicts = blameConflicts(Repo, RepoPath, MergeOurBranch,
+                                 MergeTheirBranch, BatchJobs, CheckOpts);
+    } else if (Command == "merge") {
+      Conflicts = merge(Repo, MergeOurBranch, MergeTheirBranch, CheckOpts,
+                        std::cout, Partial);
+    } else if (Command == "rebase") {
       Conflicts = rebase(Repo, RebaseUpstreamBranch, RebaseBranch,
-                         PrintConflicts, Verbose);
+                         RebaseOntoCommit, CheckOpts, std::cout, Partial);
+    } else if (Command == "patch") {
+      Conflicts = checkPatch(Repo, TargetBranch, PatchBase, PatchText,
+                             CheckOpts, std::cout, Partial);
     }
+  } catch (const DeadlineExceeded &Ex) {
+    std::ostream &Out = Records ? std::cerr : std::cout;
+    Out << "Deadline of " << DeadlineMs << " ms exceeded during "
+        << Ex.Phase;
+    if (Command == "rebase") {
+      Out << " after " << Ex.Steps << " completed steps";
+    }
+    Out << "; found " << Found.size() << " conflicts so far." << std::endl;
+    if (Records) {
+      Records->timeout(Command.c_str(), RequestedRefs[0], RequestedRefs[1],
+                       Ex.Phase, Ex.Steps, Found.size());
+      Records->summary();
+      Records->flush();
+    }
+    reportTrace(Timings, TracePath, TimingsOut);
+    releaseAlternates();
+    git_repository_free(Repo);
+    git_libgit2_shutdown();
+    return ExitDeadlineExceeded;
+  } catch (const GitError &Ex) {
+    std::cerr << Ex.what() << "\n";
+    if (Records) {
+      // batch reports the errors of single pairs itself
+      bool Single = Command != "batch";
+      Records->error(Single ? RequestedRefs[0] : "",
+                     Single ? RequestedRefs[1] : "", Ex.what());
+      Records->summary();
+      Records->flush();
+    }
+    reportTrace(Timings, TracePath, TimingsOut);
+    releaseAlternates();
+    git_repository_free(Repo);
+    git_libgit2_shutdown();
+    return EXIT_FAILURE;
   }
 
+  if (Records) {
+    Records->summary();
+    Records->flush();
+  }
+  reportTrace(Timings, TracePath, TimingsOut);
+
   // clean up...
+  releaseAlternates();
   git_repository_free(Repo);
   git_libgit2_shutdown();
 
-  if (Conflicts > 0) {
-    std::cout << "Found " << Conflicts << " conflicts in total." << std::endl;
+  if (Records || Command == "path-index") {
     return EXIT_SUCCESS;
   }
-
-  std::cout << "Good news, everyone! Branches can be merged automatically "
-               "without conflicts."
-            << std::endl;
-  return EXIT_SUCCESS;
+  return reportConflicts(Conflicts);
 }
@@ -0,0 +1,156 @@
+#include <cstring>
+
+#include "mergecheck/deadline.hpp"
+#include "mergecheck/handles.hpp"
+#include "mergecheck/inmemory_repo.hpp"
+#include "mergecheck/merge.hpp"
+#include "mergecheck/patch.hpp"
+#include "mergecheck/record_writer.hpp"
+#include "mergecheck/refs.hpp"
+#include "mergecheck/renames.hpp"
+#include "mergecheck/scope.hpp"
+#include "mergecheck/trace.hpp"
+#include "mergecheck/utils.hpp"
+
+namespace {
+/// Name of the merged side in printed conflicts and records.
+const char *const PatchName = "patch";
+
+TreePtr commitTree(git_repository *Repo, const git_oid &Id) {
+  git_commit *Raw;
+  int error = git_commit_lookup(&Raw, Repo, &Id);
+  checkError(error, "git_commit_lookup");
+  CommitPtr Commit(Raw);
+  git_tree *Tree;
+  error = git_commit_tree(&Tree, Commit.get());
+  checkError(error, "git_commit_tree");
+  return TreePtr(Tree);
+}
+
+/**
+ * The old and new paths of all files in \p Diff.
+ */
+std::vector<std::string> patchedPaths(const git_diff *Diff) {
+  std::vector<std::string> Paths;
+  for (size_t I = 0; I < git_diff_num_deltas(Diff); ++I) {
+    const git_diff_delta *Delta = git_diff_get_delta(Diff, I);
+    for (const char *Path : {Delta->old_file.path, Delta->new_file.path}) {
+      if (Path && std::strcmp(Path, "/dev/null") != 0) {
+        Paths.push_back(Path);
+      }
+    }
+  }
+  return Paths;
+}
+} // namespace
+
+size_t checkPatch(git_repository *Repo, const std::string &Target,
+                  const std::string &Base, const std::string &Patch,
+                  const CheckOptions &Opts, std::ostream &O,
+                  std::vector<Conflict> *Conflicting) {
+  int error;
+  TraceScope Trace("patch");
+
+  // applying the patch writes blobs, so everything goes to memory
+  InMemoryRepository Scratch(Repo);
+  std::string TargetName;
+  AnnotatedCommitPtr TargetHead(
+      lookupAnnotatedCommit(Scratch.get(), Target, &TargetName));
+  AnnotatedCommitPtr BaseHead(lookupAnnotatedCommit(Scratch.get(), Base));
+
+  git_diff *RawDiff;
+  error = git_diff_from_buffer(&RawDiff, Patch.data(), Patch.size());
+  checkError(error, "parsing patch");
+  DiffPtr Diff(RawDiff);
+  std::vector<std::string> Scope = Opts.Paths;
+  if (Scope.empty()) {
+    Scope = normalizeScope(patchedPaths(Diff.get()));
+  }
+  if (Opts.Verbose) {
+    O << "Patch changes " << git_diff_num_deltas(Diff.get()) << " files."
+      << std::endl;
+  }
+
+  std::vector<Conflict> Records;
+  if (git_diff_num_deltas(Diff.get()) > 0) {
+    TreePtr BaseTree(
+        commitTree(Scratch.get(), *git_annotated_commit_id(BaseHead.get())));
+    TreePtr TargetTree(
+        commitTree(Scratch.get(), *git_annotated_commit_id(TargetHead.get())));
+
+    git_oid PatchedId;
+    {
+      TraceScope ApplyTrace("apply patch");
+      git_apply_options ApplyOpts{};
+      ApplyOpts.version = GIT_APPLY_OPTIONS_VERSION;
+      git_index *RawIndex;
+      error = git_apply_to_tree(&RawIndex, Scratch.get(), BaseTree.get(),
+                                Diff.get(), &ApplyOpts);
+      checkError(error, "applying patch to " + Base);
+      IndexPtr Index(RawIndex);
+      error = git_index_write_tree_to(&PatchedId, Index.get(), Scratch.get());
+      checkError(error, "git_index_write_tree_to");
+    }
+    TreePtr PatchedTree;
+    {
+      git_tree *Raw;
+      error = git_tree_lookup(&Raw, Scratch.get(), &PatchedId);
+      checkError(error, "git_tree_lookup");
+      PatchedTree.reset(Raw);
+    }
+
+    TreePtr AncestorTree;
+    {
+      TraceScope BaseTrace("merge base");
+      git_oidarray Bases{};
+      error = git_merge_bases(&Bases, Scratch.get(),
+                              git_annotated_commit_id(BaseHead.get()),
+                              git_annotated_commit_id(TargetHead.get()));
+      if (error != GIT_ENOTFOUND) {
+        checkError(error, "git_merge_bases");
+        try {
+          AncestorTree = commitTree(Scratch.get(), Bases.ids[0]);
+        } catch (...) {
+          git_oidarray_free(&Bases);
+          throw;
+        }
+        if (Opts.Verbose && Bases.count > 1) {
+          O << "Several merge bases, using the first one." << std::endl;
+        }
+        git_oidarray_free(&Bases);
+      }
+    }
+
+    git_merge_options MergeOpts{};
+    error = git_merge_init_options(&MergeOpts, GIT_MERGE_OPTIONS_VERSION);
+    checkError(error, "git_merge_init_options");
+    setRenameOptions(MergeOpts, Opts.Renames, Opts);
+    {
+      TraceScope MergeTrace("scoped merge");
+      runTimed(Opts.TimeLimit, "merge", [&] {
+        mergeTreesInScope(Scratch.get(), AncestorTree.get(), TargetTree.get(),
+                          PatchedTree.get(), Scope, MergeOpts, Records);
+      });
+    }
+    if (Opts.Verbose) {
+      O << "Finished merging.\n";
+    }
+  }
+
+  // the conflicting blobs of the patch only exist in memory
+  size_t Conflicts = Records.size();
+  bool Complete = reportConflicts(Scratch.get(), Records, Opts, Target,
+                                  PatchName, TargetName, PatchName, O);
+  if (Conflicting) {
+    *Conflicting = std::move(Records);
+  }
+  if (!Complete) {
+    throw DeadlineExceeded("conflict hunks");
+  }
+  if (Opts.Records) {
+    Opts.Records->result("patch", Target, PatchName, Conflicts);
+  }
+
+  traceCounters();
+  return Conflicts;
+}
@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <set>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mergecheck/changed_paths.hpp"
+#include "mergecheck/handles.hpp"
+#include "mergecheck/path_index.hpp"
+#include "mergecheck/thread_pool.hpp"
+#include "mergecheck/utils.hpp"
+#include "mergecheck/worker_repos.hpp"
+
+namespace {
+const uint32_t IndexMagic = 0x4650434d; // "MCPF"
+const uint32_t IndexVersion = 1;
+
+/// Size of a commit whose filter would have too many entries to be useful.
+const uint32_t SaturatedSize = UINT32_MAX;
+const size_t MaxEntries = 512;
+const size_t BitsPerEntry = 10;
+const unsigned HashCount = 7;
+
+struct FileHeader {
+  uint32_t Magic;
+  uint32_t Version;
+  uint32_t Count;
+  uint32_t Reserved;
+};
+
+/// One commit in the sorted table; Offset is relative to the data area.
+struct TableEntry {
+  git_oid Id;
+  uint32_t Offset;
+  uint32_t Size;
+};
+
+struct Filter {
+  git_oid Id;
+  std::string Bits;
+  bool Saturated = false;
+};
+
+uint64_t fnv1a(const std::string &S, uint64_t Hash) {
+  for (char C : S) {
+    Hash ^= static_cast<unsigned char>(C);
+    Hash *= 1099511628211ull;
+  }
+  return Hash;
+}
+
+PathIndex::Key key(const std::string &Entry) {
+  // two independent hashes for double hashing; the step must be odd
+  return PathIndex::Key{fnv1a(Entry, 14695981039346656037ull),
+                        fnv1a(Entry, 0x9e3779b97f4a7c15ull) | 1};
+}
+
+std::string indexDir(const std::string &GitDir) {
+  std::string Dir = GitDir;
+  if (!Dir.empty() && Dir.back() != '/') {
+    Dir += '/';
+  }
+  return Dir + "mergecheck";
+}
+
+/**
+ * Compute the filter of commit \p F.Id: every changed path as it is, and its
+ * parent directories with a trailing slash.
+ */
+void buildFilter(git_repository *Repo, Filter &F) {
+  int error;
+
+  git_commit *Raw;
+  error = git_commit_lookup(&Raw, Repo, &F.Id);
+  checkError(error, "git_commit_lookup");
+  CommitPtr Commit(Raw);
+  git_tree *RawTree;
+  error = git_commit_tree(&RawTree, Commit.get());
+  checkError(error, "git_commit_tree");
+  TreePtr Tree(RawTree);
+  TreePtr ParentTree;
+  if (git_commit_parentcount(Commit.get()) > 0) {
+    error = git_commit_parent(&Raw, Commit.get(), 0);
+    checkError(error, "git_commit_parent");
+    CommitPtr Parent(Raw);
+    error = git_commit_tree(&RawTree, Parent.get());
+    checkError(error, "git_commit_tree");
+    ParentTree.reset(RawTree);
+  }
+
+  std::vector<std::string> Paths;
+  changedPaths(Repo, ParentTree.get(), Tree.get(), Paths, true);
+  std::set<std::string> Entries;
+  for (const auto &Path : Paths) {
+    Entries.insert(Path);
+    for (auto Pos = Path.find('/'); Pos != std::string::npos;
+         Pos = Path.find('/', Pos + 1)) {
+      Entries.insert(Path.substr(0, Pos + 1));
+    }
+    if (Entries.size() > MaxEntries) {
+      F.Saturated = true;
+      return;
+    }
+  }
+  if (Entries.empty()) {
+    return;
+  }
+
+  size_t Bits = (Entries.size() * BitsPerEntry + 63) / 64 * 64;
+  F.Bits.assign(Bits / 8, '\0');
+  for (const auto &Entry : Entries) {
+    PathIndex::Key K = key(Entry);
+    for (unsigned I = 0; I < HashCount; ++I) {
+      size_t Bit = (K.H1 + I * K.H2) % Bits;
+      F.Bits[Bit / 8] |= static_cast<char>(1 << (Bit % 8));
+    }
+  }
+}
+
+bool testKey(const unsigned char *Bits, size_t Bytes,
+             const PathIndex::Key &K) {
+  size_t Count = Bytes * 8;
+  for (unsigned I = 0; I < HashCount; ++I) {
+    size_t Bit = (K.H1 + I * K.H2) % Count;
+    if (!(Bits[Bit / 8] & (1 << (Bit % 8)))) {
+      return false;
+    }
+  }
+  return true;
+}
+} // namespace
+
+PathIndex::PathIndex(const std::string &GitDir) {
+  std::string Path = indexDir(GitDir) + "/path-filters";
+  int Fd = ::open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (Fd < 0) {
+    return;
+  }
+  struct stat St {};
+  if (::fstat(Fd, &St) < 0 ||
+      static_cast<size_t>(St.st_size) < sizeof(FileHeader)) {
+    ::close(Fd);
+    return;
+  }
+  MapSize = static_cast<size_t>(St.st_size);
+  Map = ::mmap(nullptr, MapSize, PROT_READ, MAP_SHARED, Fd, 0);
+  ::close(Fd);
+  if (Map == MAP_FAILED) {
+    Map = nullptr;
+    return;
+  }
+
+  FileHeader Header;
+  std::memcpy(&Header, Map, sizeof(Header));
+  if (Header.Magic != IndexMagic || Header.Version != IndexVersion ||
+      (MapSize - sizeof(Header)) / sizeof(TableEntry) < Header.Count) {
+    return;
+  }
+  Count = Header.Count;
+}
+
+PathIndex::~PathIndex() {
+  if (Map) {
+    ::munmap(Map, MapSize);
+  }
+}
+
+PathIndex::Query PathIndex::query(const std::string &Path) {
+  Query Q{key(Path), key(Path + "/")};
+  for (auto Pos = Path.find('/'); Pos != std::string::npos;
+       Pos = Path.find('/', Pos + 1)) {
+    Q.push_back(key(Path.substr(0, Pos)));
+  }
+  return Q;
+}
+
+const char *PathIndex::find(const git_oid &Commit) const {
+  const char *Table = static_cast<const char *>(Map) + sizeof(FileHeader);
+  size_t Lo = 0, Hi = Count;
+  while (Lo < Hi) {
+    size_t Mid = Lo + (Hi - Lo) / 2;
+    const char *Entry = Table + Mid * sizeof(TableEntry);
+    int Cmp = std::memcmp(Entry, Commit.id, GIT_OID_RAWSZ);
+    if (Cmp == 0) {
+      return Entry;
+    }
+    if (Cmp < 0) {
+      Lo = Mid + 1;
+    } else {
+      Hi = Mid;
+    }
+  }
+  return nullptr;
+}
+
+bool PathIndex::hasFilter(const git_oid &Commit) const {
+  return find(Commit) != nullptr;
+}
+
+bool PathIndex::mayOverlap(const git_oid &Commit, const Query &Q) const {
+  const char *Found = find(Commit);
+  if (!Found) {
+    return true;
+  }
+  TableEntry Entry;
+  std::memcpy(&Entry, Found, sizeof(Entry));
+  if (Entry.Size == 0) {
+    return false;
+  }
+  size_t DataStart = sizeof(FileHeader) + Count * sizeof(TableEntry);
+  if (Entry.Size == SaturatedSize ||
+      MapSize - DataStart < static_cast<size_t>(Entry.Offset) + Entry.Size) {
+    return true;
+  }
+
+  const auto *Bits =
+      static_cast<const unsigned char *>(Map) + DataStart + Entry.Offset;
+  for (const auto &K : Q) {
+    if (testKey(Bits, Entry.Size, K)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t updatePathIndex(git_repository *Repo, const std::string &RepoPath,
+                       unsigned Jobs, bool Verbose, std::ostream &O) {
+  int error;
+
+  std::string Dir = indexDir(git_repository_path(Repo));
+  ::mkdir(Dir.c_str(), 0755);
+  FileLock WriteLock(Dir + "/path-filters.lock");
+  if (!WriteLock.locked()) {
+    throw GitError(GIT_ERROR, "Error locking the path index in " + Dir);
+  }
+  PathIndex Old(git_repository_path(Repo));
+
+  git_revwalk *RawWalk;
+  error = git_revwalk_new(&RawWalk, Repo);
+  checkError(error, "git_revwalk_new");
+  RevwalkPtr Walk(RawWalk);
+  error = git_revwalk_push_glob(Walk.get(), "*");
+  checkError(error, "git_revwalk_push_glob");
+  error = git_revwalk_push_head(Walk.get());
+  if (error != GIT_ENOTFOUND && error != GIT_EUNBORNBRANCH) {
+    checkError(error, "git_revwalk_push_head");
+  }
+
+  std::vector<Filter> Added;
+  git_oid Id;
+  while (git_revwalk_next(&Id, Walk.get()) == 0) {
+    if (!Old.hasFilter(Id)) {
+      Added.emplace_back();
+      git_oid_cpy(&Added.back().Id, &Id);
+    }
+  }
+  if (Added.empty()) {
+    if (Verbose) {
+      O << "Path index is up to date (" << Old.size() << " commits)."
+        << std::endl;
+    }
+    return 0;
+  }
+
+  ThreadPool Pool(Jobs);
+  WorkerRepositories WorkerRepos(Repo, RepoPath, Pool.size());
+  if (Verbose) {
+    O << "Indexing " << Added.size() << " commits on " << Pool.size()
+      << " workers..." << std::endl;
+  }
+  std::atomic<size_t> Next(0);
+  for (unsigned W = 0; W < Pool.size(); ++W) {
+    Pool.submit([&](unsigned Worker) {
+      for (size_t I = Next++; I < Added.size(); I = Next++) {
+        buildFilter(WorkerRepos[Worker], Added[I]);
+      }
+    });
+  }
+  Pool.wait();
+
+  // the existing filters are copied as they are
+  std::vector<Filter> All(Old.size());
+  const char *Base = static_cast<const char *>(Old.Map);
+  size_t OldData = sizeof(FileHeader) + Old.size() * sizeof(TableEntry);
+  for (size_t I = 0; I < Old.size(); ++I) {
+    TableEntry Entry;
+    std::memcpy(&Entry, Base + sizeof(FileHeader) + I * sizeof(TableEntry),
+                sizeof(Entry));
+    git_oid_cpy(&All[I].Id, &Entry.Id);
+    All[I].Saturated =
+        Entry.Size == SaturatedSize ||
+        Old.MapSize - OldData < static_cast<size_t>(Entry.Offset) + Entry.Size;
+    if (!All[I].Saturated) {
+      All[I].Bits.assign(Base + OldData + Entry.Offset, Entry.Size);
+    }
+  }
+  All.insert(All.end(), std::make_move_iterator(Added.begin()),
+             std::make_move_iterator(Added.end()));
+  std::sort(All.begin(), All.end(), [](const Filter &A, const Filter &B) {
+    return git_oid_cmp(&A.Id, &B.Id) < 0;
+  });
+
+  FileHeader Header{IndexMagic, IndexVersion,
+                    static_cast<uint32_t>(All.size()), 0};
+  std::string Table, Data;
+  Table.append(reinterpret_cast<const char *>(&Header), sizeof(Header));
+  for (const auto &F : All) {
+    if (Data.size() > UINT32_MAX - F.Bits.size()) {
+      throw GitError(GIT_ERROR, "Error writing the path index - too large");
+    }
+    TableEntry Entry{F.Id, static_cast<uint32_t>(Data.size()),
+                     F.Saturated ? SaturatedSize
+                                 : static_cast<uint32_t>(F.Bits.size())};
+    Table.append(reinterpret_cast<const char *>(&Entry), sizeof(Entry));
+    Data += F.Bits;
+  }
+
+  std::string Path = Dir + "/path-filters", TempPath = Path + ".tmp";
+  int Fd = ::open(TempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  bool Written = Fd >= 0 && writeAll(Fd, Table) && writeAll(Fd, Data);
+  if (Fd >= 0) {
+    ::close(Fd);
+  }
+  if (!Written || ::rename(TempPath.c_str(), Path.c_str()) < 0) {
+    ::unlink(TempPath.c_str());
+    throw GitError(GIT_ERROR, "Error writing the path index " + Path);
+  }
+
+  if (Verbose) {
+    O << "Path index has " << All.size() << " commits (" << Added.size()
+      << " new, " << Table.size() + Data.size() << " bytes)." << std::endl;
+  }
+  return Added.size();
+}
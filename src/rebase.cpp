@@ -1,141 +1,781 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <set>
 #include <sstream>
+#include <vector>
 
+#include "mergecheck/changed_paths.hpp"
 #include "mergecheck/conflict.hpp"
+#include "mergecheck/deadline.hpp"
+#include "mergecheck/handles.hpp"
+#include "mergecheck/inmemory_repo.hpp"
+#include "mergecheck/path_index.hpp"
 #include "mergecheck/rebase.hpp"
+#include "mergecheck/record_writer.hpp"
+#include "mergecheck/refs.hpp"
+#include "mergecheck/renames.hpp"
+#include "mergecheck/scope.hpp"
+#include "mergecheck/thread_pool.hpp"
+#include "mergecheck/trace.hpp"
 #include "mergecheck/utils.hpp"
+#include "mergecheck/worker_repos.hpp"
 
 namespace {
-size_t rebaseHelper(git_repository *Repo, const char *UpstreamBranch,
-                    const char *Branch, const char *Onto, bool PrintConflicts,
-                    bool Verbose) {
+/**
+ * Resolve all conflicts in \p Index by taking the version of the commit being
+ * replayed (or dropping the path if that commit deleted it).
+ */
+void resolveWithTheirs(git_index *Index) {
   int error;
 
-  git_reference *UpstreamRef, *BranchRef, *OntoRef;
-  git_annotated_commit *UpstreamCommit, *BranchCommit, *OntoCommit;
+  std::vector<std::string> Paths;
+  std::vector<git_index_entry> Theirs;
+  std::vector<bool> HasTheirs;
 
-  // get "UpstreamBranch" commit
-  error = git_reference_lookup(&UpstreamRef, Repo, UpstreamBranch);
-  if (!error) {
-    error = git_annotated_commit_from_ref(&UpstreamCommit, Repo, UpstreamRef);
-    checkError(error, "git_annotated_commit");
-  } else {
-    // try to parse as commit id
-    git_oid Oid{};
-    error = git_oid_fromstrp(&Oid, UpstreamBranch);
-    checkError(error, "git_oid_fromstrp");
-    error = git_annotated_commit_lookup(&UpstreamCommit, Repo, &Oid);
-    checkError(error, "git_annotated_commit");
-  }
-
-  // get "Branch" commit
-  error = git_reference_lookup(&BranchRef, Repo, Branch);
+  git_index_conflict_iterator *ConflictIt;
+  error = git_index_conflict_iterator_new(&ConflictIt, Index);
+  checkError(error, "git_index_conflict_iterator_new");
+  IndexConflict C{};
+  while ((error = git_index_conflict_next(&C.Ancestor, &C.Our, &C.Their,
+                                          ConflictIt)) == 0) {
+    Paths.push_back(conflictPath(C));
+    HasTheirs.push_back(C.Their != nullptr);
+    Theirs.push_back(C.Their ? *C.Their : git_index_entry{});
+  }
+  git_index_conflict_iterator_free(ConflictIt);
+  if (error != GIT_ITEROVER) {
+    checkError(error, "git_index_conflict_next");
+  }
+
+  for (size_t I = 0; I < Paths.size(); ++I) {
+    error = git_index_conflict_remove(Index, Paths[I].c_str());
+    checkError(error, "git_index_conflict_remove");
+    if (HasTheirs[I]) {
+      git_index_entry Entry = Theirs[I];
+      Entry.path = Paths[I].c_str();
+      Entry.flags &= ~GIT_IDXENTRY_STAGEMASK;
+      error = git_index_add(Index, &Entry);
+      checkError(error, "git_index_add");
+    }
+  }
+}
+
+/**
+ * Whether some path touched by a commit in (\p Base, \p Tip] is unchanged
+ * between \p BaseTree and \p TipTree, i.e. was modified and reverted again.
+ */
+bool hasRevertedPaths(git_repository *Repo, const git_oid &Base,
+                      const git_oid &Tip, const git_tree *BaseTree,
+                      const git_tree *TipTree) {
+  int error;
+
+  std::vector<std::string> Net;
+  changedPaths(Repo, BaseTree, TipTree, Net, true);
+  std::set<std::string> NetPaths(Net.begin(), Net.end());
+
+  git_revwalk *RawWalk;
+  error = git_revwalk_new(&RawWalk, Repo);
+  checkError(error, "git_revwalk_new");
+  RevwalkPtr Walk(RawWalk);
+  error = git_revwalk_push(Walk.get(), &Tip);
   if (!error) {
-    error = git_annotated_commit_from_ref(&BranchCommit, Repo, BranchRef);
-    checkError(error, "git_annotated_commit");
-  } else {
-    // try to parse as commit id
-    git_oid Oid{};
-    error = git_oid_fromstrp(&Oid, Branch);
-    checkError(error, "git_oid_fromstrp");
-    error = git_annotated_commit_lookup(&BranchCommit, Repo, &Oid);
-    checkError(error, "git_annotated_commit");
-  }
-
-  // get "Onto" commit
-  if (Onto) {
-    error = git_reference_lookup(&OntoRef, Repo, Onto);
+    error = git_revwalk_hide(Walk.get(), &Base);
+  }
+  checkError(error, "setting up revwalk");
+
+  bool Reverted = false;
+  git_oid Id;
+  while (!Reverted && git_revwalk_next(&Id, Walk.get()) == 0) {
+    git_commit *RawCommit;
+    error = git_commit_lookup(&RawCommit, Repo, &Id);
+    checkError(error, "looking up replayed commit");
+    CommitPtr Commit(RawCommit);
+
+    git_tree *RawTree;
+    error = git_commit_tree(&RawTree, Commit.get());
+    checkError(error, "looking up replayed commit");
+    TreePtr Tree(RawTree);
+
+    TreePtr ParentTree;
+    if (git_commit_parentcount(Commit.get()) > 0) {
+      git_commit *RawParent;
+      error = git_commit_parent(&RawParent, Commit.get(), 0);
+      checkError(error, "looking up replayed commit");
+      CommitPtr Parent(RawParent);
+
+      git_tree *RawParentTree;
+      error = git_commit_tree(&RawParentTree, Parent.get());
+      checkError(error, "looking up replayed commit");
+      ParentTree.reset(RawParentTree);
+    }
+
+    std::vector<std::string> Touched;
+    changedPaths(Repo, ParentTree.get(), Tree.get(), Touched, true);
+    for (const auto &Path : Touched) {
+      Reverted |= NetPaths.count(Path) == 0;
+    }
+  }
+  return Reverted;
+}
+
+/**
+ * Merge the tip of \p Branch into \p Onto in one step, with the merge base of
+ * \p Upstream and \p Branch as ancestor. Returns true if this shows that
+ * replaying the commits one by one cannot conflict either: the merge is clean
+ * and no path was modified and reverted again on the branch (which could
+ * conflict in between).
+ */
+bool squashedMergeClean(git_repository *Repo,
+                        const git_annotated_commit *Upstream,
+                        const git_annotated_commit *Branch,
+                        const git_annotated_commit *Onto,
+                        const CheckOptions &CheckOpts, std::ostream &O) {
+  int error;
+  const bool Verbose = CheckOpts.Verbose;
+  TraceScope Trace("squashed merge");
+
+  git_oidarray Bases{};
+  error = git_merge_bases(&Bases, Repo, git_annotated_commit_id(Upstream),
+                          git_annotated_commit_id(Branch));
+  if (error == GIT_ENOTFOUND) {
+    if (Verbose) {
+      O << "Squashed check: no merge base, replaying commits..." << std::endl;
+    }
+    return false;
+  }
+  checkError(error, "git_merge_bases");
+  if (Bases.count != 1) {
+    git_oidarray_free(&Bases);
+    if (Verbose) {
+      O << "Squashed check: several merge bases, replaying commits..."
+        << std::endl;
+    }
+    return false;
+  }
+  git_oid Base;
+  git_oid_cpy(&Base, &Bases.ids[0]);
+  git_oidarray_free(&Bases);
+
+  const git_oid *Ids[] = {&Base, git_annotated_commit_id(Onto),
+                          git_annotated_commit_id(Branch)};
+  git_tree *Trees[3] = {nullptr, nullptr, nullptr};
+  for (int I = 0; I < 3 && !error; ++I) {
+    git_commit *Commit;
+    error = git_commit_lookup(&Commit, Repo, Ids[I]);
     if (!error) {
-      error = git_annotated_commit_from_ref(&OntoCommit, Repo, OntoRef);
-      checkError(error, "git_annotated_commit");
+      error = git_commit_tree(&Trees[I], Commit);
+      git_commit_free(Commit);
+    }
+  }
+
+  git_index *Index = nullptr;
+  git_merge_options MergeOpts{};
+  git_merge_init_options(&MergeOpts, GIT_MERGE_OPTIONS_VERSION);
+  setRenameOptions(MergeOpts, CheckOpts.Renames, CheckOpts);
+  if (!error && CheckOpts.Paths.empty()) {
+    error = git_merge_trees(&Index, Repo, Trees[0], Trees[1], Trees[2],
+                            &MergeOpts);
+  }
+
+  bool Clean = false, Reverted = false;
+  try {
+    checkError(error, "squashed merge", CheckOpts.TimeLimit, "squashed check");
+    if (CheckOpts.Paths.empty()) {
+      Clean = !git_index_has_conflicts(Index);
+    } else {
+      std::vector<Conflict> Scoped;
+      runTimed(CheckOpts.TimeLimit, "squashed check", [&] {
+        mergeTreesInScope(Repo, Trees[0], Trees[1], Trees[2], CheckOpts.Paths,
+                          MergeOpts, Scoped);
+      });
+      Clean = Scoped.empty();
+    }
+    if (Clean) {
+      Reverted = hasRevertedPaths(Repo, Base, *Ids[2], Trees[0], Trees[2]);
+    }
+  } catch (...) {
+    git_index_free(Index);
+    for (auto *Tree : Trees) {
+      git_tree_free(Tree);
+    }
+    throw;
+  }
+  git_index_free(Index);
+  for (auto *Tree : Trees) {
+    git_tree_free(Tree);
+  }
+
+  if (Verbose) {
+    if (!Clean) {
+      O << "Squashed check: conflicts, replaying commits..." << std::endl;
+    } else if (Reverted) {
+      O << "Squashed check: clean, but the branch reverts some of its "
+           "changes, replaying commits..."
+        << std::endl;
     } else {
-      // try to parse as commit id
-      git_oid Oid{};
-      error = git_oid_fromstrp(&Oid, Onto);
-      checkError(error, "git_oid_fromstrp");
-      error = git_annotated_commit_lookup(&OntoCommit, Repo, &Oid);
-      checkError(error, "git_annotated_commit");
+      O << "Squashed check: clean, skipping per-commit replay." << std::endl;
     }
   }
+  return Clean && !Reverted;
+}
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * Outcome of replaying a single commit.
+ */
+struct ReplayStep {
+  git_oid Id{};
+  std::string Summary;
+  std::vector<Conflict> Records;
+  double Ms = 0;
+  std::string Error;
+  bool Done = false;
+  /// The changed-path filters proved the step clean; it was not merged.
+  bool Skipped = false;
+  /// The merge was stopped at the deadline.
+  bool TimedOut = false;
+};
+
+/**
+ * Merge the changes of commit \p Step.Id into \p Onto, just like an in-memory
+ * rebase step without a preceding git_rebase_commit does.
+ */
+void replayStep(git_repository *Repo, const git_oid &Onto,
+                const CheckOptions &CheckOpts, ReplayStep &Step) {
+  int error;
+
+  git_commit *Commit = nullptr, *Parent = nullptr, *OntoCommit = nullptr;
+  git_tree *Tree = nullptr, *ParentTree = nullptr, *OntoTree = nullptr;
+  git_index *Index = nullptr;
+
+  error = git_commit_lookup(&Commit, Repo, &Step.Id);
+  if (!error) {
+    Step.Summary = git_commit_summary(Commit);
+    error = git_commit_tree(&Tree, Commit);
+  }
+  if (!error && git_commit_parentcount(Commit) > 0) {
+    error = git_commit_parent(&Parent, Commit, 0);
+    if (!error) {
+      error = git_commit_tree(&ParentTree, Parent);
+    }
+  }
+  if (!error) {
+    error = git_commit_lookup(&OntoCommit, Repo, &Onto);
+  }
+  if (!error) {
+    error = git_commit_tree(&OntoTree, OntoCommit);
+  }
+  std::string ScopeError;
+  int ScopeCode = 0;
+  if (!error && !CheckOpts.Paths.empty()) {
+    git_merge_options MergeOpts{};
+    git_merge_init_options(&MergeOpts, GIT_MERGE_OPTIONS_VERSION);
+    setRenameOptions(MergeOpts, CheckOpts.Renames, CheckOpts);
+    try {
+      mergeTreesInScope(Repo, ParentTree, OntoTree, Tree, CheckOpts.Paths,
+                        MergeOpts, Step.Records);
+    } catch (const GitError &Ex) {
+      ScopeError = Ex.what();
+      ScopeCode = Ex.code();
+    }
+  } else if (!error) {
+    git_merge_options MergeOpts{};
+    git_merge_init_options(&MergeOpts, GIT_MERGE_OPTIONS_VERSION);
+    setRenameOptions(MergeOpts, CheckOpts.Renames, CheckOpts);
+    error = git_merge_trees(&Index, Repo, ParentTree, OntoTree, Tree,
+                            &MergeOpts);
+  }
+  if (!error && Index && git_index_has_conflicts(Index)) {
+    git_index_conflict_iterator *ConflictIt;
+    error = git_index_conflict_iterator_new(&ConflictIt, Index);
+    if (!error) {
+      IndexConflict C{};
+      while ((error = git_index_conflict_next(&C.Ancestor, &C.Our, &C.Their,
+                                              ConflictIt)) == 0) {
+        Step.Records.push_back(toConflict(C));
+      }
+      git_index_conflict_iterator_free(ConflictIt);
+      if (error == GIT_ITEROVER) {
+        error = 0;
+      }
+    }
+  }
+
+  git_index_free(Index);
+  git_tree_free(OntoTree);
+  git_tree_free(ParentTree);
+  git_tree_free(Tree);
+  git_commit_free(OntoCommit);
+  git_commit_free(Parent);
+  git_commit_free(Commit);
+  checkError(error, "replaying commit");
+  if (!ScopeError.empty()) {
+    throw GitError(ScopeCode, ScopeError);
+  }
+}
+
+TreePtr lookupTree(git_repository *Repo, const git_oid &CommitId) {
+  git_commit *Raw;
+  int error = git_commit_lookup(&Raw, Repo, &CommitId);
+  checkError(error, "git_commit_lookup");
+  CommitPtr Commit(Raw);
+  git_tree *Tree;
+  error = git_commit_tree(&Tree, Commit.get());
+  checkError(error, "git_commit_tree");
+  return TreePtr(Tree);
+}
+
+/**
+ * If the commits of \p Replay form a single line, collect the paths changed
+ * between the parent of the first one and \p Onto into \p Upstream and return
+ * true. The changes between the parent of any step and \p Onto are then
+ * within \p Upstream and the changes of the steps before it.
+ */
+bool linearUpstreamChanges(git_repository *Repo,
+                           const std::vector<ReplayStep> &Replay,
+                           const git_oid &Onto,
+                           std::vector<std::string> &Upstream) {
+  git_oid First{};
+  for (size_t I = 0; I < Replay.size(); ++I) {
+    git_commit *Raw;
+    int error = git_commit_lookup(&Raw, Repo, &Replay[I].Id);
+    checkError(error, "git_commit_lookup");
+    CommitPtr Commit(Raw);
+    if (git_commit_parentcount(Commit.get()) != 1) {
+      return false;
+    }
+    const git_oid *Parent = git_commit_parent_id(Commit.get(), 0);
+    if (I == 0) {
+      git_oid_cpy(&First, Parent);
+    } else if (!git_oid_equal(Parent, &Replay[I - 1].Id)) {
+      return false;
+    }
+  }
+  TreePtr FirstTree = lookupTree(Repo, First);
+  TreePtr OntoTree = lookupTree(Repo, Onto);
+  changedPaths(Repo, FirstTree.get(), OntoTree.get(), Upstream, true);
+  return true;
+}
+
+/**
+ * Whether step \p I of \p Replay provably merges cleanly onto its target:
+ * its changes overlap neither \p Upstream (see linearUpstreamChanges()) nor,
+ * according to \p Filters, the changes of any earlier step. Like the merge
+ * prefilter, disjoint changes are taken to be clean.
+ */
+bool provablyClean(git_repository *Repo, std::vector<ReplayStep> &Replay,
+                   size_t I, const std::vector<std::string> &Upstream,
+                   const PathIndex &Filters) {
+  int error;
+
+  ReplayStep &Step = Replay[I];
+  git_commit *Raw;
+  error = git_commit_lookup(&Raw, Repo, &Step.Id);
+  checkError(error, "git_commit_lookup");
+  CommitPtr Commit(Raw);
+  Step.Summary = git_commit_summary(Commit.get());
+  TreePtr Tree = lookupTree(Repo, Step.Id);
+  TreePtr ParentTree =
+      lookupTree(Repo, *git_commit_parent_id(Commit.get(), 0));
+
+  std::vector<std::string> Changed;
+  changedPaths(Repo, ParentTree.get(), Tree.get(), Changed, true);
+  if (pathsOverlap(Changed, Upstream)) {
+    return false;
+  }
+  for (const auto &Path : Changed) {
+    PathIndex::Query Q = PathIndex::query(Path);
+    for (size_t Earlier = 0; Earlier < I; ++Earlier) {
+      if (Filters.mayOverlap(Replay[Earlier].Id, Q)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * Check every commit of \p Rebase against \p Onto on its own, spread over
+ * CheckOpts.RebaseJobs workers. Without git_rebase_commit, this is exactly what
+ * the sequential replay computes. The commits are handed out in order and the
+ * results are reported in order; with CheckOpts.FirstConflict, commits after
+ * the first conflicting one are skipped. \p Steps receives the number of
+ * reported commits; found conflicts are appended to \p Conflicting if given.
+ * \p OntoName is the name of \p Onto in CheckOpts.Records. Once
+ * CheckOpts.TimeLimit has passed, no further commit is started and
+ * \p Interrupted receives the first step that was not completed.
+ */
+size_t replayInParallel(git_repository *Repo, git_rebase *Rebase,
+                        const git_oid &Onto, const std::string &OntoName,
+                        const CheckOptions &CheckOpts, std::ostream &O,
+                        size_t &Steps, std::vector<Conflict> *Conflicting,
+                        std::string &Interrupted) {
+  const Deadline *Limit = CheckOpts.TimeLimit;
+  std::vector<ReplayStep> Replay(git_rebase_operation_entrycount(Rebase));
+  for (size_t I = 0; I < Replay.size(); ++I) {
+    git_oid_cpy(&Replay[I].Id, &git_rebase_operation_byindex(Rebase, I)->id);
+  }
+
+  ThreadPool Pool(CheckOpts.RebaseJobs);
+  WorkerRepositories WorkerRepos(Repo, git_repository_path(Repo), Pool.size());
+  if (CheckOpts.Verbose) {
+    O << "Replaying " << Replay.size() << " commits on " << Pool.size()
+      << " workers..." << std::endl;
+  }
+
+  // with changed-path filters, steps that only touch paths changed neither
+  // upstream nor by an earlier step are not merged at all
+  std::vector<std::string> Upstream;
+  bool CanSkip = CheckOpts.PathFilters && CheckOpts.Prefilter &&
+                 linearUpstreamChanges(Repo, Replay, Onto, Upstream);
+
+  std::atomic<size_t> Next(0);
+  std::atomic<size_t> FirstConflict(SIZE_MAX);
+  for (unsigned W = 0; W < Pool.size(); ++W) {
+    Pool.submit([&](unsigned Worker) {
+      for (size_t I = Next++; I < Replay.size() && I < FirstConflict;
+           I = Next++) {
+        if (Limit && Limit->expired()) {
+          break;
+        }
+        ReplayStep &Step = Replay[I];
+        auto StepStart = Clock::now();
+        try {
+          TraceScope StepTrace("rebase step", static_cast<int64_t>(I) + 1);
+          if (CanSkip && provablyClean(WorkerRepos[Worker], Replay, I,
+                                       Upstream, *CheckOpts.PathFilters)) {
+            Step.Skipped = true;
+          } else {
+            replayStep(WorkerRepos[Worker], Onto, CheckOpts, Step);
+          }
+        } catch (const GitError &Ex) {
+          if (stoppedAt(Ex, Limit)) {
+            Step.TimedOut = true;
+          } else {
+            Step.Error = Ex.what();
+          }
+        }
+        Step.Ms = std::chrono::duration<double, std::milli>(Clock::now() -
+                                                            StepStart)
+                      .count();
+        Step.Done = true;
+        if (CheckOpts.FirstConflict &&
+            (!Step.Records.empty() || !Step.Error.empty())) {
+          size_t Current = FirstConflict;
+          while (I < Current &&
+                 !FirstConflict.compare_exchange_weak(Current, I)) {
+          }
+        }
+      }
+    });
+  }
+  Pool.wait();
+
+  size_t Conflicts = 0, Skipped = 0;
+  for (const auto &Step : Replay) {
+    // only the deadline leaves a step before the first conflict undone
+    if (!Step.Done || Step.TimedOut) {
+      Interrupted = "rebase step " + std::to_string(Steps + 1);
+      break;
+    }
+    ++Steps;
+    Skipped += Step.Skipped;
+    if (CheckOpts.Verbose) {
+      O << "Applying commit \"" << Step.Summary << "\"" << std::endl;
+    }
+    if (!Step.Error.empty()) {
+      throw GitError(GIT_ERROR, Step.Error);
+    }
+    Conflicts += Step.Records.size();
+    if (Conflicting) {
+      Conflicting->insert(Conflicting->end(), Step.Records.begin(),
+                          Step.Records.end());
+    }
+    for (const auto &Record : Step.Records) {
+      if (CheckOpts.PrintConflicts) {
+        printConflict(Record, Step.Summary, Step.Summary, O);
+      }
+      if (CheckOpts.Records) {
+        CheckOpts.Records->conflict(OntoName, oidString(Step.Id), Record);
+      }
+    }
+    if (CheckOpts.Verbose) {
+      O << "  step " << Steps << ": " << Step.Ms << " ms"
+        << (Step.Skipped ? " (skipped, no overlapping changes)" : "")
+        << std::endl;
+    }
+    if (CheckOpts.FirstConflict && !Step.Records.empty()) {
+      break;
+    }
+  }
+  if (CheckOpts.Verbose && CanSkip) {
+    O << "Path filters: " << Skipped << " of " << Steps
+      << " steps skipped without merging." << std::endl;
+  }
+  return Conflicts;
+}
+
+size_t rebaseHelper(git_repository *Repo, const char *UpstreamBranch,
+                    const char *Branch, const char *Onto,
+                    const CheckOptions &CheckOpts, std::ostream &O,
+                    std::vector<Conflict> *Conflicting) {
+  int error;
+  TraceScope Trace("rebase");
+
+  // in cumulative mode, the replayed commits are written to memory through a
+  // private handle; otherwise, like merge(), only the merged file contents
+  // that libgit2's auto-merge writes with git_odb_write() reach the repository
+  std::unique_ptr<InMemoryRepository> Scratch;
+  if (CheckOpts.Cumulative) {
+    Scratch.reset(new InMemoryRepository(Repo));
+    Repo = Scratch->get();
+  }
+
+  // get "UpstreamBranch", "Branch" and "Onto" commits
+  AnnotatedCommitPtr UpstreamCommit(
+      lookupAnnotatedCommit(Repo, UpstreamBranch));
+  AnnotatedCommitPtr BranchCommit(lookupAnnotatedCommit(Repo, Branch));
+  AnnotatedCommitPtr OntoCommit;
+  if (Onto) {
+    OntoCommit.reset(lookupAnnotatedCommit(Repo, Onto));
+  }
+  git_annotated_commit *Target =
+      OntoCommit ? OntoCommit.get() : UpstreamCommit.get();
+
+  if (CheckOpts.SquashFirst &&
+      squashedMergeClean(Repo, UpstreamCommit.get(), BranchCommit.get(), Target,
+                         CheckOpts, O)) {
+    return 0;
+  }
+
+  SignaturePtr Committer;
+  if (CheckOpts.Cumulative) {
+    git_signature *RawCommitter;
+    error =
+        git_signature_now(&RawCommitter, "mergecheck", "mergecheck@localhost");
+    checkError(error, "git_signature_now");
+    Committer.reset(RawCommitter);
+  }
 
   size_t Conflicts = 0;
-  git_rebase *Rebase;
+  RebasePtr Rebase;
 
   git_rebase_options Opts{};
   git_rebase_init_options(&Opts, GIT_REBASE_OPTIONS_VERSION);
   Opts.inmemory = 1;
+  setRenameOptions(Opts.merge_options, CheckOpts.Renames, CheckOpts);
 
-  if (Onto) {
-    git_rebase_init(&Rebase, Repo, BranchCommit, UpstreamCommit, OntoCommit,
-                    &Opts);
-  } else {
-    git_rebase_init(&Rebase, Repo, BranchCommit, UpstreamCommit, nullptr,
-                    &Opts);
+  {
+    TraceScope InitTrace("git_rebase_init");
+    git_rebase *RawRebase;
+    error = git_rebase_init(&RawRebase, Repo, BranchCommit.get(),
+                            UpstreamCommit.get(), OntoCommit.get(), &Opts);
+    checkError(error, "git_rebase_init");
+    Rebase.reset(RawRebase);
   }
 
-  git_rebase_operation *RebaseOp;
-  while (git_rebase_next(&RebaseOp, Rebase) == 0) {
-    git_commit *RebaseCommit;
-    git_commit_lookup(&RebaseCommit, Repo, &RebaseOp->id);
-    std::string CommitMsg(git_commit_summary(RebaseCommit));
+  auto Start = Clock::now();
+  size_t Steps = 0, PeakMemory = residentMemory();
+  const Deadline *Limit = CheckOpts.TimeLimit;
+  size_t Operations = git_rebase_operation_entrycount(Rebase.get());
+  // the step that ran into the deadline, with the steps completed before it
+  std::string Interrupted;
 
-    if (Verbose) {
-      std::cout << "Applying commit \"" << CommitMsg << "\"" << std::endl;
+  // every step is merged onto the same tip unless the steps are committed,
+  // so the steps are independent and can be checked in parallel; scoped steps
+  // are always replayed this way, since git_rebase_next() merges the whole
+  // tree, and so are steps that path filters may skip
+  bool Parallel = (CheckOpts.RebaseJobs != 1 || !CheckOpts.Paths.empty() ||
+                   CheckOpts.PathFilters) &&
+                  !CheckOpts.Cumulative;
+  if (Parallel) {
+    Conflicts = replayInParallel(
+        Repo, Rebase.get(), *git_annotated_commit_id(Target),
+        Onto ? Onto : UpstreamBranch, CheckOpts, O, Steps, Conflicting,
+        Interrupted);
+  }
+
+  git_rebase_operation *RebaseOp;
+  while (!Parallel) {
+    // git_rebase_next() does the merge of the step
+    TraceScope StepTrace("rebase step", static_cast<int64_t>(Steps) + 1);
+    auto StepStart = Clock::now();
+    if (Limit && Steps < Operations && Limit->expired()) {
+      StepTrace.cancel();
+      Interrupted = "rebase step " + std::to_string(Steps + 1);
+      break;
+    }
+    error = git_rebase_next(&RebaseOp, Rebase.get());
+    if (error == GIT_ITEROVER) {
+      StepTrace.cancel();
+      break;
+    }
+    if (error != 0 && Limit && Limit->fired()) {
+      // a rename metric that stopped at the deadline ends the step
+      Interrupted = "rebase step " + std::to_string(Steps + 1);
+      StepTrace.cancel();
+      break;
     }
+    checkError(error, "git_rebase_next");
+    ++Steps;
 
-    git_commit_free(RebaseCommit);
+    git_commit *RawRebaseCommit;
+    error = git_commit_lookup(&RawRebaseCommit, Repo, &RebaseOp->id);
+    checkError(error, "git_commit_lookup");
+    CommitPtr RebaseCommit(RawRebaseCommit);
+    std::string CommitMsg(git_commit_summary(RebaseCommit.get()));
 
-    git_index *RebaseIndex;
-    git_rebase_inmemory_index(&RebaseIndex, Rebase);
+    if (CheckOpts.Verbose) {
+      O << "Applying commit \"" << CommitMsg << "\"" << std::endl;
+    }
+
+    git_index *RawRebaseIndex;
+    error = git_rebase_inmemory_index(&RawRebaseIndex, Rebase.get());
+    checkError(error, "git_rebase_inmemory_index");
+    IndexPtr RebaseIndex(RawRebaseIndex);
 
-    if (git_index_has_conflicts(RebaseIndex)) {
+    bool HasConflicts = git_index_has_conflicts(RebaseIndex.get());
+    bool StepConflicts = false;
+    if (HasConflicts) {
       // get conflicts
       git_index_conflict_iterator *ConflictIt;
-      git_index_conflict_iterator_new(&ConflictIt, RebaseIndex);
+      error = git_index_conflict_iterator_new(&ConflictIt, RebaseIndex.get());
+      checkError(error, "git_index_conflict_iterator_new");
 
-      Conflict C{};
+      IndexConflict C{};
       while ((error = git_index_conflict_next(&C.Ancestor, &C.Our, &C.Their,
                                               ConflictIt)) == 0) {
+        // cumulative replays can only filter the conflicts by scope
+        if (!CheckOpts.Paths.empty() &&
+            !inScope(toConflict(C).Path, CheckOpts.Paths)) {
+          continue;
+        }
+        if (Limit && Limit->expired()) {
+          Interrupted = "conflict iteration of rebase step " +
+                        std::to_string(Steps);
+          break;
+        }
+        StepConflicts = true;
         Conflicts++;
-        if (PrintConflicts) {
-          printConflict(C, CommitMsg, CommitMsg, std::cout);
+        if (Conflicting) {
+          Conflicting->push_back(toConflict(C));
+        }
+        if (CheckOpts.PrintConflicts) {
+          printConflict(C, CommitMsg, CommitMsg, O);
+        }
+        if (CheckOpts.Records) {
+          CheckOpts.Records->conflict(Onto ? Onto : UpstreamBranch,
+                                      oidString(RebaseOp->id), toConflict(C));
         }
       }
       git_index_conflict_iterator_free(ConflictIt);
+
+      if (error != GIT_ITEROVER) {
+        checkError(error, "git_index_conflict_next");
+      }
     }
 
-    git_index_free(RebaseIndex);
-  }
+    if (!Interrupted.empty()) {
+      --Steps;
+      break;
+    }
 
-  error = git_rebase_finish(Rebase, nullptr);
-  checkError(error, "git_rebase_finish");
+    if (CheckOpts.Cumulative) {
+      if (HasConflicts) {
+        resolveWithTheirs(RebaseIndex.get());
+      }
+      git_oid Id;
+      TraceScope CommitTrace("git_rebase_commit");
+      error =
+          git_rebase_commit(&Id, Rebase.get(), nullptr, Committer.get(),
+                            nullptr, git_commit_message(RebaseCommit.get()));
+      // GIT_EAPPLIED: the commit is already contained upstream
+      if (error != GIT_EAPPLIED) {
+        checkError(error, "git_rebase_commit");
+      }
+    }
 
-  // clean up
+    if (CheckOpts.Verbose) {
+      size_t Memory = residentMemory();
+      PeakMemory = std::max(PeakMemory, Memory);
+      double Ms = std::chrono::duration<double, std::milli>(Clock::now() -
+                                                            StepStart)
+                      .count();
+      O << "  step " << Steps << ": " << Ms << " ms, " << (Memory >> 20)
+        << " MiB resident" << std::endl;
+    }
 
-  git_annotated_commit_free(UpstreamCommit);
-  git_annotated_commit_free(BranchCommit);
-  git_reference_free(UpstreamRef);
-  git_reference_free(BranchRef);
-  if (Onto) {
-    git_annotated_commit_free(OntoCommit);
-    git_reference_free(OntoRef);
+    if (StepConflicts && CheckOpts.FirstConflict) {
+      break;
+    }
   }
 
-  git_rebase_free(Rebase);
+  error = git_rebase_finish(Rebase.get(), nullptr);
+  checkError(error, "git_rebase_finish");
+
+  if (CheckOpts.Verbose) {
+    double Ms =
+        std::chrono::duration<double, std::milli>(Clock::now() - Start).count();
+    O << "Replayed " << Steps << " commits "
+      << (CheckOpts.Cumulative ? "cumulatively" : "independently") << " in "
+      << Ms << " ms, peak " << (PeakMemory >> 20) << " MiB resident."
+      << std::endl;
+  }
 
+  if (!Interrupted.empty()) {
+    throw DeadlineExceeded(Interrupted, Steps);
+  }
   return Conflicts;
 }
 } // namespace
 
 size_t rebase(git_repository *Repo, const std::string &UpstreamBranch,
               const std::string &Branch, bool PrintConflicts, bool Verbose) {
-  return rebaseHelper(Repo, UpstreamBranch.c_str(), Branch.c_str(), nullptr,
-                      PrintConflicts, Verbose);
+  return rebase(Repo, UpstreamBranch, Branch, PrintConflicts, Verbose,
+                std::cout);
 }
 
 size_t rebase(git_repository *Repo, const std::string &UpstreamBranch,
               const std::string &Branch, const std::string &OntoCommit,
               bool PrintConflicts, bool Verbose) {
+  return rebase(Repo, UpstreamBranch, Branch, OntoCommit, PrintConflicts,
+                Verbose, std::cout);
+}
+
+size_t rebase(git_repository *Repo, const std::string &UpstreamBranch,
+              const std::string &Branch, bool PrintConflicts, bool Verbose,
+              std::ostream &O) {
+  CheckOptions Opts;
+  Opts.PrintConflicts = PrintConflicts;
+  Opts.Verbose = Verbose;
+  return rebaseHelper(Repo, UpstreamBranch.c_str(), Branch.c_str(), nullptr,
+                      Opts, O, nullptr);
+}
+
+size_t rebase(git_repository *Repo, const std::string &UpstreamBranch,
+              const std::string &Branch, const std::string &OntoCommit,
+              bool PrintConflicts, bool Verbose, std::ostream &O) {
+  CheckOptions Opts;
+  Opts.PrintConflicts = PrintConflicts;
+  Opts.Verbose = Verbose;
   return rebaseHelper(Repo, UpstreamBranch.c_str(), Branch.c_str(),
-                      OntoCommit.c_str(), PrintConflicts, Verbose);
+                      OntoCommit.c_str(), Opts, O, nullptr);
+}
+
+size_t rebase(git_repository *Repo, const std::string &UpstreamBranch,
+              const std::string &Branch, const std::string &OntoCommit,
+              const CheckOptions &Opts, std::ostream &O,
+              std::vector<Conflict> *Conflicting) {
+  size_t Conflicts = rebaseHelper(
+      Repo, UpstreamBranch.c_str(), Branch.c_str(),
+      OntoCommit.empty() ? nullptr : OntoCommit.c_str(), Opts, O, Conflicting);
+  if (Opts.Records) {
+    Opts.Records->result("rebase", UpstreamBranch, Branch, Conflicts);
+  }
+  return Conflicts;
 }
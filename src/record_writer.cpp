@@ -0,0 +1,260 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "mergecheck/record_writer.hpp"
+#include "mergecheck/utils.hpp"
+
+namespace {
+struct Field {
+  /// Raw values are inserted into JSON as they are, e.g. arrays.
+  enum { String, Number, Null, Raw } Type;
+  const char *Key;
+  std::string Value;
+};
+
+Field str(const char *Key, const std::string &Value) {
+  return {Field::String, Key, Value};
+}
+
+Field num(const char *Key, size_t Value) {
+  return {Field::Number, Key, std::to_string(Value)};
+}
+
+/**
+ * Blob id and mode of one side of a conflict; null if the side is absent.
+ */
+void side(std::vector<Field> &Fields, const char *IdKey, const char *ModeKey,
+          const git_oid &Id, uint32_t Mode) {
+  if (!Mode) {
+    Fields.push_back({Field::Null, IdKey, ""});
+    Fields.push_back({Field::Null, ModeKey, ""});
+    return;
+  }
+  char Octal[16];
+  snprintf(Octal, sizeof(Octal), "%06o", Mode);
+  Fields.push_back(str(IdKey, oidString(Id)));
+  Fields.push_back(str(ModeKey, Octal));
+}
+
+const char *const CsvColumns[] = {
+    "type", "our", "their", "path", "kind", "ancestor_id", "ancestor_mode",
+    "ours_id", "ours_mode", "theirs_id", "theirs_mode", "hunks", "conflicts",
+    "checks", "errors", "message", "check", "phase", "steps"};
+
+void appendJsonString(std::string &Out, const std::string &S) {
+  Out += '"';
+  for (unsigned char Ch : S) {
+    switch (Ch) {
+    case '"':
+      Out += "\\\"";
+      break;
+    case '\\':
+      Out += "\\\\";
+      break;
+    case '\n':
+      Out += "\\n";
+      break;
+    case '\t':
+      Out += "\\t";
+      break;
+    default:
+      if (Ch < 0x20) {
+        char Escaped[8];
+        snprintf(Escaped, sizeof(Escaped), "\\u%04x", Ch);
+        Out += Escaped;
+      } else {
+        Out += static_cast<char>(Ch);
+      }
+    }
+  }
+  Out += '"';
+}
+
+void appendCsvField(std::string &Out, const std::string &S) {
+  if (S.find_first_of(",\"\r\n") == std::string::npos) {
+    Out += S;
+    return;
+  }
+  Out += '"';
+  for (char Ch : S) {
+    if (Ch == '"') {
+      Out += '"';
+    }
+    Out += Ch;
+  }
+  Out += '"';
+}
+
+std::string format(OutputFormat Format, const std::vector<Field> &Fields) {
+  std::string Out;
+  if (Format == OutputFormat::Csv) {
+    bool First = true;
+    for (const char *Column : CsvColumns) {
+      if (!First) {
+        Out += ',';
+      }
+      First = false;
+      for (const auto &F : Fields) {
+        if (std::strcmp(F.Key, Column) == 0) {
+          appendCsvField(Out, F.Value);
+          break;
+        }
+      }
+    }
+    Out += '\n';
+    return Out;
+  }
+
+  Out += '{';
+  for (const auto &F : Fields) {
+    if (Out.size() > 1) {
+      Out += ',';
+    }
+    appendJsonString(Out, F.Key);
+    Out += ':';
+    if (F.Type == Field::String) {
+      appendJsonString(Out, F.Value);
+    } else if (F.Type == Field::Number || F.Type == Field::Raw) {
+      Out += F.Value;
+    } else {
+      Out += "null";
+    }
+  }
+  Out += "}\n";
+  return Out;
+}
+/**
+ * JSON: an array of {"start", "end", "ours", "base", "theirs"} objects, or the
+ * reason why there are none ("too-large", ...) as a string. CSV:
+ * "<start>-<end>:<ours>/<base>/<theirs>" per hunk, separated by ";", or the
+ * reason.
+ */
+Field hunks(OutputFormat Format, const FileHunks &Hunks) {
+  if (Hunks.Status != HunkStatus::Merged) {
+    return str("hunks", hunkStatusName(Hunks.Status));
+  }
+  std::string Value = Format == OutputFormat::Csv ? "" : "[";
+  for (const auto &H : Hunks.Hunks) {
+    if (Value.size() > 1) {
+      Value += Format == OutputFormat::Csv ? ";" : ",";
+    }
+    if (Format == OutputFormat::Csv) {
+      Value += std::to_string(H.Start) + "-" + std::to_string(H.End) + ":" +
+               std::to_string(H.OurLines) + "/" + std::to_string(H.BaseLines) +
+               "/" + std::to_string(H.TheirLines);
+    } else {
+      Value += "{\"start\":" + std::to_string(H.Start) +
+               ",\"end\":" + std::to_string(H.End) +
+               ",\"ours\":" + std::to_string(H.OurLines) +
+               ",\"base\":" + std::to_string(H.BaseLines) +
+               ",\"theirs\":" + std::to_string(H.TheirLines) + "}";
+    }
+  }
+  if (Format != OutputFormat::Csv) {
+    Value += "]";
+  }
+  return {Field::Raw, "hunks", Value};
+}
+} // namespace
+
+bool parseOutputFormat(const std::string &Name, OutputFormat &Format) {
+  if (Name == "human") {
+    Format = OutputFormat::Human;
+  } else if (Name == "jsonl") {
+    Format = OutputFormat::JsonLines;
+  } else if (Name == "csv") {
+    Format = OutputFormat::Csv;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+RecordWriter::RecordWriter(std::ostream &O, OutputFormat Format,
+                           size_t BufferSize)
+    : O(O), Format(Format), BufferSize(BufferSize) {
+  Buffer.reserve(BufferSize);
+  if (Format == OutputFormat::Csv) {
+    for (const char *Column : CsvColumns) {
+      Buffer += Column;
+      Buffer += ',';
+    }
+    Buffer.back() = '\n';
+  }
+}
+
+RecordWriter::~RecordWriter() { flush(); }
+
+void RecordWriter::conflict(const std::string &Our, const std::string &Their,
+                            const Conflict &C, const FileHunks *Hunks) {
+  std::vector<Field> Fields = {str("type", "conflict"), str("our", Our),
+                               str("their", Their), str("path", C.Path),
+                               str("kind", conflictKindName(C.Kind))};
+  side(Fields, "ancestor_id", "ancestor_mode", C.AncestorId, C.AncestorMode);
+  side(Fields, "ours_id", "ours_mode", C.OurId, C.OurMode);
+  side(Fields, "theirs_id", "theirs_mode", C.TheirId, C.TheirMode);
+  if (Hunks) {
+    Fields.push_back(hunks(Format, *Hunks));
+  }
+  append(format(Format, Fields));
+}
+
+void RecordWriter::result(const char *Type, const std::string &Our,
+                          const std::string &Their, size_t Conflicts) {
+  append(format(Format, {str("type", Type), str("our", Our),
+                         str("their", Their), num("conflicts", Conflicts)}));
+  std::lock_guard<std::mutex> Guard(Lock);
+  ++Checks;
+  this->Conflicts += Conflicts;
+}
+
+void RecordWriter::timeout(const char *Type, const std::string &Our,
+                           const std::string &Their, const std::string &Phase,
+                           size_t Steps, size_t Conflicts) {
+  std::vector<Field> Fields = {str("type", "timeout"), str("check", Type),
+                               str("our", Our), str("their", Their),
+                               str("phase", Phase)};
+  if (std::strcmp(Type, "rebase") == 0) {
+    Fields.push_back(num("steps", Steps));
+  }
+  Fields.push_back(num("conflicts", Conflicts));
+  append(format(Format, Fields));
+  std::lock_guard<std::mutex> Guard(Lock);
+  ++Checks;
+  this->Conflicts += Conflicts;
+}
+
+void RecordWriter::error(const std::string &Our, const std::string &Their,
+                         const std::string &Message) {
+  append(format(Format, {str("type", "error"), str("our", Our),
+                         str("their", Their), str("message", Message)}));
+  std::lock_guard<std::mutex> Guard(Lock);
+  ++Errors;
+}
+
+void RecordWriter::summary() {
+  std::vector<Field> Fields;
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Fields = {str("type", "summary"), num("checks", Checks),
+              num("conflicts", Conflicts), num("errors", Errors)};
+  }
+  append(format(Format, Fields));
+}
+
+void RecordWriter::flush() {
+  std::lock_guard<std::mutex> Guard(Lock);
+  O.write(Buffer.data(), Buffer.size());
+  O.flush();
+  Buffer.clear();
+}
+
+void RecordWriter::append(const std::string &Record) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  Buffer += Record;
+  if (Buffer.size() >= BufferSize) {
+    O.write(Buffer.data(), Buffer.size());
+    Buffer.clear();
+  }
+}
@@ -0,0 +1,58 @@
+#include "mergecheck/alternates.hpp"
+#include "mergecheck/refs.hpp"
+#include "mergecheck/trace.hpp"
+#include "mergecheck/utils.hpp"
+
+git_annotated_commit *lookupAnnotatedCommit(git_repository *Repo,
+                                            const std::string &Name,
+                                            std::string *ShortName) {
+  int error;
+  TraceScope Trace("ref lookup");
+
+  git_annotated_commit *Head;
+  git_reference *Ref = nullptr;
+  if (ShortName) {
+    *ShortName = Name;
+  }
+
+  git_oid AltOid{};
+  if (resolveAlternateRef(Name, AltOid)) {
+    error = git_annotated_commit_lookup(&Head, Repo, &AltOid);
+    checkError(error, "git_annotated_commit");
+    return Head;
+  }
+
+  error = git_reference_lookup(&Ref, Repo, Name.c_str());
+  if (!error) {
+    error = git_annotated_commit_from_ref(&Head, Repo, Ref);
+    if (error) {
+      git_reference_free(Ref);
+    }
+    checkError(error, "git_annotated_commit");
+    // get short name for nicer program output
+    const char *BranchShort = nullptr;
+    if (ShortName && git_branch_name(&BranchShort, Ref) == 0) {
+      *ShortName = BranchShort;
+    }
+    git_reference_free(Ref);
+  } else {
+    // try to parse as commit id
+    git_oid Oid{};
+    error = git_oid_fromstrp(&Oid, Name.c_str());
+    checkError(error, "git_oid_fromstrp");
+    error = git_annotated_commit_lookup(&Head, Repo, &Oid);
+    checkError(error, "git_annotated_commit");
+  }
+  return Head;
+}
+
+git_commit *lookupCommit(git_repository *Repo, const std::string &Name) {
+  int error;
+
+  git_annotated_commit *Head = lookupAnnotatedCommit(Repo, Name);
+  git_commit *Commit;
+  error = git_commit_lookup(&Commit, Repo, git_annotated_commit_id(Head));
+  git_annotated_commit_free(Head);
+  checkError(error, "git_commit_lookup");
+  return Commit;
+}
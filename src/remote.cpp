@@ -1,27 +1,66 @@
+#include <chrono>
 #include <iostream>
 
+#include "mergecheck/handles.hpp"
 #include "mergecheck/remote.hpp"
 #include "mergecheck/utils.hpp"
 
+namespace {
+struct WantedRef {
+  std::string Source;      ///< name on the remote, e.g. "refs/heads/master"
+  std::string Destination; ///< e.g. "refs/remotes/upstream/master"
+};
+
+/**
+ * Collect the remote branches that \p Refs refer to through remote-tracking
+ * refs of \p RemoteName.
+ */
+std::vector<WantedRef> wantedRefs(const std::string &RemoteName,
+                                  const std::vector<std::string> &Refs) {
+  const std::string Prefix = "refs/remotes/" + RemoteName + "/";
+  std::vector<WantedRef> Wanted;
+  for (const auto &Ref : Refs) {
+    if (Ref.compare(0, Prefix.size(), Prefix) != 0 ||
+        Ref.size() == Prefix.size()) {
+      continue;
+    }
+    WantedRef W{"refs/heads/" + Ref.substr(Prefix.size()), Ref};
+    bool Duplicate = false;
+    for (const auto &Other : Wanted) {
+      Duplicate |= Other.Destination == W.Destination;
+    }
+    if (!Duplicate) {
+      Wanted.push_back(W);
+    }
+  }
+  return Wanted;
+}
+} // namespace
+
 void addRemote(git_repository *Repo, const std::string &RemoteUrl,
-               const std::string &RemoteName, bool Verbose) {
+               const std::string &RemoteName,
+               const std::vector<std::string> &Refs, bool Verbose) {
   int error;
 
-  git_remote *Remote = nullptr;
+  RemotePtr Remote;
   if (Verbose) {
     std::cout << "Checking if remote \'" << RemoteName << "\' already exists..."
               << std::endl;
   }
-  error = git_remote_lookup(&Remote, Repo, RemoteName.c_str());
+  git_remote *RawRemote = nullptr;
+  error = git_remote_lookup(&RawRemote, Repo, RemoteName.c_str());
   if (error < 0) {
     if (Verbose) {
       std::cout << "Adding remote \'" << RemoteName << "\'..." << std::endl;
     }
-    error = git_remote_create(&Remote, Repo, "upstream", RemoteUrl.c_str());
+    error = git_remote_create(&RawRemote, Repo, RemoteName.c_str(),
+                              RemoteUrl.c_str());
     checkError(error, "adding remote");
+    Remote.reset(RawRemote);
   } else {
     // remote already exists; check if url is the same
-    auto Url = git_remote_url(Remote);
+    Remote.reset(RawRemote);
+    auto Url = git_remote_url(Remote.get());
     if (RemoteUrl == std::string(Url)) {
       if (Verbose) {
         std::cout << "Remote \'" << RemoteName
@@ -29,22 +68,109 @@ void addRemote(git_repository *Repo, const std::string &RemoteUrl,
                   << std::endl;
       }
     } else {
-      std::cerr << "Error: Remote \'" << RemoteName
-                << "\' already exists with the url \'" << Url
-                << "\', which differs from the one specified by the user. "
-                << "Please use a different name." << std::endl;
-      exit(EXIT_FAILURE);
+      std::string Message = "Error: Remote \'" + RemoteName +
+                            "\' already exists with the url \'" + Url +
+                            "\', which differs from the one specified by the "
+                            "user. Please use a different name.";
+      throw GitError(GIT_EEXISTS, Message);
+    }
+  }
+
+  std::vector<WantedRef> Wanted = wantedRefs(RemoteName, Refs);
+  if (Wanted.empty()) {
+    if (Verbose) {
+      std::cout << "No refs of remote \'" << RemoteName
+                << "\' requested, skipping fetch." << std::endl;
     }
+    return;
+  }
+
+  auto Start = std::chrono::steady_clock::now();
+
+  // ask the remote for its tips; branches whose tip we already have only need
+  // their remote-tracking ref to be updated
+  git_remote_callbacks Callbacks{};
+  error = git_remote_init_callbacks(&Callbacks, GIT_REMOTE_CALLBACKS_VERSION);
+  checkError(error, "git_remote_init_callbacks");
+  error = git_remote_connect(Remote.get(), GIT_DIRECTION_FETCH, &Callbacks,
+                             nullptr, nullptr);
+  checkError(error, "connecting to remote");
+  const git_remote_head **Heads;
+  size_t HeadCount = 0;
+  error = git_remote_ls(&Heads, &HeadCount, Remote.get());
+  checkError(error, "listing remote refs");
+
+  OdbPtr Odb;
+  {
+    git_odb *Raw;
+    error = git_repository_odb(&Raw, Repo);
+    checkError(error, "git_repository_odb");
+    Odb.reset(Raw);
+  }
+
+  std::vector<std::string> Refspecs;
+  for (const auto &W : Wanted) {
+    const git_remote_head *Head = nullptr;
+    for (size_t I = 0; I < HeadCount; ++I) {
+      if (W.Source == Heads[I]->name) {
+        Head = Heads[I];
+      }
+    }
+    if (Head == nullptr) {
+      std::cerr << "Warning: Remote \'" << RemoteName << "\' has no branch \'"
+                << W.Source << "\'.\n";
+      continue;
+    }
+    if (git_odb_exists(Odb.get(), &Head->oid)) {
+      git_reference *Ref;
+      error = git_reference_create(&Ref, Repo, W.Destination.c_str(),
+                                   &Head->oid, 1, "mergecheck: update");
+      checkError(error, "updating remote-tracking ref");
+      ReferencePtr Updated(Ref);
+      if (Verbose) {
+        std::cout << "Tip of \'" << W.Destination
+                  << "\' is already present locally." << std::endl;
+      }
+      continue;
+    }
+    Refspecs.push_back("+" + W.Source + ":" + W.Destination);
+  }
+  Odb.reset();
+  git_remote_disconnect(Remote.get());
+
+  if (Refspecs.empty()) {
+    if (Verbose) {
+      std::cout << "Nothing to fetch from remote \'" << RemoteName << "\'."
+                << std::endl;
+    }
+    return;
   }
 
   if (Verbose) {
-    std::cout << "Fetching remote \'" << RemoteName << "\'..." << std::endl;
+    std::cout << "Fetching " << Refspecs.size() << " refs from remote \'"
+              << RemoteName << "\'..." << std::endl;
+  }
+  std::vector<char *> RefspecPtrs;
+  for (auto &Refspec : Refspecs) {
+    RefspecPtrs.push_back(&Refspec[0]);
   }
+  git_strarray RefspecArray{RefspecPtrs.data(), RefspecPtrs.size()};
+
   git_fetch_options FetchOpts{};
   error = git_fetch_init_options(&FetchOpts, GIT_FETCH_OPTIONS_VERSION);
   checkError(error, "git_fetch_options");
-  error = git_remote_fetch(Remote, nullptr, &FetchOpts, nullptr);
+  FetchOpts.download_tags = GIT_REMOTE_DOWNLOAD_TAGS_NONE;
+  FetchOpts.update_fetchhead = 0;
+  error = git_remote_fetch(Remote.get(), &RefspecArray, &FetchOpts, nullptr);
   checkError(error, "fetching remote");
 
-  git_remote_free(Remote);
+  if (Verbose) {
+    const git_transfer_progress *Stats = git_remote_stats(Remote.get());
+    double Ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - Start)
+                    .count();
+    std::cout << "Fetched " << Stats->received_objects << " objects ("
+              << Stats->received_bytes << " bytes, " << Stats->local_objects
+              << " local) in " << Ms << " ms." << std::endl;
+  }
 }
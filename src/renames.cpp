@@ -0,0 +1,407 @@
+#include <chrono>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <git2/sys/hashsig.h>
+
+#include "mergecheck/deadline.hpp"
+#include "mergecheck/handles.hpp"
+#include "mergecheck/renames.hpp"
+#include "mergecheck/utils.hpp"
+
+namespace {
+struct OidHash {
+  size_t operator()(const git_oid &Id) const {
+    // object ids are uniformly distributed already
+    size_t H;
+    std::memcpy(&H, Id.id, sizeof(H));
+    return H;
+  }
+};
+
+struct OidEqual {
+  bool operator()(const git_oid &A, const git_oid &B) const {
+    return git_oid_equal(&A, &B);
+  }
+};
+
+using OidCounts = std::unordered_map<git_oid, size_t, OidHash, OidEqual>;
+
+/// libgit2's target_limit if neither the options nor the config set one.
+const unsigned DefaultRenameLimit = 1000;
+
+/*
+ * libgit2's default metric for merges: hashed content signatures that ignore
+ * whitespace changes.
+ */
+const git_hashsig_option_t SignatureOptions = GIT_HASHSIG_SMART_WHITESPACE;
+
+int hashsigFileSignature(void **Out, const git_diff_file *, const char *Path,
+                         void *) {
+  return git_hashsig_create_fromfile(reinterpret_cast<git_hashsig **>(Out),
+                                     Path, SignatureOptions);
+}
+
+int hashsigBufferSignature(void **Out, const git_diff_file *, const char *Buf,
+                           size_t Size, void *) {
+  return git_hashsig_create(reinterpret_cast<git_hashsig **>(Out), Buf, Size,
+                            SignatureOptions);
+}
+
+void hashsigFreeSignature(void *Signature, void *) {
+  git_hashsig_free(static_cast<git_hashsig *>(Signature));
+}
+
+int hashsigSimilarity(int *Score, void *A, void *B, void *) {
+  int Similarity = git_hashsig_compare(static_cast<git_hashsig *>(A),
+                                       static_cast<git_hashsig *>(B));
+  if (Similarity < 0) {
+    return Similarity;
+  }
+  *Score = Similarity;
+  return 0;
+}
+
+const git_diff_similarity_metric HashsigMetric = {
+    hashsigFileSignature, hashsigBufferSignature, hashsigFreeSignature,
+    hashsigSimilarity, nullptr};
+
+int64_t steadyNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/*
+ * A similarity metric that only compares blob ids: a pair is either identical
+ * (100) or unrelated (0). The signature is the id itself, so libgit2 never
+ * hashes file contents.
+ */
+int oidFileSignature(void **Out, const git_diff_file *File, const char *,
+                     void *) {
+  *Out = new git_oid(File->id);
+  return 0;
+}
+
+int oidBufferSignature(void **Out, const git_diff_file *File, const char *,
+                       size_t, void *) {
+  *Out = new git_oid(File->id);
+  return 0;
+}
+
+void oidFreeSignature(void *Signature, void *) {
+  delete static_cast<git_oid *>(Signature);
+}
+
+int oidSimilarity(int *Score, void *A, void *B, void *) {
+  *Score = git_oid_equal(static_cast<git_oid *>(A), static_cast<git_oid *>(B))
+               ? 100
+               : 0;
+  return 0;
+}
+
+git_diff_similarity_metric ExactMetric = {oidFileSignature, oidBufferSignature,
+                                          oidFreeSignature, oidSimilarity,
+                                          nullptr};
+
+bool isTreeMode(uint32_t Mode) { return Mode == GIT_FILEMODE_TREE; }
+
+/**
+ * Append the files below the deleted (or added) subtree \p Entry to \p Out.
+ */
+void expandTree(git_repository *Repo, const ChangedEntry &Entry, bool Deleted,
+                std::vector<ChangedEntry> &Out) {
+  git_tree *Raw;
+  int error =
+      git_tree_lookup(&Raw, Repo, Deleted ? &Entry.OldId : &Entry.NewId);
+  checkError(error, "git_tree_lookup");
+  TreePtr Tree(Raw);
+  changedEntries(Repo, Deleted ? Tree.get() : nullptr,
+                 Deleted ? nullptr : Tree.get(), Out, true, Entry.Path + "/");
+}
+
+/**
+ * Match the deleted entries of one side to its added entries by id: subtrees
+ * first, then the files of all unmatched subtrees and the remaining files.
+ * If \p Files is given, the paths of all files the side changed are added to
+ * it.
+ */
+void matchSide(git_repository *Repo, const std::vector<ChangedEntry> &Changes,
+               RenameScan &Scan, std::unordered_set<std::string> *Files) {
+  std::vector<ChangedEntry> DeletedTrees, AddedTrees, DeletedFiles,
+      AddedFiles, MovedTrees;
+  for (const auto &E : Changes) {
+    if (!E.NewMode) {
+      (isTreeMode(E.OldMode) ? DeletedTrees : DeletedFiles).push_back(E);
+    } else if (!E.OldMode) {
+      (isTreeMode(E.NewMode) ? AddedTrees : AddedFiles).push_back(E);
+    } else if (Files) {
+      Files->insert(E.Path);
+    }
+  }
+
+  OidCounts Unmatched;
+  for (const auto &E : AddedTrees) {
+    ++Unmatched[E.NewId];
+  }
+  for (const auto &E : DeletedTrees) {
+    auto It = Unmatched.find(E.OldId);
+    if (It != Unmatched.end() && It->second > 0) {
+      --It->second;
+      ++Scan.ExactRenames;
+      MovedTrees.push_back(E);
+    } else {
+      expandTree(Repo, E, true, DeletedFiles);
+    }
+  }
+  for (const auto &E : AddedTrees) {
+    auto It = Unmatched.find(E.NewId);
+    if (It->second > 0) {
+      --It->second;
+      expandTree(Repo, E, false, AddedFiles);
+    } else {
+      MovedTrees.push_back(E);
+    }
+  }
+
+  if (Files) {
+    // moved subtrees are only expanded to be counted
+    std::vector<ChangedEntry> MovedFiles;
+    for (const auto &E : MovedTrees) {
+      expandTree(Repo, E, !E.NewMode, MovedFiles);
+    }
+    for (const auto *Side : {&MovedFiles, &DeletedFiles, &AddedFiles}) {
+      for (const auto &E : *Side) {
+        Files->insert(E.Path);
+      }
+    }
+  }
+
+  Unmatched.clear();
+  for (const auto &E : AddedFiles) {
+    ++Unmatched[E.NewId];
+  }
+  size_t Exact = 0;
+  for (const auto &E : DeletedFiles) {
+    auto It = Unmatched.find(E.OldId);
+    if (It != Unmatched.end() && It->second > 0) {
+      --It->second;
+      ++Exact;
+    }
+  }
+
+  Scan.Deleted += DeletedFiles.size();
+  Scan.Added += AddedFiles.size();
+  Scan.ExactRenames += Exact;
+  Scan.Candidates +=
+      (DeletedFiles.size() - Exact) * (AddedFiles.size() - Exact);
+}
+
+/**
+ * Whether a path deleted or added by \p A was also changed by \p B.
+ */
+bool movesTouched(const std::vector<ChangedEntry> &A,
+                  const std::vector<ChangedEntry> &B) {
+  std::vector<std::string> Moved, Changed;
+  for (const auto &E : A) {
+    if (!E.OldMode || !E.NewMode) {
+      Moved.push_back(E.Path);
+    }
+  }
+  if (Moved.empty()) {
+    return false;
+  }
+  for (const auto &E : B) {
+    Changed.push_back(E.Path);
+  }
+  return pathsOverlap(Moved, Changed);
+}
+} // namespace
+
+bool parseRenameMode(const std::string &Name, RenameMode &Mode) {
+  if (Name == "off") {
+    Mode = RenameMode::Off;
+  } else if (Name == "exact") {
+    Mode = RenameMode::Exact;
+  } else if (Name == "full") {
+    Mode = RenameMode::Full;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char *renameModeName(RenameMode Mode) {
+  switch (Mode) {
+  case RenameMode::Off:
+    return "off";
+  case RenameMode::Exact:
+    return "exact";
+  case RenameMode::Full:
+    break;
+  }
+  return "full";
+}
+
+void setRenameOptions(git_merge_options &MergeOpts, RenameMode Mode,
+                      const CheckOptions &Opts) {
+  if (Mode == RenameMode::Off) {
+    MergeOpts.flags &= ~GIT_MERGE_FIND_RENAMES;
+    return;
+  }
+  MergeOpts.flags |= GIT_MERGE_FIND_RENAMES;
+  if (Opts.RenameLimit) {
+    MergeOpts.target_limit = Opts.RenameLimit;
+  }
+  if (Mode == RenameMode::Exact) {
+    MergeOpts.rename_threshold = 100;
+    MergeOpts.metric = &ExactMetric;
+  } else if (Opts.RenameThreshold) {
+    MergeOpts.rename_threshold = Opts.RenameThreshold;
+  }
+  if (Opts.TimeLimit) {
+    // a callback's error ends the merge
+    MergeOpts.metric = const_cast<git_diff_similarity_metric *>(
+        Opts.TimeLimit->renameMetric(MergeOpts.metric));
+  }
+}
+
+unsigned renameLimit(git_repository *Repo, const CheckOptions &Opts) {
+  if (Opts.RenameLimit) {
+    return Opts.RenameLimit;
+  }
+  // the same lookup as libgit2's: the first setting that is present wins
+  git_config *Raw;
+  if (git_repository_config_snapshot(&Raw, Repo) == 0) {
+    ConfigPtr Config(Raw);
+    for (const char *Name : {"merge.renameLimit", "diff.renameLimit"}) {
+      int32_t Limit = 0;
+      if (git_config_get_int32(&Limit, Config.get(), Name) == 0 &&
+          Limit != 0) {
+        return Limit > 0 ? static_cast<unsigned>(Limit) : DefaultRenameLimit;
+      }
+    }
+  }
+  return DefaultRenameLimit;
+}
+
+const git_diff_similarity_metric &defaultRenameMetric() {
+  return HashsigMetric;
+}
+
+RenameScan scanRenames(git_repository *Repo,
+                       const std::vector<ChangedEntry> &Ours,
+                       const std::vector<ChangedEntry> &Theirs,
+                       RenameMode Mode, unsigned Limit) {
+  auto Start = std::chrono::steady_clock::now();
+  RenameScan Scan;
+  Scan.Limit = Limit;
+  Scan.Relevant = Mode != RenameMode::Off &&
+                  (movesTouched(Ours, Theirs) || movesTouched(Theirs, Ours));
+  if (Scan.Relevant) {
+    // libgit2 counts the files changed by either side, once per path
+    std::unordered_set<std::string> Files;
+    bool Full = Mode == RenameMode::Full;
+    matchSide(Repo, Ours, Scan, Full ? &Files : nullptr);
+    matchSide(Repo, Theirs, Scan, Full ? &Files : nullptr);
+    Scan.ChangedFiles = Files.size();
+    Scan.OverLimit = Full && Scan.ChangedFiles > Limit;
+    if (Scan.OverLimit) {
+      Scan.Candidates = 0;
+    }
+  }
+  Scan.Ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - Start)
+                .count();
+  return Scan;
+}
+
+RenameMode effectiveRenameMode(RenameMode Mode, const RenameScan &Scan) {
+  if (!Scan.Relevant) {
+    return RenameMode::Off;
+  }
+  // over the limit, libgit2 only matches identical files
+  if (Mode == RenameMode::Full && Scan.OverLimit) {
+    Mode = RenameMode::Exact;
+  }
+  // exact detection can only find what the scan found
+  if (Mode == RenameMode::Exact && Scan.ExactRenames == 0) {
+    return RenameMode::Off;
+  }
+  return Mode;
+}
+
+std::ostream &printRenameScan(const RenameScan &Scan, RenameMode Mode,
+                              std::ostream &O) {
+  O << "Renames (" << renameModeName(Mode) << "): ";
+  if (!Scan.Relevant) {
+    return O << "no moved path was changed on the other side, detection "
+                "skipped.\n";
+  }
+  O << Scan.Deleted << " deleted, " << Scan.Added << " added, "
+    << Scan.ExactRenames << " exact renames";
+  if (Mode == RenameMode::Full && Scan.OverLimit) {
+    O << ", " << Scan.ChangedFiles << " changed files exceed the limit of "
+      << Scan.Limit << ", similarity detection skipped";
+  } else if (Mode == RenameMode::Full) {
+    O << ", " << Scan.Candidates << " candidate pairs";
+  } else if (Scan.ExactRenames == 0) {
+    O << ", detection skipped";
+  }
+  return O << " (" << Scan.Ms << " ms)\n";
+}
+
+void RenameTimer::wrap(git_merge_options &MergeOpts) {
+  Inner = MergeOpts.metric ? MergeOpts.metric : &defaultRenameMetric();
+  Metric = {fileSignature, bufferSignature, freeSignature, similarity, this};
+  MergeOpts.metric = &Metric;
+}
+
+double RenameTimer::ms() const {
+  int64_t Begin = First, End = Last;
+  return Begin && End > Begin ? (End - Begin) / 1e6 : 0;
+}
+
+void RenameTimer::started() {
+  int64_t Unset = 0;
+  First.compare_exchange_strong(Unset, steadyNs());
+}
+
+int RenameTimer::fileSignature(void **Out, const git_diff_file *File,
+                               const char *Path, void *Payload) {
+  RenameTimer &Timer = *static_cast<RenameTimer *>(Payload);
+  Timer.started();
+  ++Timer.Signatures;
+  return Timer.Inner->file_signature(Out, File, Path, Timer.Inner->payload);
+}
+
+int RenameTimer::bufferSignature(void **Out, const git_diff_file *File,
+                                 const char *Buf, size_t Size,
+                                 void *Payload) {
+  RenameTimer &Timer = *static_cast<RenameTimer *>(Payload);
+  Timer.started();
+  ++Timer.Signatures;
+  return Timer.Inner->buffer_signature(Out, File, Buf, Size,
+                                       Timer.Inner->payload);
+}
+
+void RenameTimer::freeSignature(void *Signature, void *Payload) {
+  RenameTimer &Timer = *static_cast<RenameTimer *>(Payload);
+  Timer.Inner->free_signature(Signature, Timer.Inner->payload);
+}
+
+int RenameTimer::similarity(int *Score, void *A, void *B, void *Payload) {
+  RenameTimer &Timer = *static_cast<RenameTimer *>(Payload);
+  Timer.started();
+  int Error = Timer.Inner->similarity(Score, A, B, Timer.Inner->payload);
+  ++Timer.Comparisons;
+  Timer.Last = steadyNs();
+  return Error;
+}
+
+std::ostream &printRenameTiming(const RenameTimer &Timer, std::ostream &O) {
+  return O << "Rename detection: " << Timer.signatures() << " signatures, "
+           << Timer.comparisons() << " comparisons (" << Timer.ms()
+           << " ms)\n";
+}
@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mergecheck/result_cache.hpp"
+#include "mergecheck/utils.hpp"
+
+namespace {
+const uint32_t RecordMagic = 0x3352434d; // "MCR3"
+const size_t HeaderSize = 3 * sizeof(uint32_t);
+
+uint32_t checksum(const char *Data, size_t Size) {
+  // FNV-1a
+  uint32_t Hash = 2166136261u;
+  for (size_t I = 0; I < Size; ++I) {
+    Hash ^= static_cast<unsigned char>(Data[I]);
+    Hash *= 16777619u;
+  }
+  return Hash;
+}
+
+template <typename T> void put(std::string &Out, const T &Value) {
+  Out.append(reinterpret_cast<const char *>(&Value), sizeof(Value));
+}
+
+template <typename T> bool get(const std::string &In, size_t &Pos, T &Value) {
+  if (In.size() - Pos < sizeof(Value)) {
+    return false;
+  }
+  std::memcpy(&Value, In.data() + Pos, sizeof(Value));
+  Pos += sizeof(Value);
+  return true;
+}
+
+void appendRecord(std::string &Out, const MergeKey &Key,
+                  const std::vector<Conflict> &Conflicts) {
+  std::string Payload;
+  put(Payload, Key.Base);
+  put(Payload, Key.Ours);
+  put(Payload, Key.Theirs);
+  put(Payload, Key.Variant);
+  put(Payload, static_cast<uint32_t>(Conflicts.size()));
+  for (const auto &C : Conflicts) {
+    put(Payload, static_cast<uint8_t>(C.Kind));
+    put(Payload, static_cast<uint32_t>(C.Path.size()));
+    Payload += C.Path;
+    put(Payload, C.AncestorId);
+    put(Payload, C.OurId);
+    put(Payload, C.TheirId);
+    put(Payload, C.AncestorMode);
+    put(Payload, C.OurMode);
+    put(Payload, C.TheirMode);
+  }
+
+  put(Out, RecordMagic);
+  put(Out, static_cast<uint32_t>(Payload.size()));
+  put(Out, checksum(Payload.data(), Payload.size()));
+  Out += Payload;
+}
+
+bool parsePayload(const std::string &In, size_t Pos, MergeKey &Key,
+                  std::vector<Conflict> &Conflicts) {
+  uint32_t Count = 0;
+  if (!get(In, Pos, Key.Base) || !get(In, Pos, Key.Ours) ||
+      !get(In, Pos, Key.Theirs) || !get(In, Pos, Key.Variant) ||
+      !get(In, Pos, Count)) {
+    return false;
+  }
+  Conflicts.clear();
+  for (uint32_t I = 0; I < Count; ++I) {
+    uint8_t Kind = 0;
+    uint32_t PathSize = 0;
+    if (!get(In, Pos, Kind) || !get(In, Pos, PathSize) ||
+        In.size() - Pos < PathSize ||
+        Kind > static_cast<uint8_t>(ConflictKind::DeletedInTheirs)) {
+      return false;
+    }
+    Conflict C{static_cast<ConflictKind>(Kind), In.substr(Pos, PathSize), {},
+               {}, {}, 0, 0, 0};
+    Pos += PathSize;
+    if (!get(In, Pos, C.AncestorId) || !get(In, Pos, C.OurId) ||
+        !get(In, Pos, C.TheirId) || !get(In, Pos, C.AncestorMode) ||
+        !get(In, Pos, C.OurMode) || !get(In, Pos, C.TheirMode)) {
+      return false;
+    }
+    Conflicts.push_back(std::move(C));
+  }
+  return true;
+}
+} // namespace
+
+bool operator==(const MergeKey &A, const MergeKey &B) {
+  return git_oid_equal(&A.Base, &B.Base) && git_oid_equal(&A.Ours, &B.Ours) &&
+         git_oid_equal(&A.Theirs, &B.Theirs) && A.Variant == B.Variant;
+}
+
+size_t MergeKeyHash::operator()(const MergeKey &K) const {
+  // object ids are uniformly distributed already
+  size_t A, B, C;
+  std::memcpy(&A, K.Base.id, sizeof(A));
+  std::memcpy(&B, K.Ours.id, sizeof(B));
+  std::memcpy(&C, K.Theirs.id, sizeof(C));
+  return A ^ (B * 31) ^ (C * 131) ^ K.Variant;
+}
+
+ResultCache::ResultCache(const std::string &GitDir, size_t MaxBytes)
+    : MaxBytes(MaxBytes) {
+  std::string Dir = GitDir;
+  if (!Dir.empty() && Dir.back() != '/') {
+    Dir += '/';
+  }
+  Dir += "mergecheck";
+  ::mkdir(Dir.c_str(), 0755);
+  DataPath = Dir + "/results";
+  LockPath = Dir + "/results.lock";
+}
+
+bool ResultCache::lookup(const MergeKey &Key,
+                         std::vector<Conflict> &Conflicts) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  auto It = Entries.find(Key);
+  if (It == Entries.end()) {
+    // somebody else may have added it in the meantime
+    refresh();
+    It = Entries.find(Key);
+  }
+  if (It == Entries.end()) {
+    ++Misses;
+    return false;
+  }
+  ++Hits;
+  Conflicts = It->second.Conflicts;
+  return true;
+}
+
+void ResultCache::store(const MergeKey &Key,
+                        const std::vector<Conflict> &Conflicts) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  FileLock WriteLock(LockPath);
+  if (!WriteLock.locked()) {
+    return;
+  }
+
+  refresh();
+  if (Entries.count(Key)) {
+    return;
+  }
+
+  int Fd = ::open(DataPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                  0644);
+  if (Fd < 0) {
+    return;
+  }
+  struct stat St {};
+  ::fstat(Fd, &St);
+  if (static_cast<uint64_t>(St.st_ino) != FileId) {
+    reset();
+    FileId = St.st_ino;
+  }
+  // drop a torn record left behind by a crashed writer
+  if (static_cast<size_t>(St.st_size) > ParsedBytes) {
+    if (::ftruncate(Fd, static_cast<off_t>(ParsedBytes)) < 0) {
+      ::close(Fd);
+      return;
+    }
+  }
+
+  std::string Record;
+  appendRecord(Record, Key, Conflicts);
+  bool Written = writeAll(Fd, Record);
+  ::close(Fd);
+  if (!Written) {
+    return;
+  }
+  ParsedBytes += Record.size();
+  Entries[Key] = Entry{NextSequence++, Conflicts};
+
+  if (ParsedBytes > MaxBytes) {
+    compact();
+  }
+}
+
+void ResultCache::reset() {
+  Entries.clear();
+  FileId = 0;
+  ParsedBytes = 0;
+}
+
+void ResultCache::refresh() {
+  int Fd = ::open(DataPath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (Fd < 0) {
+    reset();
+    return;
+  }
+  struct stat St {};
+  if (::fstat(Fd, &St) < 0) {
+    ::close(Fd);
+    return;
+  }
+  if (static_cast<uint64_t>(St.st_ino) != FileId) {
+    // the file was compacted (or created) by another process
+    reset();
+    FileId = St.st_ino;
+  }
+
+  size_t Size = static_cast<size_t>(St.st_size);
+  if (Size > ParsedBytes) {
+    std::string Data(Size - ParsedBytes, '\0');
+    size_t Read = 0;
+    while (Read < Data.size()) {
+      ssize_t N = ::pread(Fd, &Data[Read], Data.size() - Read,
+                          static_cast<off_t>(ParsedBytes + Read));
+      if (N < 0 && errno == EINTR) {
+        continue;
+      }
+      if (N <= 0) {
+        break;
+      }
+      Read += static_cast<size_t>(N);
+    }
+    Data.resize(Read);
+    ParsedBytes += parse(Data);
+  }
+  ::close(Fd);
+}
+
+size_t ResultCache::parse(const std::string &Data) {
+  size_t Pos = 0;
+  while (Data.size() - Pos >= HeaderSize) {
+    size_t Cursor = Pos;
+    uint32_t Magic = 0, PayloadSize = 0, Sum = 0;
+    get(Data, Cursor, Magic);
+    get(Data, Cursor, PayloadSize);
+    get(Data, Cursor, Sum);
+    if (Magic != RecordMagic || Data.size() - Cursor < PayloadSize ||
+        checksum(Data.data() + Cursor, PayloadSize) != Sum) {
+      break;
+    }
+
+    MergeKey Key{};
+    std::vector<Conflict> Conflicts;
+    if (!parsePayload(Data.substr(Cursor, PayloadSize), 0, Key, Conflicts)) {
+      break;
+    }
+    Entries[Key] = Entry{NextSequence++, std::move(Conflicts)};
+    Pos = Cursor + PayloadSize;
+  }
+  return Pos;
+}
+
+void ResultCache::compact() {
+  // keep the newest entries that fit into half of the size limit
+  std::vector<std::pair<uint64_t, const MergeKey *>> BySequence;
+  BySequence.reserve(Entries.size());
+  for (const auto &KV : Entries) {
+    BySequence.emplace_back(KV.second.Sequence, &KV.first);
+  }
+  std::sort(BySequence.begin(), BySequence.end(),
+            [](const std::pair<uint64_t, const MergeKey *> &A,
+               const std::pair<uint64_t, const MergeKey *> &B) {
+              return A.first > B.first;
+            });
+
+  std::vector<std::string> Records;
+  size_t Total = 0;
+  for (const auto &SK : BySequence) {
+    std::string Record;
+    appendRecord(Record, *SK.second, Entries[*SK.second].Conflicts);
+    if (Total + Record.size() > MaxBytes / 2) {
+      break;
+    }
+    Total += Record.size();
+    Records.push_back(std::move(Record));
+  }
+
+  std::string Data;
+  Data.reserve(Total);
+  for (auto It = Records.rbegin(); It != Records.rend(); ++It) {
+    Data += *It;
+  }
+
+  std::string TempPath = DataPath + ".tmp";
+  int Fd = ::open(TempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (Fd < 0) {
+    return;
+  }
+  bool Written = writeAll(Fd, Data);
+  ::close(Fd);
+  if (!Written || ::rename(TempPath.c_str(), DataPath.c_str()) < 0) {
+    ::unlink(TempPath.c_str());
+    return;
+  }
+
+  reset();
+  refresh();
+}
@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <map>
+
+#include "mergecheck/handles.hpp"
+#include "mergecheck/scope.hpp"
+#include "mergecheck/utils.hpp"
+
+namespace {
+/**
+ * A directory that is merged on its own, with its subtree on every side
+ * (nullptr if absent) and the paths of the scope below it.
+ */
+struct ScopeRoot {
+  std::string Prefix;
+  TreePtr Trees[3];
+  std::vector<std::string> Paths;
+};
+
+enum class Lookup { Tree, Missing, Other };
+
+Lookup subtree(git_repository *Repo, const git_tree *Root,
+               const std::string &Dir, TreePtr &Out) {
+  int error;
+
+  git_tree *Raw;
+  if (Dir.empty()) {
+    // a new handle, so that the root can be owned like any subtree
+    error = git_tree_lookup(&Raw, Repo, git_tree_id(Root));
+    checkError(error, "git_tree_lookup");
+    Out.reset(Raw);
+    return Lookup::Tree;
+  }
+
+  git_tree_entry *Entry;
+  error = git_tree_entry_bypath(&Entry, Root, Dir.c_str());
+  if (error == GIT_ENOTFOUND) {
+    return Lookup::Missing;
+  }
+  checkError(error, "git_tree_entry_bypath");
+  if (git_tree_entry_type(Entry) != GIT_OBJ_TREE) {
+    git_tree_entry_free(Entry);
+    return Lookup::Other;
+  }
+  error = git_tree_lookup(&Raw, Repo, git_tree_entry_id(Entry));
+  git_tree_entry_free(Entry);
+  checkError(error, "git_tree_lookup");
+  Out.reset(Raw);
+  return Lookup::Tree;
+}
+
+std::string parentDir(const std::string &Path) {
+  auto Pos = Path.rfind('/');
+  return Pos == std::string::npos ? "" : Path.substr(0, Pos);
+}
+
+/**
+ * Find the directory to merge for every path of \p Scope: the path itself if
+ * it is a directory (or absent) on all \p Count sides, otherwise its deepest
+ * such parent. Paths that share a directory are merged together.
+ */
+std::vector<ScopeRoot> resolveScope(git_repository *Repo,
+                                    const git_tree *const *Trees,
+                                    size_t Count,
+                                    const std::vector<std::string> &Scope) {
+  std::map<std::string, ScopeRoot> Roots;
+  for (const auto &Path : Scope) {
+    std::string Dir = Path;
+    TreePtr Found[3];
+    for (;;) {
+      bool AllTrees = true;
+      for (size_t I = 0; I < Count && AllTrees; ++I) {
+        Found[I].reset();
+        if (Trees[I]) {
+          AllTrees = subtree(Repo, Trees[I], Dir, Found[I]) != Lookup::Other;
+        }
+      }
+      if (AllTrees || Dir.empty()) {
+        break;
+      }
+      Dir = parentDir(Dir);
+    }
+
+    auto It = Roots.find(Dir);
+    if (It == Roots.end()) {
+      It = Roots.emplace(Dir, ScopeRoot()).first;
+      It->second.Prefix = Dir.empty() ? "" : Dir + "/";
+      for (size_t I = 0; I < Count; ++I) {
+        It->second.Trees[I] = std::move(Found[I]);
+      }
+    }
+    It->second.Paths.push_back(Path);
+  }
+
+  std::vector<ScopeRoot> Result;
+  for (auto &Entry : Roots) {
+    Result.push_back(std::move(Entry.second));
+  }
+  return Result;
+}
+
+bool sameTree(const git_tree *A, const git_tree *B) {
+  if (!A || !B) {
+    return A == B;
+  }
+  return git_oid_equal(git_tree_id(A), git_tree_id(B));
+}
+
+void keepInScope(std::vector<ChangedEntry> &Entries,
+                 const std::vector<std::string> &Scope, size_t From) {
+  Entries.erase(std::remove_if(Entries.begin() + From, Entries.end(),
+                               [&](const ChangedEntry &E) {
+                                 return !touchesScope(E.Path, Scope);
+                               }),
+                Entries.end());
+}
+} // namespace
+
+bool literalScopePath(const std::string &Arg, std::string &Path) {
+  static const std::string LiteralMagic = ":(literal)";
+  if (Arg.compare(0, LiteralMagic.size(), LiteralMagic) == 0) {
+    Path = Arg.substr(LiteralMagic.size());
+    return true;
+  }
+  Path = Arg;
+  return Arg.find_first_of("*?[") == std::string::npos;
+}
+
+std::vector<std::string> normalizeScope(const std::vector<std::string> &Paths) {
+  std::vector<std::string> Normalized;
+  for (auto Path : Paths) {
+    while (Path.compare(0, 2, "./") == 0) {
+      Path.erase(0, 2);
+    }
+    Path.erase(0, Path.find_first_not_of('/'));
+    while (!Path.empty() && Path.back() == '/') {
+      Path.pop_back();
+    }
+    if (Path.empty() || Path == ".") {
+      return {};
+    }
+    Normalized.push_back(Path);
+  }
+
+  // parents sort before their children
+  std::sort(Normalized.begin(), Normalized.end());
+  std::vector<std::string> Scope;
+  for (const auto &Path : Normalized) {
+    if (Scope.empty() || !inScope(Path, Scope)) {
+      Scope.push_back(Path);
+    }
+  }
+  return Scope;
+}
+
+bool inScope(const std::string &Path, const std::vector<std::string> &Scope) {
+  if (Scope.empty()) {
+    return true;
+  }
+  for (const auto &S : Scope) {
+    if (S.empty() || (Path.compare(0, S.size(), S) == 0 &&
+                      (Path.size() == S.size() || Path[S.size()] == '/'))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool touchesScope(const std::string &Path,
+                  const std::vector<std::string> &Scope) {
+  if (inScope(Path, Scope)) {
+    return true;
+  }
+  for (const auto &S : Scope) {
+    if (S.size() > Path.size() && S.compare(0, Path.size(), Path) == 0 &&
+        S[Path.size()] == '/') {
+      return true;
+    }
+  }
+  return false;
+}
+
+void mergeTreesInScope(git_repository *Repo, const git_tree *Base,
+                       const git_tree *Ours, const git_tree *Theirs,
+                       const std::vector<std::string> &Scope,
+                       const git_merge_options &MergeOpts,
+                       std::vector<Conflict> &Conflicts) {
+  int error;
+
+  const git_tree *Trees[] = {Base, Ours, Theirs};
+  for (auto &Root : resolveScope(Repo, Trees, 3, Scope)) {
+    const git_tree *B = Root.Trees[0].get(), *O = Root.Trees[1].get(),
+                   *T = Root.Trees[2].get();
+    // one side is unchanged, so the merge takes the other one
+    if (sameTree(B, O) || sameTree(B, T) || sameTree(O, T)) {
+      continue;
+    }
+
+    git_index *Raw;
+    error = git_merge_trees(&Raw, Repo, B, O, T, &MergeOpts);
+    checkError(error, "git_merge_trees");
+    IndexPtr Index(Raw);
+    if (!git_index_has_conflicts(Index.get())) {
+      continue;
+    }
+
+    git_index_conflict_iterator *ConflictIt;
+    error = git_index_conflict_iterator_new(&ConflictIt, Index.get());
+    checkError(error, "git_index_conflict_iterator_new");
+    IndexConflict C{};
+    while ((error = git_index_conflict_next(&C.Ancestor, &C.Our, &C.Their,
+                                            ConflictIt)) == 0) {
+      Conflict Record = toConflict(C);
+      Record.Path = Root.Prefix + Record.Path;
+      if (inScope(Record.Path, Root.Paths)) {
+        Conflicts.push_back(std::move(Record));
+      }
+    }
+    git_index_conflict_iterator_free(ConflictIt);
+    if (error != GIT_ITEROVER) {
+      checkError(error, "git_index_conflict_next");
+    }
+  }
+}
+
+void changedEntriesInScope(git_repository *Repo, const git_tree *Base,
+                           const git_tree *Ours, const git_tree *Theirs,
+                           const std::vector<std::string> &Scope,
+                           std::vector<ChangedEntry> &OurChanges,
+                           std::vector<ChangedEntry> &TheirChanges) {
+  const git_tree *Trees[] = {Base, Ours, Theirs};
+  for (auto &Root : resolveScope(Repo, Trees, 3, Scope)) {
+    size_t OurFrom = OurChanges.size(), TheirFrom = TheirChanges.size();
+    changedEntries(Repo, Root.Trees[0].get(), Root.Trees[1].get(), OurChanges,
+                   false, Root.Prefix);
+    changedEntries(Repo, Root.Trees[0].get(), Root.Trees[2].get(),
+                   TheirChanges, false, Root.Prefix);
+    keepInScope(OurChanges, Root.Paths, OurFrom);
+    keepInScope(TheirChanges, Root.Paths, TheirFrom);
+  }
+}
@@ -0,0 +1,749 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <git2.h>
+
+#include "mergecheck/merge.hpp"
+#include "mergecheck/path_index.hpp"
+#include "mergecheck/rebase.hpp"
+#include "mergecheck/result_cache.hpp"
+#include "mergecheck/server.hpp"
+#include "mergecheck/thread_pool.hpp"
+#include "mergecheck/utils.hpp"
+
+namespace {
+volatile std::sig_atomic_t StopRequested = 0;
+
+/// Clients sending a longer request line are disconnected.
+const size_t MaxRequestSize = 1 << 20;
+/// Seconds a worker waits for a client to take a response.
+const long SendTimeout = 30;
+
+void handleStopSignal(int /*Signal*/) { StopRequested = 1; }
+
+std::vector<std::string> split(const std::string &S, char Delim) {
+  std::vector<std::string> Fields;
+  std::string::size_type Start = 0;
+  for (;;) {
+    auto End = S.find(Delim, Start);
+    Fields.push_back(S.substr(Start, End - Start));
+    if (End == std::string::npos) {
+      return Fields;
+    }
+    Start = End + 1;
+  }
+}
+
+std::string flagsField(const CheckOptions &Opts, bool UseResultCache,
+                       bool UsePathFilters) {
+  std::vector<std::string> Set;
+  if (Opts.PrintConflicts) {
+    Set.push_back("print-conflicts");
+  }
+  if (Opts.Verbose) {
+    Set.push_back("verbose");
+  }
+  if (UseResultCache) {
+    Set.push_back("result-cache");
+  }
+  if (!Opts.Prefilter) {
+    Set.push_back("no-prefilter");
+  }
+  if (Opts.Cumulative) {
+    Set.push_back("cumulative");
+  }
+  if (!Opts.SquashFirst) {
+    Set.push_back("per-commit");
+  }
+  if (Opts.FirstConflict) {
+    Set.push_back("first-conflict");
+  }
+  if (!UsePathFilters) {
+    Set.push_back("no-path-filters");
+  }
+  std::string Flags;
+  for (const auto &Flag : Set) {
+    Flags += Flags.empty() ? Flag : "," + Flag;
+  }
+  return Flags;
+}
+
+bool sendAll(int Fd, const std::string &Data) {
+  const char *Ptr = Data.data();
+  size_t Left = Data.size();
+  while (Left > 0) {
+    ssize_t Written = ::send(Fd, Ptr, Left, MSG_NOSIGNAL);
+    if (Written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (Written <= 0) {
+      return false;
+    }
+    Ptr += Written;
+    Left -= static_cast<size_t>(Written);
+  }
+  return true;
+}
+
+/**
+ * Buffered reader for newline-terminated lines and fixed-size blocks.
+ */
+class SocketReader {
+public:
+  explicit SocketReader(int Fd) : Fd(Fd) {}
+
+  bool readLine(std::string &Line) {
+    for (;;) {
+      auto Pos = Buffer.find('\n');
+      if (Pos != std::string::npos) {
+        Line = Buffer.substr(0, Pos);
+        Buffer.erase(0, Pos + 1);
+        return true;
+      }
+      if (!fill()) {
+        return false;
+      }
+    }
+  }
+
+  bool readBlock(size_t Size, std::string &Block) {
+    while (Buffer.size() < Size) {
+      if (!fill()) {
+        return false;
+      }
+    }
+    Block = Buffer.substr(0, Size);
+    Buffer.erase(0, Size);
+    return true;
+  }
+
+private:
+  bool fill() {
+    char Chunk[4096];
+    for (;;) {
+      ssize_t Read = ::recv(Fd, Chunk, sizeof(Chunk), 0);
+      if (Read < 0 && errno == EINTR) {
+        continue;
+      }
+      if (Read <= 0) {
+        return false;
+      }
+      Buffer.append(Chunk, static_cast<size_t>(Read));
+      return true;
+    }
+  }
+
+  int Fd;
+  std::string Buffer;
+};
+
+/**
+ * Remove and return the complete lines at the front of \p Buffer.
+ */
+std::vector<std::string> takeLines(std::string &Buffer) {
+  std::vector<std::string> Lines;
+  std::string::size_type Start = 0;
+  for (auto End = Buffer.find('\n'); End != std::string::npos;
+       End = Buffer.find('\n', Start)) {
+    Lines.push_back(Buffer.substr(Start, End - Start));
+    Start = End + 1;
+  }
+  Buffer.erase(0, Start);
+  return Lines;
+}
+
+bool makeSocketAddress(const std::string &SocketPath, sockaddr_un &Addr) {
+  std::memset(&Addr, 0, sizeof(Addr));
+  Addr.sun_family = AF_UNIX;
+  if (SocketPath.size() >= sizeof(Addr.sun_path)) {
+    std::cerr << "Error: Socket path \'" << SocketPath << "\' is too long.\n";
+    return false;
+  }
+  std::strncpy(Addr.sun_path, SocketPath.c_str(), sizeof(Addr.sun_path) - 1);
+  return true;
+}
+
+/**
+ * Make \p SocketPath available for bind(): nothing may exist there except a
+ * stale socket, which is removed. Fails if the path is taken by another file
+ * or by a socket somebody is listening on.
+ */
+bool claimSocketPath(const std::string &SocketPath, const sockaddr_un &Addr) {
+  struct stat Info;
+  if (::lstat(SocketPath.c_str(), &Info) < 0) {
+    if (errno == ENOENT) {
+      return true;
+    }
+    std::cerr << "Error: Could not stat \'" << SocketPath
+              << "\': " << std::strerror(errno) << "\n";
+    return false;
+  }
+  if (!S_ISSOCK(Info.st_mode)) {
+    std::cerr << "Error: \'" << SocketPath
+              << "\' exists and is not a socket.\n";
+    return false;
+  }
+
+  int Fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Fd < 0) {
+    std::cerr << "Error: Could not create socket: " << std::strerror(errno)
+              << "\n";
+    return false;
+  }
+  int Connected = ::connect(Fd, reinterpret_cast<const sockaddr *>(&Addr),
+                            sizeof(Addr));
+  int ConnectError = errno;
+  ::close(Fd);
+  if (Connected == 0) {
+    std::cerr << "Error: A server is already listening on \'" << SocketPath
+              << "\'.\n";
+    return false;
+  }
+  if (ConnectError != ECONNREFUSED) {
+    std::cerr << "Error: Could not check socket \'" << SocketPath
+              << "\': " << std::strerror(ConnectError) << "\n";
+    return false;
+  }
+  if (::unlink(SocketPath.c_str()) < 0) {
+    std::cerr << "Error: Could not remove stale socket \'" << SocketPath
+              << "\': " << std::strerror(errno) << "\n";
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Open repositories, keyed by path. Every repository has one shared object
+ * database and a free list of handles backed by it, so concurrent requests on
+ * the same repository get their own handle but a warm object cache.
+ */
+class RepositoryCache {
+public:
+  RepositoryCache() = default;
+  RepositoryCache(const RepositoryCache &) = delete;
+  RepositoryCache &operator=(const RepositoryCache &) = delete;
+
+  ~RepositoryCache() {
+    for (auto &KV : Entries) {
+      for (auto *Repo : KV.second.Idle) {
+        git_repository_free(Repo);
+      }
+      git_odb_free(KV.second.Odb);
+    }
+  }
+
+  git_repository *acquire(const std::string &Path) {
+    std::lock_guard<std::mutex> Guard(Lock);
+    auto It = Entries.find(Path);
+    if (It == Entries.end()) {
+      ++Misses;
+      git_repository *Repo = nullptr;
+      int error = git_repository_open(&Repo, Path.c_str());
+      checkError(error, "opening repository");
+      git_odb *Odb = nullptr;
+      error = git_repository_odb(&Odb, Repo);
+      if (error) {
+        git_repository_free(Repo);
+      }
+      checkError(error, "git_repository_odb");
+      Entry &E = Entries[Path];
+      E.Odb = Odb;
+      E.GitDir = git_repository_path(Repo);
+      return Repo;
+    }
+
+    ++Hits;
+    Entry &E = It->second;
+    if (!E.Idle.empty()) {
+      git_repository *Repo = E.Idle.back();
+      E.Idle.pop_back();
+      return Repo;
+    }
+    git_repository *Repo = nullptr;
+    int error = git_repository_open(&Repo, Path.c_str());
+    checkError(error, "opening repository");
+    git_repository_set_odb(Repo, E.Odb);
+    return Repo;
+  }
+
+  void release(const std::string &Path, git_repository *Repo) {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Entries[Path].Idle.push_back(Repo);
+  }
+
+  /**
+   * Result cache of an already acquired repository, created on first use.
+   */
+  ResultCache *results(const std::string &Path) {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Entry &E = Entries[Path];
+    if (!E.Results) {
+      E.Results.reset(new ResultCache(E.GitDir));
+    }
+    return E.Results.get();
+  }
+
+  /**
+   * Changed-path filters of an already acquired repository, opened on first
+   * use, or nullptr if it has none.
+   */
+  const PathIndex *pathFilters(const std::string &Path) {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Entry &E = Entries[Path];
+    if (!E.Filters) {
+      E.Filters.reset(new PathIndex(E.GitDir));
+    }
+    return E.Filters->empty() ? nullptr : E.Filters.get();
+  }
+
+  void printStats(std::ostream &O) {
+    std::lock_guard<std::mutex> Guard(Lock);
+    size_t ResultHits = 0, ResultMisses = 0;
+    for (const auto &KV : Entries) {
+      if (KV.second.Results) {
+        ResultHits += KV.second.Results->hits();
+        ResultMisses += KV.second.Results->misses();
+      }
+    }
+    O << "repositories " << Entries.size() << "\n"
+      << "repository_cache_hits " << Hits << "\n"
+      << "repository_cache_misses " << Misses << "\n"
+      << "result_cache_hits " << ResultHits << "\n"
+      << "result_cache_misses " << ResultMisses << "\n";
+  }
+
+private:
+  struct Entry {
+    git_odb *Odb = nullptr;
+    std::string GitDir;
+    std::vector<git_repository *> Idle;
+    std::unique_ptr<ResultCache> Results;
+    std::unique_ptr<PathIndex> Filters;
+  };
+
+  std::mutex Lock;
+  std::map<std::string, Entry> Entries;
+  size_t Hits = 0;
+  size_t Misses = 0;
+};
+
+struct LatencyStats {
+  size_t Requests = 0;
+  size_t Errors = 0;
+  double TotalMs = 0;
+  double MaxMs = 0;
+};
+
+class Server {
+public:
+  explicit Server(bool Verbose) : Verbose(Verbose) {}
+
+  RepositoryCache &repositories() { return Repos; }
+
+  /**
+   * Answer the request \p Lines of the client \p Fd in order. Returns false
+   * if the client is gone.
+   */
+  bool answer(int Fd, const std::vector<std::string> &Lines) {
+    for (const auto &Line : Lines) {
+      if (!sendAll(Fd, handleRequest(Line))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  std::string handleRequest(const std::string &Line) {
+    auto Start = std::chrono::steady_clock::now();
+    std::vector<std::string> Fields = split(Line, '\t');
+    const std::string &Command = Fields[0];
+
+    std::ostringstream Body;
+    std::ostringstream Header;
+    bool Failed = false;
+    size_t Conflicts = 0;
+
+    if (Command == "stats") {
+      printStats(Body);
+      Header << "OK 0 " << Body.str().size() << "\n";
+      return Header.str() + Body.str();
+    }
+
+    try {
+      if (Command == "merge" && Fields.size() == 5) {
+        CheckOptions Opts;
+        bool UseResultCache = false, UsePathFilters = true;
+        parseFlags(Fields[4], Opts, UseResultCache, UsePathFilters);
+        git_repository *Repo = Repos.acquire(Fields[1]);
+        if (UseResultCache) {
+          Opts.Cache = Repos.results(Fields[1]);
+        }
+        if (UsePathFilters) {
+          Opts.PathFilters = Repos.pathFilters(Fields[1]);
+        }
+        try {
+          Conflicts = merge(Repo, Fields[2], Fields[3], Opts, Body);
+        } catch (...) {
+          Repos.release(Fields[1], Repo);
+          throw;
+        }
+        Repos.release(Fields[1], Repo);
+      } else if (Command == "rebase" && Fields.size() == 6) {
+        CheckOptions Opts;
+        bool UseResultCache = false, UsePathFilters = true;
+        parseFlags(Fields[5], Opts, UseResultCache, UsePathFilters);
+        git_repository *Repo = Repos.acquire(Fields[1]);
+        if (UsePathFilters) {
+          Opts.PathFilters = Repos.pathFilters(Fields[1]);
+        }
+        try {
+          Conflicts = rebase(Repo, Fields[2], Fields[3], Fields[4], Opts, Body);
+        } catch (...) {
+          Repos.release(Fields[1], Repo);
+          throw;
+        }
+        Repos.release(Fields[1], Repo);
+      } else {
+        Body.str("Error: Malformed request.\n");
+        Failed = true;
+      }
+    } catch (const GitError &Ex) {
+      Body.str(std::string(Ex.what()) + "\n");
+      Failed = true;
+    } catch (const std::exception &Ex) {
+      Body.str("Error: " + std::string(Ex.what()) + "\n");
+      Failed = true;
+    }
+
+    double Ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - Start)
+                    .count();
+    record(Command, Ms, Failed);
+    if (Verbose) {
+      std::ostringstream Log;
+      Log << Command << " " << (Failed ? "failed" : "done") << " in " << Ms
+          << " ms\n";
+      std::cout << Log.str() << std::flush;
+    }
+
+    if (Failed) {
+      Header << "ERR " << Body.str().size() << "\n";
+    } else {
+      Header << "OK " << Conflicts << " " << Body.str().size() << "\n";
+    }
+    return Header.str() + Body.str();
+  }
+
+  static void parseFlags(const std::string &Field, CheckOptions &Opts,
+                         bool &UseResultCache, bool &UsePathFilters) {
+    for (const auto &Flag : split(Field, ',')) {
+      if (Flag == "print-conflicts") {
+        Opts.PrintConflicts = true;
+      } else if (Flag == "verbose") {
+        Opts.Verbose = true;
+      } else if (Flag == "result-cache") {
+        UseResultCache = true;
+      } else if (Flag == "no-prefilter") {
+        Opts.Prefilter = false;
+      } else if (Flag == "cumulative") {
+        Opts.Cumulative = true;
+      } else if (Flag == "per-commit") {
+        Opts.SquashFirst = false;
+      } else if (Flag == "first-conflict") {
+        Opts.FirstConflict = true;
+      } else if (Flag == "no-path-filters") {
+        UsePathFilters = false;
+      }
+    }
+  }
+
+  void record(const std::string &Command, double Ms, bool Failed) {
+    std::lock_guard<std::mutex> Guard(StatsLock);
+    LatencyStats &S = Stats[Command];
+    S.Requests++;
+    S.Errors += Failed ? 1 : 0;
+    S.TotalMs += Ms;
+    S.MaxMs = std::max(S.MaxMs, Ms);
+  }
+
+  void printStats(std::ostream &O) {
+    Repos.printStats(O);
+    ssize_t CachedBytes = 0, CacheLimit = 0;
+    git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &CachedBytes, &CacheLimit);
+    O << "object_cache_bytes " << CachedBytes << "\n"
+      << "object_cache_limit " << CacheLimit << "\n";
+
+    std::lock_guard<std::mutex> Guard(StatsLock);
+    for (const auto &KV : Stats) {
+      const LatencyStats &S = KV.second;
+      O << KV.first << "_requests " << S.Requests << "\n"
+        << KV.first << "_errors " << S.Errors << "\n"
+        << KV.first << "_latency_avg_ms "
+        << (S.Requests ? S.TotalMs / S.Requests : 0.0) << "\n"
+        << KV.first << "_latency_max_ms " << S.MaxMs << "\n";
+    }
+  }
+
+  bool Verbose;
+  RepositoryCache Repos;
+  std::mutex StatsLock;
+  std::map<std::string, LatencyStats> Stats;
+};
+} // namespace
+
+std::string mergeRequest(const std::string &RepoPath,
+                         const std::string &OurBranch,
+                         const std::string &TheirBranch,
+                         const CheckOptions &Opts, bool UseResultCache,
+                         bool UsePathFilters) {
+  return "merge\t" + RepoPath + "\t" + OurBranch + "\t" + TheirBranch + "\t" +
+         flagsField(Opts, UseResultCache, UsePathFilters);
+}
+
+std::string rebaseRequest(const std::string &RepoPath,
+                          const std::string &UpstreamBranch,
+                          const std::string &Branch, const std::string &Onto,
+                          const CheckOptions &Opts, bool UsePathFilters) {
+  return "rebase\t" + RepoPath + "\t" + UpstreamBranch + "\t" + Branch + "\t" +
+         Onto + "\t" + flagsField(Opts, false, UsePathFilters);
+}
+
+int serve(const std::string &RepoPath, const std::string &SocketPath,
+          unsigned Jobs, bool Verbose) {
+  sockaddr_un Addr{};
+  if (!makeSocketAddress(SocketPath, Addr)) {
+    return EXIT_FAILURE;
+  }
+
+  Server S(Verbose);
+  // open the main repository eagerly, so the first request is already warm
+  S.repositories().release(RepoPath, S.repositories().acquire(RepoPath));
+
+  if (!claimSocketPath(SocketPath, Addr)) {
+    return EXIT_FAILURE;
+  }
+  int ListenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (ListenFd < 0) {
+    std::cerr << "Error: Could not create socket: " << std::strerror(errno)
+              << "\n";
+    return EXIT_FAILURE;
+  }
+  if (::bind(ListenFd, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr)) <
+          0 ||
+      ::listen(ListenFd, SOMAXCONN) < 0) {
+    std::cerr << "Error: Could not listen on \'" << SocketPath
+              << "\': " << std::strerror(errno) << "\n";
+    ::close(ListenFd);
+    return EXIT_FAILURE;
+  }
+
+  // workers report finished requests through this pipe to wake up poll()
+  int WakeFds[2];
+  if (::pipe(WakeFds) < 0) {
+    std::cerr << "Error: Could not create pipe: " << std::strerror(errno)
+              << "\n";
+    ::close(ListenFd);
+    ::unlink(SocketPath.c_str());
+    return EXIT_FAILURE;
+  }
+  ::fcntl(WakeFds[0], F_SETFL, O_NONBLOCK);
+  ::fcntl(WakeFds[1], F_SETFL, O_NONBLOCK);
+
+  std::signal(SIGINT, handleStopSignal);
+  std::signal(SIGTERM, handleStopSignal);
+
+  // Connections are only polled while none of their requests is handled, so
+  // an idle client never occupies a worker. Each connection is touched by at
+  // most one thread at a time: the accept loop or the worker answering it.
+  struct Connection {
+    std::string Buffer;
+    bool Busy = false;
+  };
+  std::map<int, Connection> Clients;
+  std::mutex FinishedLock;
+  // (client, still connected) of the requests answered since the last poll
+  std::vector<std::pair<int, bool>> Finished;
+
+  {
+    ThreadPool Pool(Jobs);
+    if (Verbose) {
+      std::cout << "Listening on \'" << SocketPath << "\' with "
+                << Pool.size() << " workers..." << std::endl;
+    }
+
+    auto dispatch = [&](int Fd, Connection &C) {
+      std::vector<std::string> Lines = takeLines(C.Buffer);
+      if (Lines.empty()) {
+        return;
+      }
+      C.Busy = true;
+      Pool.submit([&, Fd, Lines](unsigned) {
+        // a response that cannot be produced or sent drops the client
+        bool Open = false;
+        try {
+          Open = S.answer(Fd, Lines);
+        } catch (...) {
+        }
+        {
+          std::lock_guard<std::mutex> Guard(FinishedLock);
+          Finished.emplace_back(Fd, Open);
+        }
+        char Wake = 0;
+        ssize_t Written = ::write(WakeFds[1], &Wake, 1);
+        (void)Written;
+      });
+    };
+    auto disconnect = [&Clients](int Fd) {
+      ::close(Fd);
+      Clients.erase(Fd);
+    };
+
+    while (!StopRequested) {
+      std::vector<pollfd> Fds{{ListenFd, POLLIN, 0}, {WakeFds[0], POLLIN, 0}};
+      for (const auto &KV : Clients) {
+        if (!KV.second.Busy) {
+          Fds.push_back({KV.first, POLLIN, 0});
+        }
+      }
+      int Ready = ::poll(Fds.data(), Fds.size(), 250);
+      if (Ready <= 0) {
+        continue;
+      }
+
+      if (Fds[1].revents & POLLIN) {
+        char Drain[256];
+        while (::read(WakeFds[0], Drain, sizeof(Drain)) > 0) {
+        }
+        std::vector<std::pair<int, bool>> Done;
+        {
+          std::lock_guard<std::mutex> Guard(FinishedLock);
+          Done.swap(Finished);
+        }
+        for (const auto &D : Done) {
+          if (!D.second) {
+            disconnect(D.first);
+            continue;
+          }
+          Connection &C = Clients[D.first];
+          C.Busy = false;
+          // pipelined requests that arrived with the previous ones
+          dispatch(D.first, C);
+        }
+      }
+
+      for (size_t I = 2; I < Fds.size(); ++I) {
+        if (Fds[I].revents == 0) {
+          continue;
+        }
+        int Fd = Fds[I].fd;
+        char Chunk[4096];
+        ssize_t Read = ::recv(Fd, Chunk, sizeof(Chunk), MSG_DONTWAIT);
+        if (Read < 0 && (errno == EINTR || errno == EAGAIN ||
+                         errno == EWOULDBLOCK)) {
+          continue;
+        }
+        Connection &C = Clients[Fd];
+        if (Read <= 0 ||
+            C.Buffer.size() + static_cast<size_t>(Read) > MaxRequestSize) {
+          disconnect(Fd);
+          continue;
+        }
+        C.Buffer.append(Chunk, static_cast<size_t>(Read));
+        dispatch(Fd, C);
+      }
+
+      if (Fds[0].revents & POLLIN) {
+        int ClientFd = ::accept(ListenFd, nullptr, nullptr);
+        if (ClientFd >= 0) {
+          timeval Timeout{SendTimeout, 0};
+          ::setsockopt(ClientFd, SOL_SOCKET, SO_SNDTIMEO, &Timeout,
+                       sizeof(Timeout));
+          Clients[ClientFd];
+        }
+      }
+    }
+
+    if (Verbose) {
+      std::cout << "Shutting down..." << std::endl;
+    }
+    ::close(ListenFd);
+    ::unlink(SocketPath.c_str());
+    // idle clients are dropped right away; requests in progress are finished
+    for (auto It = Clients.begin(); It != Clients.end();) {
+      if (It->second.Busy) {
+        ++It;
+      } else {
+        ::close(It->first);
+        It = Clients.erase(It);
+      }
+    }
+    Pool.wait();
+  }
+
+  for (const auto &KV : Clients) {
+    ::close(KV.first);
+  }
+  ::close(WakeFds[0]);
+  ::close(WakeFds[1]);
+  return EXIT_SUCCESS;
+}
+
+ForwardStatus forwardRequest(const std::string &SocketPath,
+                             const std::string &Request, std::ostream &O,
+                             size_t &Conflicts) {
+  sockaddr_un Addr{};
+  if (!makeSocketAddress(SocketPath, Addr)) {
+    return ForwardStatus::NoServer;
+  }
+
+  int Fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Fd < 0) {
+    return ForwardStatus::NoServer;
+  }
+  if (::connect(Fd, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr)) < 0) {
+    ::close(Fd);
+    return ForwardStatus::NoServer;
+  }
+
+  ForwardStatus Status = ForwardStatus::Failed;
+  SocketReader Reader(Fd);
+  std::string Header, Body;
+  if (sendAll(Fd, Request + "\n") && Reader.readLine(Header)) {
+    std::istringstream HeaderStream(Header);
+    std::string Kind;
+    size_t Length = 0;
+    HeaderStream >> Kind;
+    if (Kind == "OK" && HeaderStream >> Conflicts >> Length &&
+        Reader.readBlock(Length, Body)) {
+      O << Body;
+      Status = ForwardStatus::Ok;
+    } else if (Kind == "ERR" && HeaderStream >> Length &&
+               Reader.readBlock(Length, Body)) {
+      std::cerr << Body;
+    } else {
+      std::cerr << "Error: Malformed response from server.\n";
+    }
+  } else {
+    std::cerr << "Error: Lost connection to server.\n";
+  }
+
+  ::close(Fd);
+  return Status;
+}
@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include "mergecheck/deadline.hpp"
+#include "mergecheck/handles.hpp"
+#include "mergecheck/inmemory_repo.hpp"
+#include "mergecheck/sharded_merge.hpp"
+#include "mergecheck/thread_pool.hpp"
+#include "mergecheck/utils.hpp"
+#include "mergecheck/worker_repos.hpp"
+
+namespace {
+bool isTree(const git_tree_entry *E) {
+  return E && git_tree_entry_type(E) == GIT_OBJ_TREE;
+}
+
+bool sameEntry(const git_tree_entry *A, const git_tree_entry *B) {
+  if (!A || !B) {
+    return A == B;
+  }
+  return git_oid_equal(git_tree_entry_id(A), git_tree_entry_id(B)) &&
+         git_tree_entry_filemode(A) == git_tree_entry_filemode(B);
+}
+
+/**
+ * Subtrees merged by one worker, on the sides that are present. The root shard
+ * has an empty prefix and the root trees of its in-memory repository.
+ */
+struct Shard {
+  std::string Prefix;
+  git_oid Ids[3];
+  bool Present[3];
+  std::vector<Conflict> Conflicts;
+  std::string Error;
+  /// false if the shard was skipped or stopped at the deadline
+  bool Done = false;
+};
+
+TreePtr lookupTree(git_repository *Repo, const git_oid &Id) {
+  git_tree *Raw;
+  int error = git_tree_lookup(&Raw, Repo, &Id);
+  checkError(error, "git_tree_lookup");
+  return TreePtr(Raw);
+}
+
+void mergeShard(git_repository *Repo, const git_merge_options &MergeOpts,
+                Shard &S) {
+  int error;
+
+  TreePtr Trees[3];
+  for (size_t Side = 0; Side < 3; ++Side) {
+    if (S.Present[Side]) {
+      Trees[Side] = lookupTree(Repo, S.Ids[Side]);
+    }
+  }
+  git_index *Raw;
+  error = git_merge_trees(&Raw, Repo, Trees[0].get(), Trees[1].get(),
+                          Trees[2].get(), &MergeOpts);
+  checkError(error, "git_merge_trees");
+  IndexPtr Index(Raw);
+  if (!git_index_has_conflicts(Index.get())) {
+    return;
+  }
+
+  git_index_conflict_iterator *ConflictIt;
+  error = git_index_conflict_iterator_new(&ConflictIt, Index.get());
+  checkError(error, "git_index_conflict_iterator_new");
+  IndexConflict C{};
+  while ((error = git_index_conflict_next(&C.Ancestor, &C.Our, &C.Their,
+                                          ConflictIt)) == 0) {
+    Conflict Record = toConflict(C);
+    Record.Path = S.Prefix + Record.Path;
+    S.Conflicts.push_back(std::move(Record));
+  }
+  git_index_conflict_iterator_free(ConflictIt);
+  if (error != GIT_ITEROVER) {
+    checkError(error, "git_index_conflict_next");
+  }
+}
+
+/**
+ * Write a tree with the entries \p Names of \p Tree (those it has) to the
+ * object database of \p Repo.
+ */
+git_oid writeSubset(git_repository *Repo, const git_tree *Tree,
+                    const std::vector<std::string> &Names) {
+  int error;
+
+  git_treebuilder *Builder;
+  error = git_treebuilder_new(&Builder, Repo, nullptr);
+  checkError(error, "git_treebuilder_new");
+  for (const auto &Name : Names) {
+    const git_tree_entry *E = git_tree_entry_byname(Tree, Name.c_str());
+    if (!E) {
+      continue;
+    }
+    error = git_treebuilder_insert(nullptr, Builder, Name.c_str(),
+                                   git_tree_entry_id(E),
+                                   git_tree_entry_filemode(E));
+    if (error) {
+      git_treebuilder_free(Builder);
+    }
+    checkError(error, "git_treebuilder_insert");
+  }
+  git_oid Id;
+  error = git_treebuilder_write(&Id, Builder);
+  git_treebuilder_free(Builder);
+  checkError(error, "git_treebuilder_write");
+  return Id;
+}
+} // namespace
+
+bool mergeTreesSharded(git_repository *Repo, const git_tree *Base,
+                       const git_tree *Ours, const git_tree *Theirs,
+                       const git_merge_options &MergeOpts, unsigned Jobs,
+                       std::vector<Conflict> &Conflicts, size_t &Shards,
+                       const Deadline *Limit) {
+  Shards = 0;
+  if (MergeOpts.flags & GIT_MERGE_FIND_RENAMES) {
+    return false;
+  }
+
+  // visit every top-level name once, from the first side that has it
+  const git_tree *Trees[] = {Base, Ours, Theirs};
+  std::vector<Shard> Work;
+  std::vector<std::string> RootNames, Changed;
+  std::vector<bool> RootHasTree;
+  for (size_t Side = 0; Side < 3; ++Side) {
+    size_t Count = Trees[Side] ? git_tree_entrycount(Trees[Side]) : 0;
+    for (size_t I = 0; I < Count; ++I) {
+      const char *Name =
+          git_tree_entry_name(git_tree_entry_byindex(Trees[Side], I));
+      bool Seen = false;
+      for (size_t Earlier = 0; Earlier < Side && !Seen; ++Earlier) {
+        Seen = Trees[Earlier] &&
+               git_tree_entry_byname(Trees[Earlier], Name) != nullptr;
+      }
+      if (Seen) {
+        continue;
+      }
+
+      const git_tree_entry *E[3];
+      for (size_t K = 0; K < 3; ++K) {
+        E[K] = Trees[K] ? git_tree_entry_byname(Trees[K], Name) : nullptr;
+      }
+      if (sameEntry(E[0], E[1]) && sameEntry(E[0], E[2])) {
+        continue;
+      }
+      bool Trivial = sameEntry(E[0], E[1]) || sameEntry(E[0], E[2]) ||
+                     sameEntry(E[1], E[2]);
+      bool AllTrees = (!E[0] || isTree(E[0])) && (!E[1] || isTree(E[1])) &&
+                      (!E[2] || isTree(E[2]));
+      if (!Trivial && !AllTrees) {
+        RootNames.push_back(Name);
+        RootHasTree.push_back(isTree(E[0]) || isTree(E[1]) || isTree(E[2]));
+        continue;
+      }
+      Changed.push_back(Name);
+      if (Trivial) {
+        continue;
+      }
+      Work.emplace_back();
+      Shard &S = Work.back();
+      S.Prefix = std::string(Name) + "/";
+      for (size_t K = 0; K < 3; ++K) {
+        S.Present[K] = E[K] != nullptr;
+        if (E[K]) {
+          git_oid_cpy(&S.Ids[K], git_tree_entry_id(E[K]));
+        }
+      }
+    }
+  }
+
+  // libgit2 only flags a file "a" and the paths below "a/" as a
+  // directory/file conflict if no other changed path sorts between them
+  for (size_t I = 0; I < RootNames.size(); ++I) {
+    if (!RootHasTree[I]) {
+      continue;
+    }
+    const std::string &Name = RootNames[I];
+    for (const auto &Other : Changed) {
+      if (Other > Name && Other < Name + "/") {
+        return false;
+      }
+    }
+  }
+
+  std::unique_ptr<InMemoryRepository> Scratch;
+  if (!RootNames.empty()) {
+    Scratch.reset(new InMemoryRepository(Repo));
+    Work.emplace_back();
+    Shard &Root = Work.back();
+    for (size_t K = 0; K < 3; ++K) {
+      Root.Present[K] = Trees[K] != nullptr;
+      if (Trees[K]) {
+        Root.Ids[K] = writeSubset(Scratch->get(), Trees[K], RootNames);
+      }
+    }
+  }
+  Shards = Work.size();
+
+  ThreadPool Pool(Jobs);
+  WorkerRepositories WorkerRepos(Repo, git_repository_path(Repo), Pool.size());
+  for (size_t I = 0; I < Work.size(); ++I) {
+    // only the root shard has an empty prefix; it reads the written trees
+    bool IsRoot = Work[I].Prefix.empty();
+    Pool.submit([&, I, IsRoot](unsigned Worker) {
+      if (Limit && Limit->expired()) {
+        return;
+      }
+      try {
+        mergeShard(IsRoot ? Scratch->get() : WorkerRepos[Worker], MergeOpts,
+                   Work[I]);
+        Work[I].Done = true;
+      } catch (const GitError &Ex) {
+        if (!stoppedAt(Ex, Limit)) {
+          Work[I].Error = Ex.what();
+        }
+      }
+    });
+  }
+  Pool.wait();
+
+  // the conflicts of the finished shards are kept if others timed out
+  bool TimedOut = false;
+  size_t First = Conflicts.size();
+  for (auto &S : Work) {
+    if (!S.Error.empty()) {
+      throw GitError(GIT_ERROR, S.Error);
+    }
+    if (!S.Done) {
+      TimedOut = true;
+      continue;
+    }
+    std::move(S.Conflicts.begin(), S.Conflicts.end(),
+              std::back_inserter(Conflicts));
+  }
+  // in index order, like the conflicts of a single merge
+  std::sort(
+      Conflicts.begin() + First, Conflicts.end(),
+      [](const Conflict &A, const Conflict &B) { return A.Path < B.Path; });
+  if (TimedOut) {
+    throw DeadlineExceeded("sharded merge");
+  }
+  return true;
+}
@@ -0,0 +1,387 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <tuple>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mergecheck/changed_paths.hpp"
+#include "mergecheck/handles.hpp"
+#include "mergecheck/merge.hpp"
+#include "mergecheck/refs.hpp"
+#include "mergecheck/scope.hpp"
+#include "mergecheck/status.hpp"
+#include "mergecheck/utils.hpp"
+
+namespace {
+/**
+ * Everything remembered about one (target, branch) pair.
+ */
+struct PairState {
+  git_oid TargetTip{};
+  git_oid BranchTip{};
+  git_oid Base{};
+  bool HasBase = false;
+  size_t Conflicts = 0;
+  std::vector<std::string> TargetPaths;
+  std::vector<std::string> BranchPaths;
+};
+
+/// (target, branch, options variant)
+using PairKey = std::tuple<std::string, std::string, std::string>;
+using StatusState = std::map<PairKey, PairState>;
+
+/// First line of a state file in the current format.
+const char *const StateHeader = "mergecheck status 2";
+
+/**
+ * The options that change the result of a check, so that results computed
+ * with different options are kept apart (like MergeKey::Variant).
+ */
+std::string optionsVariant(const CheckOptions &Opts) {
+  std::ostringstream V;
+  V << "renames=" << static_cast<unsigned>(Opts.Renames)
+    << ",threshold=" << Opts.RenameThreshold << ",limit=" << Opts.RenameLimit
+    << ",tree-only=" << Opts.TreeOnly
+    << ",confirm=" << (Opts.TreeOnly && Opts.Confirm);
+  for (const auto &Path : normalizeScope(Opts.Paths)) {
+    V << ",path:" << Path.size() << ":" << Path;
+  }
+  return V.str();
+}
+
+std::string escapePath(const std::string &Path) {
+  std::string Out;
+  for (char C : Path) {
+    if (C == '\\') {
+      Out += "\\\\";
+    } else if (C == '\n') {
+      Out += "\\n";
+    } else if (C == '\t') {
+      Out += "\\t";
+    } else {
+      Out += C;
+    }
+  }
+  return Out;
+}
+
+std::string unescapePath(const std::string &Line) {
+  std::string Out;
+  for (size_t I = 0; I < Line.size(); ++I) {
+    if (Line[I] == '\\' && I + 1 < Line.size()) {
+      ++I;
+      Out += Line[I] == 'n' ? '\n' : Line[I] == 't' ? '\t' : Line[I];
+    } else {
+      Out += Line[I];
+    }
+  }
+  return Out;
+}
+
+/*
+ * The state file starts with StateHeader, followed by records of the form
+ *
+ *   pair <target> <branch> <variant> <target tip> <branch tip> <base|->
+ *        <conflicts> <#target paths> <#branch paths>
+ *   <target path>...
+ *   <branch path>...
+ *
+ * with tab-separated fields on the first line and one escaped path per line.
+ */
+StatusState loadState(const std::string &Path) {
+  StatusState State;
+  std::ifstream In(Path);
+  std::string Line;
+  if (!std::getline(In, Line) || Line != StateHeader) {
+    // missing or older state is simply recomputed
+    return State;
+  }
+  while (std::getline(In, Line)) {
+    std::istringstream Fields(Line);
+    std::string Tag, Target, Branch, Variant, TargetTip, BranchTip, Base;
+    PairState S;
+    size_t TargetCount = 0, BranchCount = 0;
+    if (!std::getline(Fields, Tag, '\t') || Tag != "pair" ||
+        !std::getline(Fields, Target, '\t') ||
+        !std::getline(Fields, Branch, '\t') ||
+        !std::getline(Fields, Variant, '\t') ||
+        !std::getline(Fields, TargetTip, '\t') ||
+        !std::getline(Fields, BranchTip, '\t') ||
+        !std::getline(Fields, Base, '\t') ||
+        !(Fields >> S.Conflicts >> TargetCount >> BranchCount) ||
+        git_oid_fromstr(&S.TargetTip, TargetTip.c_str()) ||
+        git_oid_fromstr(&S.BranchTip, BranchTip.c_str())) {
+      // unreadable state is simply recomputed
+      return StatusState();
+    }
+    S.HasBase = Base != "-";
+    if (S.HasBase && git_oid_fromstr(&S.Base, Base.c_str())) {
+      return StatusState();
+    }
+    for (size_t I = 0; I < TargetCount + BranchCount; ++I) {
+      if (!std::getline(In, Line)) {
+        return StatusState();
+      }
+      (I < TargetCount ? S.TargetPaths : S.BranchPaths)
+          .push_back(unescapePath(Line));
+    }
+    State[PairKey(Target, Branch, unescapePath(Variant))] = std::move(S);
+  }
+  return State;
+}
+
+/**
+ * Store the pairs in \p Changed to the state file \p Path. Concurrent runs
+ * are serialized through a lock file, and the pairs they stored in the
+ * meantime are kept.
+ */
+void saveState(const std::string &Path, const StatusState &Changed) {
+  FileLock WriteLock(Path + ".lock");
+  if (!WriteLock.locked()) {
+    std::cerr << "Warning: Could not lock \'" << Path << "\'.\n";
+    return;
+  }
+  StatusState State = loadState(Path);
+  for (const auto &KV : Changed) {
+    State[KV.first] = KV.second;
+  }
+
+  std::ostringstream Out;
+  Out << StateHeader << "\n";
+  for (const auto &KV : State) {
+    const PairState &S = KV.second;
+    Out << "pair\t" << std::get<0>(KV.first) << "\t" << std::get<1>(KV.first)
+        << "\t" << escapePath(std::get<2>(KV.first)) << "\t"
+        << oidString(S.TargetTip) << "\t" << oidString(S.BranchTip) << "\t"
+        << (S.HasBase ? oidString(S.Base) : "-") << "\t" << S.Conflicts
+        << "\t" << S.TargetPaths.size() << "\t" << S.BranchPaths.size()
+        << "\n";
+    for (const auto &P : S.TargetPaths) {
+      Out << escapePath(P) << "\n";
+    }
+    for (const auto &P : S.BranchPaths) {
+      Out << escapePath(P) << "\n";
+    }
+  }
+
+  std::string TempPath = Path + ".XXXXXX";
+  int Fd = ::mkstemp(&TempPath[0]);
+  if (Fd < 0) {
+    std::cerr << "Warning: Could not create a temporary file for \'" << Path
+              << "\'.\n";
+    return;
+  }
+  ::fchmod(Fd, 0644);
+  bool Written = writeAll(Fd, Out.str());
+  Written = ::close(Fd) == 0 && Written;
+  if (!Written || ::rename(TempPath.c_str(), Path.c_str()) < 0) {
+    std::cerr << "Warning: Could not write \'" << Path << "\'.\n";
+    ::unlink(TempPath.c_str());
+  }
+}
+
+TreePtr commitTree(git_repository *Repo, const git_oid &Id) {
+  int error;
+
+  git_commit *Raw;
+  error = git_commit_lookup(&Raw, Repo, &Id);
+  checkError(error, "git_commit_lookup");
+  CommitPtr Commit(Raw);
+  git_tree *Tree;
+  error = git_commit_tree(&Tree, Commit.get());
+  checkError(error, "git_commit_tree");
+  return TreePtr(Tree);
+}
+
+/**
+ * Whether \p Path refers to the same entry (or to no entry) in both trees.
+ */
+bool sameEntry(const git_tree *A, const git_tree *B, const std::string &Path) {
+  git_tree_entry *EntryA = nullptr, *EntryB = nullptr;
+  if (A) {
+    git_tree_entry_bypath(&EntryA, A, Path.c_str());
+  }
+  git_tree_entry_bypath(&EntryB, B, Path.c_str());
+
+  bool Same;
+  if (EntryA == nullptr || EntryB == nullptr) {
+    Same = EntryA == EntryB;
+  } else {
+    Same = git_oid_equal(git_tree_entry_id(EntryA),
+                         git_tree_entry_id(EntryB)) &&
+           git_tree_entry_filemode(EntryA) == git_tree_entry_filemode(EntryB);
+  }
+  git_tree_entry_free(EntryA);
+  git_tree_entry_free(EntryB);
+  return Same;
+}
+
+/**
+ * \p Paths holds the paths changed between \p BaseTree and \p OldTip. Update
+ * it to the paths changed between \p BaseTree and \p NewTip by only diffing
+ * the two tips and re-checking the paths that differ between them.
+ */
+void updateChangedPaths(git_repository *Repo, const git_tree *BaseTree,
+                        const git_oid &OldTip, const git_oid &NewTip,
+                        std::vector<std::string> &Paths) {
+  TreePtr OldTree = commitTree(Repo, OldTip);
+  TreePtr NewTree = commitTree(Repo, NewTip);
+
+  std::vector<std::string> Delta;
+  changedPaths(Repo, OldTree.get(), NewTree.get(), Delta, true);
+
+  std::set<std::string> Updated(Paths.begin(), Paths.end());
+  for (const auto &Path : Delta) {
+    if (sameEntry(BaseTree, NewTree.get(), Path)) {
+      Updated.erase(Path);
+    } else {
+      Updated.insert(Path);
+    }
+  }
+  Paths.assign(Updated.begin(), Updated.end());
+}
+
+/**
+ * Paths changed between \p BaseTree and \p Tip.
+ */
+std::vector<std::string> changedSince(git_repository *Repo,
+                                      const git_tree *BaseTree,
+                                      const git_oid &Tip) {
+  TreePtr TipTree = commitTree(Repo, Tip);
+  std::vector<std::string> Paths;
+  changedPaths(Repo, BaseTree, TipTree.get(), Paths, true);
+  std::sort(Paths.begin(), Paths.end());
+  return Paths;
+}
+} // namespace
+
+size_t status(git_repository *Repo, const std::string &Target,
+              const std::vector<std::string> &Branches,
+              const CheckOptions &Opts) {
+  int error;
+
+  std::string Dir = std::string(git_repository_path(Repo)) + "mergecheck";
+  ::mkdir(Dir.c_str(), 0755);
+  std::string StatePath = Dir + "/status";
+  StatusState State = loadState(StatePath);
+
+  git_oid TargetTip;
+  {
+    CommitPtr TargetCommit(lookupCommit(Repo, Target));
+    git_oid_cpy(&TargetTip, git_commit_id(TargetCommit.get()));
+  }
+
+  // the changed-path sets already serve as prefilter
+  CheckOptions MergeOpts = Opts;
+  MergeOpts.Prefilter = false;
+
+  std::string Variant = optionsVariant(Opts);
+  StatusState Changed;
+  size_t Total = 0, Reused = 0, Incremental = 0, Recomputed = 0;
+  for (const auto &Branch : Branches) {
+    git_oid BranchTip;
+    {
+      CommitPtr BranchCommit(lookupCommit(Repo, Branch));
+      git_oid_cpy(&BranchTip, git_commit_id(BranchCommit.get()));
+    }
+
+    PairKey Key(Target, Branch, Variant);
+    auto It = State.find(Key);
+    bool Known = It != State.end();
+    PairState &S = State[Key];
+
+    if (Known && git_oid_equal(&S.TargetTip, &TargetTip) &&
+        git_oid_equal(&S.BranchTip, &BranchTip)) {
+      ++Reused;
+      std::cout << Branch << ": " << S.Conflicts << " conflicts";
+      if (Opts.Verbose) {
+        std::cout << " (unchanged)";
+      }
+      std::cout << "\n";
+      Total += S.Conflicts;
+      continue;
+    }
+
+    // merge base of the new tips
+    git_oidarray Bases{};
+    bool HasBase = true;
+    error = git_merge_bases(&Bases, Repo, &TargetTip, &BranchTip);
+    if (error == GIT_ENOTFOUND) {
+      HasBase = false;
+    } else {
+      checkError(error, "git_merge_bases");
+    }
+    bool MultipleBases = HasBase && Bases.count > 1;
+    git_oid Base{};
+    if (HasBase) {
+      git_oid_cpy(&Base, &Bases.ids[0]);
+      git_oidarray_free(&Bases);
+    }
+    TreePtr BaseTree;
+    if (HasBase) {
+      BaseTree = commitTree(Repo, Base);
+    }
+
+    bool SameBase = Known && S.HasBase == HasBase &&
+                    (!HasBase || git_oid_equal(&S.Base, &Base));
+    bool Updated = false;
+    if (SameBase) {
+      // only the commits between the old and the new tips need to be looked
+      // at; fall back to a full diff if the old tips are gone
+      try {
+        if (!git_oid_equal(&S.TargetTip, &TargetTip)) {
+          updateChangedPaths(Repo, BaseTree.get(), S.TargetTip, TargetTip,
+                             S.TargetPaths);
+        }
+        if (!git_oid_equal(&S.BranchTip, &BranchTip)) {
+          updateChangedPaths(Repo, BaseTree.get(), S.BranchTip, BranchTip,
+                             S.BranchPaths);
+        }
+        Updated = true;
+      } catch (const GitError &) {
+      }
+    }
+    if (Updated) {
+      ++Incremental;
+    } else {
+      ++Recomputed;
+      S.TargetPaths = changedSince(Repo, BaseTree.get(), TargetTip);
+      S.BranchPaths = changedSince(Repo, BaseTree.get(), BranchTip);
+    }
+    BaseTree.reset();
+
+    S.TargetTip = TargetTip;
+    S.BranchTip = BranchTip;
+    S.Base = Base;
+    S.HasBase = HasBase;
+    if (MultipleBases || pathsOverlap(S.TargetPaths, S.BranchPaths)) {
+      // the recorded tips, not the refs, which may have moved since
+      S.Conflicts = merge(Repo, S.TargetTip, S.BranchTip, Target, Branch,
+                          MergeOpts, std::cout);
+    } else {
+      S.Conflicts = 0;
+    }
+
+    std::cout << Branch << ": " << S.Conflicts << " conflicts";
+    if (Opts.Verbose) {
+      std::cout << (Updated ? " (updated)" : " (recomputed)");
+    }
+    std::cout << "\n";
+    Total += S.Conflicts;
+    Changed[Key] = S;
+  }
+
+  saveState(StatePath, Changed);
+
+  std::cout << "Recomputed " << Recomputed + Incremental << " pairs ("
+            << Incremental << " incrementally), reused " << Reused << "."
+            << std::endl;
+  return Total;
+}
@@ -0,0 +1,106 @@
+#include <algorithm>
+
+#include "mergecheck/thread_pool.hpp"
+
+ThreadPool::ThreadPool(unsigned Threads) {
+  if (Threads == 0) {
+    Threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (unsigned I = 0; I < Threads; ++I) {
+    Queues.emplace_back(new WorkQueue());
+  }
+  for (unsigned I = 0; I < Threads; ++I) {
+    Workers.emplace_back(&ThreadPool::run, this, I);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> Guard(StateLock);
+    Stopping = true;
+  }
+  WorkAvailable.notify_all();
+  for (auto &W : Workers) {
+    W.join();
+  }
+}
+
+void ThreadPool::submit(Task T) {
+  unsigned Target = NextQueue++ % size();
+  {
+    std::lock_guard<std::mutex> Guard(Queues[Target]->Lock);
+    Queues[Target]->Tasks.push_back(std::move(T));
+  }
+  {
+    std::lock_guard<std::mutex> Guard(StateLock);
+    ++Queued;
+    ++Pending;
+  }
+  WorkAvailable.notify_one();
+}
+
+void ThreadPool::wait() {
+  std::unique_lock<std::mutex> Guard(StateLock);
+  AllDone.wait(Guard, [this] { return Pending == 0; });
+  if (FirstError) {
+    std::exception_ptr Error = FirstError;
+    FirstError = nullptr;
+    std::rethrow_exception(Error);
+  }
+}
+
+bool ThreadPool::popOrSteal(unsigned Worker, Task &Out) {
+  // own queue first (most recently submitted task)
+  {
+    WorkQueue &Own = *Queues[Worker];
+    std::lock_guard<std::mutex> Guard(Own.Lock);
+    if (!Own.Tasks.empty()) {
+      Out = std::move(Own.Tasks.back());
+      Own.Tasks.pop_back();
+      return true;
+    }
+  }
+  // steal the oldest task of some other worker
+  for (unsigned I = 1; I < size(); ++I) {
+    WorkQueue &Victim = *Queues[(Worker + I) % size()];
+    std::lock_guard<std::mutex> Guard(Victim.Lock);
+    if (!Victim.Tasks.empty()) {
+      Out = std::move(Victim.Tasks.front());
+      Victim.Tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::run(unsigned Worker) {
+  for (;;) {
+    Task T;
+    if (popOrSteal(Worker, T)) {
+      {
+        std::lock_guard<std::mutex> Guard(StateLock);
+        --Queued;
+      }
+      std::exception_ptr Error;
+      try {
+        T(Worker);
+      } catch (...) {
+        Error = std::current_exception();
+      }
+      std::lock_guard<std::mutex> Guard(StateLock);
+      if (Error && !FirstError) {
+        FirstError = Error;
+      }
+      if (--Pending == 0) {
+        AllDone.notify_all();
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> Guard(StateLock);
+    WorkAvailable.wait(Guard, [this] { return Stopping || Queued > 0; });
+    if (Stopping && Queued <= 0) {
+      return;
+    }
+  }
+}
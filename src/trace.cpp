@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <git2.h>
+#include <sys/resource.h>
+
+#include "mergecheck/trace.hpp"
+#include "mergecheck/utils.hpp"
+
+std::atomic<bool> TracingEnabled(false);
+
+namespace {
+struct TraceEvent {
+  const char *Name;
+  int64_t Index;
+  unsigned Thread;
+  uint64_t Start;
+  uint64_t End;
+};
+
+struct CounterSample {
+  uint64_t Time;
+  size_t Resident;
+  size_t PeakResident;
+  int64_t CachedObjects;
+};
+
+std::mutex TraceLock;
+std::vector<TraceEvent> Events;
+std::vector<CounterSample> Samples;
+uint64_t Origin = 0;
+
+/**
+ * Small, stable per-thread ids for the trace viewer.
+ */
+unsigned threadId() {
+  static std::atomic<unsigned> NextId(0);
+  thread_local unsigned Id = NextId++;
+  return Id;
+}
+
+double toMs(uint64_t Us) { return static_cast<double>(Us) / 1000.0; }
+
+void writeJsonString(std::ostream &O, const char *S) {
+  O << '"';
+  for (; *S; ++S) {
+    if (*S == '"' || *S == '\\') {
+      O << '\\';
+    }
+    O << *S;
+  }
+  O << '"';
+}
+} // namespace
+
+void enableTracing() {
+  std::lock_guard<std::mutex> Guard(TraceLock);
+  if (!Origin) {
+    Origin = TraceScope::now();
+  }
+  TracingEnabled = true;
+}
+
+uint64_t TraceScope::now() {
+  auto Since = std::chrono::steady_clock::now().time_since_epoch();
+  return static_cast<uint64_t>(
+             std::chrono::duration_cast<std::chrono::microseconds>(Since)
+                 .count()) +
+         1;
+}
+
+void TraceScope::record(const char *Name, int64_t Index, uint64_t Start,
+                        uint64_t End) {
+  unsigned Thread = threadId();
+  std::lock_guard<std::mutex> Guard(TraceLock);
+  Events.push_back(TraceEvent{Name, Index, Thread, Start, End});
+}
+
+void traceCounters() {
+  if (!tracing()) {
+    return;
+  }
+  CounterSample Sample{TraceScope::now(), residentMemory(), 0, 0};
+  struct rusage Usage {};
+  if (getrusage(RUSAGE_SELF, &Usage) == 0) {
+    // kilobytes on Linux
+    Sample.PeakResident = static_cast<size_t>(Usage.ru_maxrss) * 1024;
+  }
+  int64_t Allowed = 0;
+  git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &Sample.CachedObjects, &Allowed);
+
+  std::lock_guard<std::mutex> Guard(TraceLock);
+  Samples.push_back(Sample);
+}
+
+void printTimings(std::ostream &O) {
+  traceCounters();
+  std::lock_guard<std::mutex> Guard(TraceLock);
+
+  struct Total {
+    size_t Count = 0;
+    uint64_t Us = 0;
+  };
+  std::map<std::string, Total> Totals;
+  for (const auto &E : Events) {
+    Total &T = Totals[E.Name];
+    ++T.Count;
+    T.Us += E.End - E.Start;
+  }
+
+  O << "Timings:\n";
+  for (const auto &KV : Totals) {
+    O << "  " << KV.first << ": " << toMs(KV.second.Us) << " ms ("
+      << KV.second.Count << "x, " << toMs(KV.second.Us) / KV.second.Count
+      << " ms avg)\n";
+  }
+  for (const auto &E : Events) {
+    if (E.Index >= 0) {
+      O << "  " << E.Name << " " << E.Index << ": " << toMs(E.End - E.Start)
+        << " ms\n";
+    }
+  }
+  if (!Samples.empty()) {
+    const CounterSample &Last = Samples.back();
+    O << "  resident: " << (Last.Resident >> 20) << " MiB, peak "
+      << (Last.PeakResident >> 20) << " MiB, object cache "
+      << (Last.CachedObjects >> 20) << " MiB\n";
+  }
+  O.flush();
+}
+
+bool writeTrace(const std::string &Path) {
+  traceCounters();
+  std::lock_guard<std::mutex> Guard(TraceLock);
+
+  std::ofstream Out(Path, std::ios::trunc);
+  Out << "{\"traceEvents\":[";
+  bool First = true;
+  for (const auto &E : Events) {
+    Out << (First ? "\n" : ",\n") << "{\"name\":";
+    writeJsonString(Out, E.Name);
+    Out << ",\"cat\":\"mergecheck\",\"ph\":\"X\",\"pid\":1,\"tid\":" << E.Thread
+        << ",\"ts\":" << E.Start - Origin << ",\"dur\":" << E.End - E.Start;
+    if (E.Index >= 0) {
+      Out << ",\"args\":{\"index\":" << E.Index << "}";
+    }
+    Out << "}";
+    First = false;
+  }
+  for (const auto &S : Samples) {
+    Out << (First ? "\n" : ",\n")
+        << "{\"name\":\"memory\",\"ph\":\"C\",\"pid\":1,\"ts\":"
+        << S.Time - Origin << ",\"args\":{\"resident\":" << S.Resident
+        << ",\"peak_resident\":" << S.PeakResident
+        << ",\"object_cache\":" << S.CachedObjects << "}}";
+    First = false;
+  }
+  Out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  return static_cast<bool>(Out);
+}
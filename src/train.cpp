@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <iostream>
+
+#include "mergecheck/changed_paths.hpp"
+#include "mergecheck/conflict.hpp"
+#include "mergecheck/handles.hpp"
+#include "mergecheck/inmemory_repo.hpp"
+#include "mergecheck/refs.hpp"
+#include "mergecheck/renames.hpp"
+#include "mergecheck/thread_pool.hpp"
+#include "mergecheck/train.hpp"
+#include "mergecheck/utils.hpp"
+#include "mergecheck/worker_repos.hpp"
+
+namespace {
+/**
+ * Everything about one ref of the train that does not depend on its position.
+ */
+struct TrainEntry {
+  git_oid Tip{};
+  git_oid Base{};
+  bool HasBase = false;
+  /// paths changed between the merge base and the tip
+  std::vector<std::string> Paths;
+  std::string Error;
+};
+
+struct StepResult {
+  std::vector<Conflict> Records;
+};
+
+TreePtr commitTree(git_repository *Repo, const git_oid &Id) {
+  int error;
+
+  git_commit *Raw;
+  error = git_commit_lookup(&Raw, Repo, &Id);
+  checkError(error, "git_commit_lookup");
+  CommitPtr Commit(Raw);
+  git_tree *Tree;
+  error = git_commit_tree(&Tree, Commit.get());
+  checkError(error, "git_commit_tree");
+  return TreePtr(Tree);
+}
+
+void prepareEntry(git_repository *Repo, const git_oid &Target,
+                  const std::string &Ref, TrainEntry &Entry) {
+  int error;
+
+  {
+    CommitPtr Commit(lookupCommit(Repo, Ref));
+    git_oid_cpy(&Entry.Tip, git_commit_id(Commit.get()));
+  }
+
+  error = git_merge_base(&Entry.Base, Repo, &Target, &Entry.Tip);
+  if (error != GIT_ENOTFOUND) {
+    checkError(error, "git_merge_base");
+    Entry.HasBase = true;
+  }
+
+  TreePtr BaseTree;
+  if (Entry.HasBase) {
+    BaseTree = commitTree(Repo, Entry.Base);
+  }
+  TreePtr TipTree = commitTree(Repo, Entry.Tip);
+  changedPaths(Repo, BaseTree.get(), TipTree.get(), Entry.Paths, true);
+}
+
+/**
+ * Merge \p Entries[From, To) one after another into the tree of \p Target,
+ * using the in-memory repository \p Repo. Stops at the first conflicting
+ * entry and returns its index (or \p To). Only the results of entries from
+ * \p ReportFrom on are stored in \p Results.
+ */
+size_t mergeChain(git_repository *Repo, const git_oid &Target,
+                  const std::vector<TrainEntry> &Entries, size_t From,
+                  size_t To, size_t ReportFrom, const CheckOptions &Opts,
+                  std::vector<StepResult> &Results) {
+  int error;
+
+  TreePtr Merged = commitTree(Repo, Target);
+  git_merge_options MergeOpts{};
+  git_merge_init_options(&MergeOpts, GIT_MERGE_OPTIONS_VERSION);
+  setRenameOptions(MergeOpts, Opts.Renames, Opts);
+
+  size_t I = From;
+  for (; I < To; ++I) {
+    const TrainEntry &Entry = Entries[I];
+    IndexPtr Index;
+    {
+      TreePtr BaseTree;
+      if (Entry.HasBase) {
+        BaseTree = commitTree(Repo, Entry.Base);
+      }
+      TreePtr TipTree = commitTree(Repo, Entry.Tip);
+      git_index *Raw;
+      error = git_merge_trees(&Raw, Repo, BaseTree.get(), Merged.get(),
+                              TipTree.get(), &MergeOpts);
+      checkError(error, "git_merge_trees");
+      Index.reset(Raw);
+    }
+
+    bool Conflicting = git_index_has_conflicts(Index.get());
+    if (I >= ReportFrom) {
+      StepResult &Result = Results[I];
+      if (Conflicting) {
+        git_index_conflict_iterator *ConflictIt;
+        git_index_conflict_iterator_new(&ConflictIt, Index.get());
+        IndexConflict C{};
+        while (git_index_conflict_next(&C.Ancestor, &C.Our, &C.Their,
+                                       ConflictIt) == 0) {
+          Result.Records.push_back(toConflict(C));
+        }
+        git_index_conflict_iterator_free(ConflictIt);
+      }
+    }
+    if (Conflicting) {
+      break;
+    }
+
+    // the merged tree only goes to the in-memory backend
+    git_oid MergedId;
+    error = git_index_write_tree_to(&MergedId, Index.get(), Repo);
+    checkError(error, "git_index_write_tree_to");
+    git_tree *Raw;
+    error = git_tree_lookup(&Raw, Repo, &MergedId);
+    checkError(error, "git_tree_lookup");
+    Merged.reset(Raw);
+  }
+
+  return I;
+}
+} // namespace
+
+size_t train(git_repository *Repo, const std::string &RepoPath,
+             const std::string &Target, const std::vector<std::string> &Refs,
+             unsigned Jobs, const CheckOptions &Opts) {
+  git_commit *TargetCommit = lookupCommit(Repo, Target);
+  git_oid TargetId;
+  git_oid_cpy(&TargetId, git_commit_id(TargetCommit));
+  git_commit_free(TargetCommit);
+
+  ThreadPool Pool(Jobs);
+
+  // 1. merge bases and changed paths of all refs
+  std::vector<TrainEntry> Entries(Refs.size());
+  {
+    WorkerRepositories WorkerRepos(Repo, RepoPath, Pool.size());
+    for (size_t I = 0; I < Refs.size(); ++I) {
+      Pool.submit([&, I](unsigned Worker) {
+        try {
+          prepareEntry(WorkerRepos[Worker], TargetId, Refs[I], Entries[I]);
+        } catch (const GitError &Ex) {
+          Entries[I].Error = Ex.what();
+        }
+      });
+    }
+    Pool.wait();
+  }
+  for (size_t I = 0; I < Refs.size(); ++I) {
+    if (!Entries[I].Error.empty()) {
+      throw GitError(GIT_ERROR, Refs[I] + ": " + Entries[I].Error);
+    }
+  }
+
+  // 2. evaluate one segment of the queue per worker, each starting from the
+  // target
+  size_t Segments = std::max<size_t>(
+      1, std::min<size_t>(Pool.size(), Refs.size()));
+  std::vector<size_t> Bounds(Segments + 1);
+  for (size_t S = 0; S <= Segments; ++S) {
+    Bounds[S] = Refs.size() * S / Segments;
+  }
+  if (Opts.Verbose && Segments > 1) {
+    std::cout << "Evaluating " << Refs.size() << " refs speculatively in "
+              << Segments << " segments..." << std::endl;
+  }
+
+  std::vector<StepResult> Results(Refs.size());
+  for (size_t S = 0; S < Segments; ++S) {
+    Pool.submit([&, S](unsigned) {
+      InMemoryRepository Scratch(Repo);
+      mergeChain(Scratch.get(), TargetId, Entries, Bounds[S], Bounds[S + 1],
+                 Bounds[S], Opts, Results);
+    });
+  }
+  Pool.wait();
+
+  // 3. keep segments the earlier merges cannot affect; re-evaluate the rest of
+  // the queue in order otherwise
+  std::vector<std::string> EarlierPaths;
+  size_t First = Refs.size();
+  for (size_t S = 0; S < Segments && First == Refs.size(); ++S) {
+    std::vector<std::string> SegmentPaths;
+    for (size_t I = Bounds[S]; I < Bounds[S + 1]; ++I) {
+      SegmentPaths.insert(SegmentPaths.end(), Entries[I].Paths.begin(),
+                          Entries[I].Paths.end());
+    }
+    if (S > 0 && pathsOverlap(EarlierPaths, SegmentPaths)) {
+      if (Opts.Verbose) {
+        std::cout << "Segment " << S + 1 << " depends on earlier refs, "
+                  << "re-evaluating sequentially..." << std::endl;
+      }
+      std::fill(Results.begin() + Bounds[S], Results.end(), StepResult());
+      InMemoryRepository Scratch(Repo);
+      First = mergeChain(Scratch.get(), TargetId, Entries, 0, Refs.size(),
+                         Bounds[S], Opts, Results);
+      break;
+    }
+    for (size_t I = Bounds[S]; I < Bounds[S + 1]; ++I) {
+      if (!Results[I].Records.empty()) {
+        First = I;
+        break;
+      }
+    }
+    EarlierPaths.insert(EarlierPaths.end(), SegmentPaths.begin(),
+                        SegmentPaths.end());
+  }
+
+  // 4. report
+  for (size_t I = 0; I < Refs.size() && I <= First; ++I) {
+    const StepResult &Result = Results[I];
+    std::cout << I + 1 << " " << Refs[I] << ": ";
+    if (Result.Records.empty()) {
+      std::cout << "clean\n";
+      continue;
+    }
+    std::cout << Result.Records.size() << " conflicts\n";
+    if (Opts.PrintConflicts) {
+      for (const auto &Record : Result.Records) {
+        printConflict(Record, Target, Refs[I], std::cout);
+      }
+    }
+  }
+  if (First < Refs.size()) {
+    std::cout << "First conflict at position " << First + 1 << " ("
+              << Refs[First] << ")." << std::endl;
+    return Results[First].Records.size();
+  }
+  std::cout << "All " << Refs.size() << " refs merge without conflicts."
+            << std::endl;
+  return 0;
+}
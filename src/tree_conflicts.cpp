@@ -0,0 +1,160 @@
+#include <algorithm>
+
+#include "mergecheck/handles.hpp"
+#include "mergecheck/scope.hpp"
+#include "mergecheck/tree_conflicts.hpp"
+#include "mergecheck/utils.hpp"
+
+namespace {
+bool isTree(const git_tree_entry *E) {
+  return E && git_tree_entry_type(E) == GIT_OBJ_TREE;
+}
+
+bool sameTree(const git_tree *A, const git_tree *B) {
+  if (!A || !B) {
+    return A == B;
+  }
+  return git_oid_equal(git_tree_id(A), git_tree_id(B));
+}
+
+bool sameEntry(const git_tree_entry *A, const git_tree_entry *B) {
+  if (!A || !B) {
+    return A == B;
+  }
+  return git_oid_equal(git_tree_entry_id(A), git_tree_entry_id(B)) &&
+         git_tree_entry_filemode(A) == git_tree_entry_filemode(B);
+}
+
+/**
+ * Whether both sides changed a value differently.
+ */
+template <typename T, typename Eq>
+bool diverged(const T &Base, const T &Ours, const T &Theirs, Eq Equal) {
+  return !Equal(Base, Ours) && !Equal(Base, Theirs) && !Equal(Ours, Theirs);
+}
+
+class TreeWalker {
+public:
+  TreeWalker(git_repository *Repo, const std::vector<std::string> &Scope)
+      : Repo(Repo), Scope(Scope) {}
+
+  void walk(const git_tree *Base, const git_tree *Ours, const git_tree *Theirs,
+            const std::string &Prefix) {
+    const git_tree *Trees[] = {Base, Ours, Theirs};
+    for (size_t Side = 0; Side < 3; ++Side) {
+      size_t Count = Trees[Side] ? git_tree_entrycount(Trees[Side]) : 0;
+      for (size_t I = 0; I < Count; ++I) {
+        const char *Name =
+            git_tree_entry_name(git_tree_entry_byindex(Trees[Side], I));
+        // every name is visited from the first side that has it
+        bool Seen = false;
+        for (size_t Earlier = 0; Earlier < Side && !Seen; ++Earlier) {
+          Seen = Trees[Earlier] &&
+                 git_tree_entry_byname(Trees[Earlier], Name) != nullptr;
+        }
+        if (Seen) {
+          continue;
+        }
+        visit(lookup(Base, Name), lookup(Ours, Name), lookup(Theirs, Name),
+              Prefix + Name);
+      }
+    }
+  }
+
+  std::vector<Conflict> Conflicts;
+
+private:
+  static const git_tree_entry *lookup(const git_tree *Tree, const char *Name) {
+    return Tree ? git_tree_entry_byname(Tree, Name) : nullptr;
+  }
+
+  TreePtr subtree(const git_tree_entry *E) {
+    if (!E) {
+      return nullptr;
+    }
+    git_tree *Raw;
+    int error = git_tree_lookup(&Raw, Repo, git_tree_entry_id(E));
+    checkError(error, "git_tree_lookup");
+    return TreePtr(Raw);
+  }
+
+  void visit(const git_tree_entry *B, const git_tree_entry *O,
+             const git_tree_entry *T, const std::string &Path) {
+    // unchanged on one side, or changed the same way on both
+    if (sameEntry(B, O) || sameEntry(B, T) || sameEntry(O, T)) {
+      return;
+    }
+    if (!touchesScope(Path, Scope)) {
+      return;
+    }
+
+    if ((!B || isTree(B)) && (!O || isTree(O)) && (!T || isTree(T))) {
+      TreePtr BaseTree = subtree(B), OurTree = subtree(O),
+              TheirTree = subtree(T);
+      walk(BaseTree.get(), OurTree.get(), TheirTree.get(), Path + "/");
+      return;
+    }
+
+    // a file on at least one side; directories are treated as absent
+    bool Added = B == nullptr;
+    B = isTree(B) ? nullptr : B;
+    O = isTree(O) ? nullptr : O;
+    T = isTree(T) ? nullptr : T;
+    if (B && O && T) {
+      // like a content merge, take a change of only the id or only the mode
+      // from the side that made it
+      auto SameId = [](const git_tree_entry *X, const git_tree_entry *Y) {
+        return git_oid_equal(git_tree_entry_id(X), git_tree_entry_id(Y));
+      };
+      auto SameMode = [](const git_tree_entry *X, const git_tree_entry *Y) {
+        return git_tree_entry_filemode(X) == git_tree_entry_filemode(Y);
+      };
+      if (!diverged(B, O, T, SameId) && !diverged(B, O, T, SameMode)) {
+        return;
+      }
+    }
+
+    ConflictKind Kind = ConflictKind::Content;
+    if (Added) {
+      Kind = ConflictKind::AddAdd;
+    } else if (!O) {
+      Kind = ConflictKind::DeletedInOurs;
+    } else if (!T) {
+      Kind = ConflictKind::DeletedInTheirs;
+    }
+    Conflict C{Kind, Path, {}, {}, {}, 0, 0, 0};
+    if (B) {
+      git_oid_cpy(&C.AncestorId, git_tree_entry_id(B));
+      C.AncestorMode = git_tree_entry_filemode(B);
+    }
+    if (O) {
+      git_oid_cpy(&C.OurId, git_tree_entry_id(O));
+      C.OurMode = git_tree_entry_filemode(O);
+    }
+    if (T) {
+      git_oid_cpy(&C.TheirId, git_tree_entry_id(T));
+      C.TheirMode = git_tree_entry_filemode(T);
+    }
+    Conflicts.push_back(std::move(C));
+  }
+
+  git_repository *Repo;
+  const std::vector<std::string> &Scope;
+};
+} // namespace
+
+std::vector<Conflict> treeConflicts(git_repository *Repo, const git_tree *Base,
+                                    const git_tree *Ours,
+                                    const git_tree *Theirs,
+                                    const std::vector<std::string> &Scope) {
+  TreeWalker Walker(Repo, Scope);
+  if (!sameTree(Base, Ours) && !sameTree(Base, Theirs) &&
+      !sameTree(Ours, Theirs)) {
+    Walker.walk(Base, Ours, Theirs, "");
+  }
+  // in index order, like the conflicts of a merge
+  std::sort(
+      Walker.Conflicts.begin(), Walker.Conflicts.end(),
+      [](const Conflict &A, const Conflict &B) { return A.Path < B.Path; });
+  return std::move(Walker.Conflicts);
+}
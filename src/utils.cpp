@@ -1,4 +1,10 @@
-#include <iostream>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
 
 #include <git2.h>
 
@@ -10,8 +16,55 @@ void checkError(int ErrorCode, const std::string &Action) {
     return;
   }
 
-  std::cerr << "Error " << ErrorCode << " " << Action << " - "
-            << ((Error && Error->message) ? Error->message : "???") << "\n";
+  std::ostringstream Message;
+  Message << "Error " << ErrorCode << " " << Action << " - "
+          << ((Error && Error->message) ? Error->message : "???");
+
+  throw GitError(ErrorCode, Message.str());
+}
+
+std::string oidString(const git_oid &Oid) {
+  char Hex[GIT_OID_HEXSZ + 1];
+  git_oid_tostr(Hex, sizeof(Hex), &Oid);
+  return Hex;
+}
+
+size_t residentMemory() {
+  std::ifstream Statm("/proc/self/statm");
+  size_t Size = 0, Resident = 0;
+  if (!(Statm >> Size >> Resident)) {
+    return 0;
+  }
+  return Resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
 
-  exit(EXIT_FAILURE);
+bool writeAll(int Fd, const std::string &Data) {
+  const char *Ptr = Data.data();
+  size_t Left = Data.size();
+  while (Left > 0) {
+    ssize_t Written = ::write(Fd, Ptr, Left);
+    if (Written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (Written <= 0) {
+      return false;
+    }
+    Ptr += Written;
+    Left -= static_cast<size_t>(Written);
+  }
+  return true;
+}
+
+FileLock::FileLock(const std::string &Path)
+    : Fd(::open(Path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)) {
+  if (Fd >= 0) {
+    while (::flock(Fd, LOCK_EX) < 0 && errno == EINTR) {
+    }
+  }
+}
+
+FileLock::~FileLock() {
+  if (Fd >= 0) {
+    ::close(Fd); // releases the lock
+  }
 }
@@ -0,0 +1,32 @@
+#include "mergecheck/worker_repos.hpp"
+#include "mergecheck/utils.hpp"
+
+WorkerRepositories::WorkerRepositories(git_repository *Repo,
+                                       const std::string &RepoPath,
+                                       unsigned Workers) {
+  int error;
+
+  error = git_repository_odb(&SharedOdb, Repo);
+  checkError(error, "git_repository_odb");
+
+  Repos.resize(Workers, nullptr);
+  for (auto &WorkerRepo : Repos) {
+    error = git_repository_open(&WorkerRepo, RepoPath.c_str());
+    if (error) {
+      release();
+    }
+    checkError(error, "opening repository");
+    git_repository_set_odb(WorkerRepo, SharedOdb);
+  }
+}
+
+WorkerRepositories::~WorkerRepositories() { release(); }
+
+void WorkerRepositories::release() {
+  for (auto *WorkerRepo : Repos) {
+    git_repository_free(WorkerRepo);
+  }
+  Repos.clear();
+  git_odb_free(SharedOdb);
+  SharedOdb = nullptr;
+}
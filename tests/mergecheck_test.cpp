@@ -0,0 +1,500 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include <git2.h>
+
+#include "mergecheck/changed_paths.hpp"
+#include "mergecheck/checker.hpp"
+#include "mergecheck/handles.hpp"
+#include "mergecheck/path_index.hpp"
+#include "mergecheck/result_cache.hpp"
+#include "mergecheck/status.hpp"
+#include "mergecheck/utils.hpp"
+#include "repo_generator.hpp"
+
+namespace {
+size_t Failures = 0;
+
+void expect(bool Condition, const std::string &What) {
+  if (!Condition) {
+    std::cerr << "FAILED: " << What << "\n";
+    ++Failures;
+  }
+}
+
+int removeEntry(const char *Path, const struct stat *, int, struct FTW *) {
+  return ::remove(Path);
+}
+
+void removeTree(const std::string &Path) {
+  nftw(Path.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+size_t fileSize(const std::string &Path) {
+  struct stat St {};
+  return ::stat(Path.c_str(), &St) == 0 ? static_cast<size_t>(St.st_size) : 0;
+}
+
+std::string readFile(const std::string &Path) {
+  std::ifstream In(Path, std::ios::binary);
+  std::ostringstream Out;
+  Out << In.rdbuf();
+  return Out.str();
+}
+
+void writeFile(const std::string &Path, const std::string &Data,
+               bool Append = false) {
+  std::ofstream Out(Path, std::ios::binary |
+                              (Append ? std::ios::app : std::ios::trunc));
+  Out << Data;
+}
+
+bool sameConflicts(std::vector<Conflict> A, std::vector<Conflict> B) {
+  auto ByPath = [](const Conflict &X, const Conflict &Y) {
+    return X.Path < Y.Path;
+  };
+  std::sort(A.begin(), A.end(), ByPath);
+  std::sort(B.begin(), B.end(), ByPath);
+  if (A.size() != B.size()) {
+    return false;
+  }
+  for (size_t I = 0; I < A.size(); ++I) {
+    if (A[I].Kind != B[I].Kind || A[I].Path != B[I].Path ||
+        !git_oid_equal(&A[I].AncestorId, &B[I].AncestorId) ||
+        !git_oid_equal(&A[I].OurId, &B[I].OurId) ||
+        !git_oid_equal(&A[I].TheirId, &B[I].TheirId) ||
+        A[I].AncestorMode != B[I].AncestorMode ||
+        A[I].OurMode != B[I].OurMode || A[I].TheirMode != B[I].TheirMode) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool hasConflict(const std::vector<Conflict> &Conflicts,
+                 const std::string &Path) {
+  for (const auto &C : Conflicts) {
+    if (C.Path == Path) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Commit the files \p Files (path -> content) as the whole tree, with the
+ * parent \p Parent (may be nullptr), and point \p Ref at the commit.
+ */
+git_oid commitFiles(git_repository *Repo, const std::string &Ref,
+                    const git_oid *Parent,
+                    const std::map<std::string, std::string> &Files) {
+  int error;
+
+  git_treebuilder *Builder;
+  error = git_treebuilder_new(&Builder, Repo, nullptr);
+  checkError(error, "git_treebuilder_new");
+  git_oid EmptyId;
+  error = git_treebuilder_write(&EmptyId, Builder);
+  git_treebuilder_free(Builder);
+  checkError(error, "git_treebuilder_write");
+  git_tree *Raw;
+  error = git_tree_lookup(&Raw, Repo, &EmptyId);
+  checkError(error, "git_tree_lookup");
+  TreePtr Empty(Raw);
+
+  std::vector<git_tree_update> Updates;
+  for (const auto &KV : Files) {
+    git_tree_update Update{};
+    Update.action = GIT_TREE_UPDATE_UPSERT;
+    Update.filemode = GIT_FILEMODE_BLOB;
+    Update.path = KV.first.c_str();
+    error = git_blob_create_frombuffer(&Update.id, Repo, KV.second.data(),
+                                       KV.second.size());
+    checkError(error, "git_blob_create_frombuffer");
+    Updates.push_back(Update);
+  }
+  git_oid TreeId;
+  error = git_tree_create_updated(&TreeId, Repo, Empty.get(), Updates.size(),
+                                  Updates.data());
+  checkError(error, "git_tree_create_updated");
+  error = git_tree_lookup(&Raw, Repo, &TreeId);
+  checkError(error, "git_tree_lookup");
+  TreePtr Tree(Raw);
+
+  CommitPtr ParentCommit;
+  if (Parent) {
+    git_commit *RawParent;
+    error = git_commit_lookup(&RawParent, Repo, Parent);
+    checkError(error, "git_commit_lookup");
+    ParentCommit.reset(RawParent);
+  }
+  const git_commit *Parents[] = {ParentCommit.get()};
+
+  git_signature *Signature;
+  error = git_signature_new(&Signature, "mergecheck-test", "test@localhost",
+                            1500000000, 0);
+  checkError(error, "git_signature_new");
+  git_oid Id;
+  error = git_commit_create(&Id, Repo, Ref.c_str(), Signature, Signature,
+                            nullptr, "test commit", Tree.get(), Parent ? 1 : 0,
+                            Parents);
+  git_signature_free(Signature);
+  checkError(error, "git_commit_create");
+  return Id;
+}
+
+/**
+ * Merge \p Branch into \p Master in one piece and on \p Jobs shards and
+ * compare the conflicts.
+ */
+void expectShardedEqual(Checker &C, const std::string &Master,
+                        const std::string &Branch, unsigned Jobs,
+                        std::vector<Conflict> *Single = nullptr) {
+  CheckOptions Opts;
+  Opts.Prefilter = false;
+  std::vector<Conflict> Expected, Sharded;
+  Status S = C.merge(Master, Branch, Opts, Expected);
+  expect(S.ok(), "single merge of " + Branch + ": " + S.Message);
+  Opts.MergeJobs = Jobs;
+  S = C.merge(Master, Branch, Opts, Sharded);
+  expect(S.ok(), "sharded merge of " + Branch + ": " + S.Message);
+  expect(sameConflicts(Expected, Sharded),
+         "sharded merge of " + Branch + " on " + std::to_string(Jobs) +
+             " jobs matches a single merge");
+  if (Single) {
+    *Single = std::move(Expected);
+  }
+}
+
+void testShardedMerge(const std::string &WorkDir) {
+  // root-level files only, one level of directories, and moved files, which
+  // make the sharded merge fall back to a single one
+  std::vector<RepoShape> Shapes(3);
+  Shapes[0].Files = 200;
+  Shapes[0].Depth = 0;
+  Shapes[1].Files = 400;
+  Shapes[1].Depth = 1;
+  Shapes[2].Files = 400;
+  Shapes[2].Depth = 2;
+  Shapes[2].RenameRate = 0.3;
+  for (size_t I = 0; I < Shapes.size(); ++I) {
+    Shapes[I].History = 6;
+    Shapes[I].Branches = 6;
+    Shapes[I].BranchCommits = 2;
+    Shapes[I].FileSize = 512;
+    Shapes[I].ConflictRate = 0.5;
+    Shapes[I].Seed = I + 1;
+
+    std::string Path = WorkDir + "/sharded-" + std::to_string(I) + ".git";
+    GeneratedRepo Repo = generateRepo(Path, Shapes[I]);
+    std::unique_ptr<Checker> C;
+    Status S = Checker::open(Path, C);
+    expect(S.ok(), "open " + Path + ": " + S.Message);
+    if (!S.ok()) {
+      continue;
+    }
+    for (size_t B = 0; B < Repo.Branches.size(); ++B) {
+      std::vector<Conflict> Single;
+      expectShardedEqual(*C, Repo.Master, Repo.Branches[B], 8, &Single);
+      expectShardedEqual(*C, Repo.Master, Repo.Branches[B], 2);
+      if (Shapes[I].RenameRate == 0) {
+        expect(Single.empty() != Repo.Conflicting[B],
+               Repo.Branches[B] + " conflicts as generated");
+      }
+    }
+  }
+}
+
+void testShardedDirectoryFile(const std::string &WorkDir) {
+  std::string Path = WorkDir + "/directory-file.git";
+  git_repository *Raw;
+  int error = git_repository_init(&Raw, Path.c_str(), 1);
+  checkError(error, "git_repository_init");
+  RepositoryPtr Repo(Raw);
+
+  // "lib" is replaced by a file on one side and changed on the other, so the
+  // root shard and the "lib/" shard touch the same path
+  git_oid Base = commitFiles(Repo.get(), "refs/heads/base", nullptr,
+                             {{"README", "base\n"},
+                              {"doc/a.txt", "a\n"},
+                              {"lib/x.c", "x\n"},
+                              {"src/y.c", "y\n"}});
+  commitFiles(Repo.get(), "refs/heads/ours", &Base,
+              {{"README", "ours\n"},
+               {"doc/a.txt", "a ours\n"},
+               {"lib", "file\n"},
+               {"src/y.c", "y\n"}});
+  commitFiles(Repo.get(), "refs/heads/theirs", &Base,
+              {{"README", "theirs\n"},
+               {"doc/a.txt", "a theirs\n"},
+               {"lib/x.c", "x theirs\n"},
+               {"src/y.c", "y\n"}});
+  Repo.reset();
+
+  std::unique_ptr<Checker> C;
+  Status S = Checker::open(Path, C);
+  expect(S.ok(), "open " + Path + ": " + S.Message);
+  if (!S.ok()) {
+    return;
+  }
+  std::vector<Conflict> Single;
+  expectShardedEqual(*C, "refs/heads/ours", "refs/heads/theirs", 8, &Single);
+  expect(hasConflict(Single, "README"), "root-level file conflicts");
+  expect(hasConflict(Single, "doc/a.txt"), "file in a subtree conflicts");
+}
+
+MergeKey mergeKey(unsigned char Byte) {
+  MergeKey Key{};
+  std::memset(Key.Base.id, Byte, GIT_OID_RAWSZ);
+  std::memset(Key.Ours.id, Byte + 1, GIT_OID_RAWSZ);
+  std::memset(Key.Theirs.id, Byte + 2, GIT_OID_RAWSZ);
+  return Key;
+}
+
+void testResultCacheTornTail(const std::string &WorkDir) {
+  std::string GitDir = WorkDir + "/cache";
+  ::mkdir(GitDir.c_str(), 0755);
+  std::string DataPath = GitDir + "/mergecheck/results";
+
+  Conflict Stored{ConflictKind::Content, "src/a.c", {}, {}, {}, 0100644,
+                  0100644, 0100644};
+  std::memset(Stored.OurId.id, 7, GIT_OID_RAWSZ);
+  MergeKey First = mergeKey(1), Second = mergeKey(4);
+  {
+    ResultCache Cache(GitDir);
+    Cache.store(First, {Stored});
+  }
+  size_t Size = fileSize(DataPath);
+
+  // a record whose payload never made it to the file
+  // "MCR3" in host byte order, like the cache writes it
+  uint32_t Magic = 0x3352434d, PayloadSize = 1000, Sum = 0;
+  std::string Torn(reinterpret_cast<const char *>(&Magic), 4);
+  Torn.append(reinterpret_cast<const char *>(&PayloadSize), 4);
+  Torn.append(reinterpret_cast<const char *>(&Sum), 4);
+  Torn += "partial";
+  writeFile(DataPath, Torn, true);
+
+  {
+    ResultCache Cache(GitDir);
+    std::vector<Conflict> Found;
+    expect(Cache.lookup(First, Found) && sameConflicts(Found, {Stored}),
+           "record before a torn tail is read");
+    Cache.store(Second, {});
+  }
+  expect(readFile(DataPath).find("partial") == std::string::npos,
+         "torn tail is truncated before appending");
+  expect(fileSize(DataPath) > Size, "record is appended after the tail");
+  {
+    ResultCache Cache(GitDir);
+    std::vector<Conflict> Found;
+    expect(Cache.lookup(First, Found) && sameConflicts(Found, {Stored}),
+           "first record survives the truncation");
+    expect(Cache.lookup(Second, Found) && Found.empty(),
+           "record appended after the truncation is read");
+  }
+}
+
+void testPathIndexSaturation(const std::string &WorkDir) {
+  // the initial commit adds more files than a filter holds
+  RepoShape Shape;
+  Shape.Files = 600;
+  Shape.Depth = 1;
+  Shape.History = 3;
+  Shape.Branches = 1;
+  Shape.FileSize = 128;
+  std::string Path = WorkDir + "/path-index.git";
+  GeneratedRepo Generated = generateRepo(Path, Shape);
+
+  git_repository *Raw;
+  int error = git_repository_open(&Raw, Path.c_str());
+  checkError(error, "git_repository_open");
+  RepositoryPtr Repo(Raw);
+  std::ostream Discard(nullptr);
+  updatePathIndex(Repo.get(), Path, 2, false, Discard);
+  PathIndex Index(git_repository_path(Repo.get()));
+
+  git_oid TipId;
+  error =
+      git_reference_name_to_id(&TipId, Repo.get(), Generated.Master.c_str());
+  checkError(error, "git_reference_name_to_id");
+  git_commit *RawCommit;
+  error = git_commit_lookup(&RawCommit, Repo.get(), &TipId);
+  checkError(error, "git_commit_lookup");
+  CommitPtr Tip(RawCommit);
+  error = git_commit_lookup(&RawCommit, Repo.get(), &TipId);
+  checkError(error, "git_commit_lookup");
+  CommitPtr Root(RawCommit);
+  while (git_commit_parentcount(Root.get()) > 0) {
+    error = git_commit_parent(&RawCommit, Root.get(), 0);
+    checkError(error, "git_commit_parent");
+    Root.reset(RawCommit);
+  }
+
+  const git_oid *RootId = git_commit_id(Root.get());
+  expect(Index.hasFilter(*RootId), "initial commit is indexed");
+  expect(Index.mayOverlap(*RootId, PathIndex::query("no/such/file")),
+         "saturated filter answers positively");
+
+  // a commit of a few files has a real filter: no false negatives, and
+  // unrelated paths are mostly rejected
+  git_commit *RawParent;
+  error = git_commit_parent(&RawParent, Tip.get(), 0);
+  checkError(error, "git_commit_parent");
+  CommitPtr TipParent(RawParent);
+  git_tree *RawTree;
+  error = git_commit_tree(&RawTree, TipParent.get());
+  checkError(error, "git_commit_tree");
+  TreePtr OldTree(RawTree);
+  error = git_commit_tree(&RawTree, Tip.get());
+  checkError(error, "git_commit_tree");
+  TreePtr NewTree(RawTree);
+  std::vector<std::string> Changed;
+  changedPaths(Repo.get(), OldTree.get(), NewTree.get(), Changed, true);
+  expect(!Changed.empty(), "tip commit changes files");
+  for (const auto &P : Changed) {
+    expect(Index.mayOverlap(TipId, PathIndex::query(P)),
+           "filter of the tip contains " + P);
+  }
+  size_t Rejected = 0;
+  for (size_t I = 0; I < 64; ++I) {
+    std::string Unrelated = "unrelated/" + std::to_string(I) + ".txt";
+    Rejected += !Index.mayOverlap(TipId, PathIndex::query(Unrelated));
+  }
+  expect(Rejected > 0, "filter of the tip rejects unrelated paths");
+}
+
+/**
+ * Run status() with its output in \p Output.
+ */
+size_t runStatus(git_repository *Repo, const GeneratedRepo &Generated,
+                 const CheckOptions &Opts, std::string &Output) {
+  std::ostringstream Captured;
+  std::streambuf *Saved = std::cout.rdbuf(Captured.rdbuf());
+  size_t Total = 0;
+  try {
+    Total = status(Repo, Generated.Master, Generated.Branches, Opts);
+  } catch (...) {
+    std::cout.rdbuf(Saved);
+    throw;
+  }
+  std::cout.rdbuf(Saved);
+  Output = Captured.str();
+  return Total;
+}
+
+size_t countPairs(const std::string &State) {
+  size_t Pairs = 0;
+  std::istringstream In(State);
+  for (std::string Line; std::getline(In, Line);) {
+    Pairs += Line.compare(0, 5, "pair\t") == 0;
+  }
+  return Pairs;
+}
+
+void testStatusState(const std::string &WorkDir) {
+  RepoShape Shape;
+  Shape.Files = 100;
+  Shape.History = 6;
+  Shape.Branches = 4;
+  Shape.BranchCommits = 2;
+  Shape.FileSize = 256;
+  Shape.ConflictRate = 0.5;
+  std::string Path = WorkDir + "/status.git";
+  GeneratedRepo Generated = generateRepo(Path, Shape);
+
+  std::unique_ptr<Checker> C;
+  Status S = Checker::open(Path, C);
+  expect(S.ok(), "open " + Path + ": " + S.Message);
+  if (!S.ok()) {
+    return;
+  }
+  size_t Expected = 0;
+  CheckOptions Opts;
+  for (const auto &Branch : Generated.Branches) {
+    std::vector<Conflict> Conflicts;
+    S = C->merge(Generated.Master, Branch, Opts, Conflicts);
+    expect(S.ok(), "merge of " + Branch + ": " + S.Message);
+    Expected += Conflicts.size();
+  }
+
+  git_repository *Repo = C->repository();
+  std::string StatePath =
+      std::string(git_repository_path(Repo)) + "mergecheck/status";
+  std::string Output;
+  size_t Pairs = Generated.Branches.size();
+  expect(runStatus(Repo, Generated, Opts, Output) == Expected,
+         "status counts the conflicts of the merges");
+  std::string State = readFile(StatePath);
+  expect(State.compare(0, 20, "mergecheck status 2\n") == 0,
+         "state file starts with its header");
+  expect(countPairs(State) == Pairs, "state file has one record per pair");
+
+  // pairs are keyed by the options, and the other options' pairs are kept
+  CheckOptions NoRenames = Opts;
+  NoRenames.Renames = RenameMode::Off;
+  runStatus(Repo, Generated, NoRenames, Output);
+  expect(Output.find("reused 0.") != std::string::npos,
+         "other options recompute the pairs");
+  expect(countPairs(readFile(StatePath)) == 2 * Pairs,
+         "pairs of both option sets are stored");
+  expect(runStatus(Repo, Generated, Opts, Output) == Expected &&
+             Output.find("reused " + std::to_string(Pairs) + ".") !=
+                 std::string::npos,
+         "unchanged pairs are reused");
+
+  // older or torn state is recomputed
+  writeFile(StatePath, "mergecheck status 1\npair\tgarbage\n");
+  expect(runStatus(Repo, Generated, Opts, Output) == Expected &&
+             Output.find("reused 0.") != std::string::npos,
+         "older state file is recomputed");
+  expect(readFile(StatePath).compare(0, 20, "mergecheck status 2\n") == 0,
+         "older state file is rewritten");
+  State = readFile(StatePath);
+  writeFile(StatePath, State.substr(0, State.size() / 2));
+  expect(runStatus(Repo, Generated, Opts, Output) == Expected,
+         "torn state file is recomputed");
+}
+} // namespace
+
+int main() {
+  char Template[] = "/tmp/mergecheck-test-XXXXXX";
+  if (!mkdtemp(Template)) {
+    std::cerr << "Error: Could not create a temporary directory.\n";
+    return EXIT_FAILURE;
+  }
+  std::string WorkDir = Template;
+
+  git_libgit2_init();
+  int ExitCode = EXIT_SUCCESS;
+  try {
+    testShardedMerge(WorkDir);
+    testShardedDirectoryFile(WorkDir);
+    testResultCacheTornTail(WorkDir);
+    testPathIndexSaturation(WorkDir);
+    testStatusState(WorkDir);
+  } catch (const GitError &Ex) {
+    std::cerr << Ex.what() << "\n";
+    ExitCode = EXIT_FAILURE;
+  }
+  git_libgit2_shutdown();
+  removeTree(WorkDir);
+
+  if (Failures) {
+    std::cerr << Failures << " checks failed.\n";
+    ExitCode = EXIT_FAILURE;
+  }
+  return ExitCode;
+}